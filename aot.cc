@@ -0,0 +1,448 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <dlfcn.h>
+#include "interpret.hh"
+#include "globals.hh"
+#include "predecode.hh"
+#include "jit.hh"
+#include "aot.hh"
+
+namespace {
+  /* the helpers generated code calls, filled in by the loader */
+  struct aot_env {
+    jit_ret (*load)(state_t *, int64_t, uint64_t, uint64_t, uint64_t);
+    uint64_t (*store)(state_t *, int64_t, int64_t, uint64_t, uint64_t, uint64_t);
+    int64_t (*alu)(uint64_t, uint64_t, uint64_t, int64_t);
+    void (*link)(state_t *, uint64_t, uint64_t, uint64_t);
+  };
+
+  const char *prelude = R"(/* generated by interp_rv64 --aot_out */
+#include <stdint.h>
+typedef struct { int64_t value; uint64_t fault; } jit_ret;
+struct aot_env {
+  jit_ret (*load)(void *, int64_t, uint64_t, uint64_t, uint64_t);
+  uint64_t (*store)(void *, int64_t, int64_t, uint64_t, uint64_t, uint64_t);
+  int64_t (*alu)(uint64_t, uint64_t, uint64_t, int64_t);
+  void (*link)(void *, uint64_t, uint64_t, uint64_t);
+};
+struct aot_env aot_env;
+struct aot_block {
+  uint64_t pc;
+  uint32_t len;
+  uint32_t code_bytes;
+  const uint8_t *code;
+  void (*fn)(void *, int64_t *, uint64_t);
+};
+)";
+
+  bool is_cti(uint8_t op) {
+    return (op >= pd_jal) and (op <= pd_bgeu);
+  }
+
+  bool writes_rd(const pd_insn &d) {
+    return (d.rd != 0) and (d.op != pd_nop) and
+      not((d.op >= pd_beq) and (d.op <= pd_bgeu)) and
+      not((d.op >= pd_sb) and (d.op <= pd_sd));
+  }
+
+  /* offsets of the state the generated code touches and the op
+   * numbering it passes to the helpers */
+  uint64_t abi(const state_t *s) {
+    const uint8_t *b = reinterpret_cast<const uint8_t*>(s);
+    uint64_t off_pc = reinterpret_cast<const uint8_t*>(&s->pc) - b;
+    uint64_t off_icnt = reinterpret_cast<const uint8_t*>(&s->icnt) - b;
+    uint64_t off_last_call = reinterpret_cast<const uint8_t*>(&s->last_call) - b;
+    return off_pc | (off_icnt << 16) | (off_last_call << 32) |
+      (static_cast<uint64_t>(pd_num_ops) << 48);
+  }
+
+  std::string hex(uint64_t x) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "0x%lxULL", x);
+    return buf;
+  }
+
+  std::string reg(int r) {
+    return r ? ("x" + std::to_string(r)) : std::string("0");
+  }
+
+  /* a path as one shell word */
+  std::string quote(const std::string &p) {
+    std::string q = "'";
+    for(char c : p) {
+      q += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+    }
+    return q + "'";
+  }
+
+  /* C for the alu ops with a cheap expression in a, b and i, the
+   * rest call the interpreter's op through jit_alu */
+  const char *alu_expr(uint8_t op) {
+    switch(op)
+      {
+      case pd_addi: return "a + i";
+      case pd_slti: return "(int64_t)a < i";
+      case pd_sltiu: return "a < (uint64_t)i";
+      case pd_xori: return "a ^ i";
+      case pd_ori: return "a | i";
+      case pd_andi: return "a & i";
+      case pd_slli: return "a << i";
+      case pd_srli: return "a >> i";
+      case pd_srai: return "(int64_t)a >> i";
+      case pd_addiw: return "(int64_t)(int32_t)(a + i)";
+      case pd_slliw: return "(int64_t)(int32_t)(a << i)";
+      case pd_srliw: return "(int64_t)(int32_t)((uint32_t)a >> i)";
+      case pd_sraiw: return "(int64_t)((int32_t)a >> i)";
+      case pd_slliuw: return "(uint64_t)(uint32_t)a << i";
+      case pd_bseti: return "a | (1ULL << i)";
+      case pd_bclri: return "a & ~(1ULL << i)";
+      case pd_binvi: return "a ^ (1ULL << i)";
+      case pd_bexti: return "(a >> i) & 1";
+      case pd_cpop: return "__builtin_popcountll(a)";
+      case pd_cpopw: return "__builtin_popcount((uint32_t)a)";
+      case pd_sextb: return "(int64_t)(int8_t)a";
+      case pd_sexth: return "(int64_t)(int16_t)a";
+      case pd_zexth: return "(uint16_t)a";
+      case pd_rev8: return "__builtin_bswap64(a)";
+      case pd_add: return "a + b";
+      case pd_sub: return "a - b";
+      case pd_sll: return "a << (b & 63)";
+      case pd_slt: return "(int64_t)a < (int64_t)b";
+      case pd_sltu: return "a < b";
+      case pd_xor: return "a ^ b";
+      case pd_srl: return "a >> (b & 63)";
+      case pd_sra: return "(int64_t)a >> (b & 63)";
+      case pd_or: return "a | b";
+      case pd_and: return "a & b";
+      case pd_addw: return "(int64_t)(int32_t)(a + b)";
+      case pd_subw: return "(int64_t)(int32_t)(a - b)";
+      case pd_sllw: return "(int64_t)(int32_t)(a << (b & 31))";
+      case pd_srlw: return "(int64_t)(int32_t)((uint32_t)a >> (b & 31))";
+      case pd_sraw: return "(int64_t)((int32_t)a >> (b & 31))";
+      case pd_mul: return "a * b";
+      case pd_mulw: return "(int64_t)(int32_t)(a * b)";
+      case pd_mulh: return "((__int128)(int64_t)a * (int64_t)b) >> 64";
+      case pd_mulhu: return "((unsigned __int128)a * b) >> 64";
+      case pd_sh1add: return "(a << 1) + b";
+      case pd_sh2add: return "(a << 2) + b";
+      case pd_sh3add: return "(a << 3) + b";
+      case pd_adduw: return "(uint64_t)(uint32_t)a + b";
+      case pd_sh1adduw: return "((uint64_t)(uint32_t)a << 1) + b";
+      case pd_sh2adduw: return "((uint64_t)(uint32_t)a << 2) + b";
+      case pd_sh3adduw: return "((uint64_t)(uint32_t)a << 3) + b";
+      case pd_andn: return "a & ~b";
+      case pd_orn: return "a | ~b";
+      case pd_xnor: return "~(a ^ b)";
+      case pd_min: return "((int64_t)a < (int64_t)b) ? a : b";
+      case pd_minu: return "(a < b) ? a : b";
+      case pd_max: return "((int64_t)a > (int64_t)b) ? a : b";
+      case pd_maxu: return "(a > b) ? a : b";
+      default: return nullptr;
+      }
+  }
+
+  const char *branch_cond(uint8_t op) {
+    switch(op)
+      {
+      case pd_beq: return "a == b";
+      case pd_bne: return "a != b";
+      case pd_blt: return "(int64_t)a < (int64_t)b";
+      case pd_bge: return "(int64_t)a >= (int64_t)b";
+      case pd_bltu: return "a < b";
+      default: return "a >= b";
+      }
+  }
+
+  /* one block function, same exits as a jit block: the pc is written
+   * and icnt advanced by the block length unless a helper already
+   * retired part of the block and ended it */
+  void emit_block(std::ostream &o, uint64_t head, const std::vector<pd_insn> &insns) {
+    const uint64_t n = insns.size();
+    std::set<int> used, written;
+    for(const pd_insn &d : insns) {
+      used.insert(d.rs1);
+      used.insert(d.rs2);
+      if(writes_rd(d)) {
+	used.insert(d.rd);
+	written.insert(d.rd);
+      }
+    }
+    used.erase(0);
+    o << "static void b_" << std::hex << head << std::dec
+      << "(void *s, int64_t *gpr, uint64_t stop) {\n";
+    for(int r : used) {
+      o << "  uint64_t " << reg(r) << " = gpr[" << r << "];\n";
+    }
+    o << "  jit_ret r;\n  uint64_t t;\n top:\n";
+
+    auto link = [&](uint64_t pc, int rd, int rs1) {
+      o << "  LAST_CALL(s) = " << hex(pc) << ";\n";
+      bool rd_is_link = (rd == 1) or (rd == 5);
+      bool rs1_is_link = (rs1 == 1) or (rs1 == 5);
+      if(rd_is_link or ((rd == 0) and rs1_is_link)) {
+	o << "  aot_env.link(s, " << hex(pc) << ", " << rd << ", " << rs1 << ");\n";
+      }
+    };
+    auto jump = [&](uint64_t tgt) {
+      if(tgt == head) {
+	o << "  t = ICNT(s) + " << n << ";\n  ICNT(s) = t;\n"
+	  << "  if((t + " << n << ") <= stop) goto top;\n"
+	  << "  PC(s) = " << hex(head) << ";\n  goto exit_wb;\n";
+      }
+      else {
+	o << "  PC(s) = " << hex(tgt) << ";\n  goto exit_len;\n";
+      }
+    };
+
+    uint64_t pc = head;
+    for(uint64_t i = 0; i < n; pc += insns[i].len, i++) {
+      const pd_insn &d = insns[i];
+      const std::string rd = reg(d.rd), a = reg(d.rs1), b = reg(d.rs2);
+      const std::string imm = "(int64_t)" + std::to_string(d.imm);
+      o << "  /* " << std::hex << pc << std::dec << " */\n";
+      switch(d.op)
+	{
+	case pd_nop:
+	  break;
+	case pd_lui:
+	  o << "  " << rd << " = " << hex(static_cast<int64_t>(d.imm)) << ";\n";
+	  break;
+	case pd_auipc:
+	  o << "  " << rd << " = " << hex(pc + d.imm) << ";\n";
+	  break;
+	case pd_jal:
+	  if(d.rd != 0) {
+	    o << "  " << rd << " = " << hex(pc + d.len) << ";\n";
+	  }
+	  link(pc, d.rd, 0);
+	  jump(pc + d.imm);
+	  break;
+	case pd_jalr:
+	  o << "  t = (" << a << " + " << imm << ") & ~1ULL;\n";
+	  if(d.rd != 0) {
+	    o << "  " << rd << " = " << hex(pc + d.len) << ";\n";
+	  }
+	  link(pc, d.rd, d.rs1);
+	  o << "  PC(s) = t;\n  goto exit_len;\n";
+	  break;
+	case pd_beq:
+	case pd_bne:
+	case pd_blt:
+	case pd_bge:
+	case pd_bltu:
+	case pd_bgeu:
+	  o << "  { uint64_t a = " << a << ", b = " << b << ";\n"
+	    << "    if(" << branch_cond(d.op) << ") {\n";
+	  jump(pc + d.imm);
+	  o << "  } }\n";
+	  jump(pc + d.len);
+	  break;
+	case pd_lb:
+	case pd_lh:
+	case pd_lw:
+	case pd_ld:
+	case pd_lbu:
+	case pd_lhu:
+	case pd_lwu:
+	  o << "  r = aot_env.load(s, " << a << " + " << imm << ", " << int(d.op)
+	    << ", " << hex(pc) << ", " << i << ");\n"
+	    << "  if(r.fault) goto exit_wb;\n";
+	  if(d.rd != 0) {
+	    o << "  " << rd << " = r.value;\n";
+	  }
+	  break;
+	case pd_sb:
+	case pd_sh:
+	case pd_sw:
+	case pd_sd:
+	  o << "  if(aot_env.store(s, " << a << " + " << imm << ", " << b << ", "
+	    << ((d.len == 2) ? (d.op | jit_rvc) : d.op) << ", " << hex(pc)
+	    << ", " << i << ")) goto exit_wb;\n";
+	  break;
+	default:
+	  if(d.rd == 0) {
+	    break;
+	  }
+	  if(const char *e = alu_expr(d.op)) {
+	    o << "  { uint64_t a = " << a << ", b = " << b << "; int64_t i = " << imm
+	      << "; " << rd << " = " << e << "; }\n";
+	  }
+	  else {
+	    o << "  " << rd << " = aot_env.alu(" << int(d.op) << ", " << a << ", "
+	      << b << ", " << imm << ");\n";
+	  }
+	  break;
+	}
+    }
+    if(not(is_cti(insns.back().op))) {
+      o << "  PC(s) = " << hex(pc) << ";\n";
+    }
+    o << " exit_len:\n  ICNT(s) += " << n << ";\n exit_wb:\n";
+    for(int r : written) {
+      o << "  gpr[" << r << "] = " << reg(r) << ";\n";
+    }
+    o << "}\n\n";
+  }
+}
+
+bool aot_image::build(state_t *s, const std::vector<std::pair<uint64_t, uint64_t>> &text,
+		      const std::string &so) {
+  static const uint64_t pg_mask = 4095;
+  std::unique_ptr<pd_cache> pdc(new pd_cache(globals::phys_mem_size));
+  /* blocks start at every section start, page start, branch target
+   * and after every control transfer or slow instruction */
+  std::set<uint64_t> starts, leaders;
+  for(const auto &r : text) {
+    leaders.insert(r.first);
+    for(uint64_t pa = r.first; (pa + 2) <= r.second; ) {
+      const pd_insn *d = pdc->lookup(pa, s->mem);
+      const uint8_t op = pd_unfused(d->op);
+      const uint64_t len = d->len ? d->len : 2;
+      starts.insert(pa);
+      if((pa & pg_mask) == 0) {
+	leaders.insert(pa);
+      }
+      if((op == pd_jal) or ((op >= pd_beq) and (op <= pd_bgeu))) {
+	leaders.insert(pa + d->imm);
+      }
+      if(is_cti(op) or (op == pd_slow)) {
+	leaders.insert(pa + len);
+      }
+      pa += len;
+    }
+  }
+
+  const std::string c = so + ".c";
+  std::ofstream o(c);
+  if(not(o.is_open())) {
+    std::cerr << "INTERP : can't write " << c << "\n";
+    return false;
+  }
+  o << prelude
+    << "#define PC(s) (*(uint64_t *)((char *)(s) + " << (abi(s) & 0xffff) << "))\n"
+    << "#define ICNT(s) (*(uint64_t *)((char *)(s) + " << ((abi(s) >> 16) & 0xffff) << "))\n"
+    << "#define LAST_CALL(s) (*(uint64_t *)((char *)(s) + " << ((abi(s) >> 32) & 0xffff) << "))\n"
+    << "const uint64_t aot_abi = " << hex(abi(s)) << ";\n\n";
+
+  std::vector<std::pair<uint64_t, uint64_t>> table;
+  for(const auto &r : text) {
+    for(auto it = leaders.lower_bound(r.first); (it != leaders.end()) and (*it < r.second); ++it) {
+      const uint64_t head = *it;
+      if(starts.count(head) == 0) {
+	continue;
+      }
+      std::vector<pd_insn> insns;
+      uint64_t pa = head;
+      while((insns.size() < max_block_len) and ((pa == head) or (pa & pg_mask))) {
+	const pd_insn *d = pdc->lookup(pa, s->mem);
+	if((d->op == pd_slow) or ((pa + d->len) > r.second)) {
+	  break;
+	}
+	insns.push_back(*d);
+	insns.back().op = pd_unfused(d->op);
+	pa += d->len;
+	if(is_cti(insns.back().op)) {
+	  break;
+	}
+      }
+      if(insns.empty()) {
+	continue;
+      }
+      o << "static const uint8_t c_" << std::hex << head << std::dec << "[] = {";
+      for(uint64_t a = head; a < pa; a++) {
+	o << ((a == head) ? "" : ",") << int(s->mem[a]);
+      }
+      o << "};\n";
+      emit_block(o, head, insns);
+      table.push_back(std::make_pair(head, insns.size()));
+      table.back().second |= (pa - head) << 32;
+    }
+  }
+  o << "const struct aot_block aot_blocks[] = {\n";
+  for(const auto &t : table) {
+    o << "  {" << hex(t.first) << ", " << (t.second & 0xffffffff) << ", "
+      << (t.second >> 32) << std::hex << ", c_" << t.first << ", b_" << t.first
+      << std::dec << "},\n";
+  }
+  o << "};\nconst uint64_t aot_n_blocks = " << table.size() << ";\n";
+  o.close();
+
+  const char *cc = getenv("CC");
+  /* $CC is left unquoted so it can carry its own flags */
+  std::string cmd = std::string(cc ? cc : "cc") + " -O2 -w -shared -fPIC -o " + quote(so) +
+    " " + quote(c);
+  std::cout << "aot: " << table.size() << " blocks, " << cmd << "\n";
+  return std::system(cmd.c_str()) == 0;
+}
+
+aot_image::aot_image(state_t *s, const std::string &so) :
+  handle(nullptr), n_blocks(0), runs(0), mismatches(0) {
+  /* dlopen searches the library path for names without a slash */
+  std::string path = (so.find('/') == std::string::npos) ? ("./" + so) : so;
+  handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if(handle == nullptr) {
+    std::cerr << "INTERP : " << dlerror() << "\n";
+    exit(-1);
+  }
+  const uint64_t *so_abi = reinterpret_cast<const uint64_t*>(dlsym(handle, "aot_abi"));
+  const uint64_t *so_n = reinterpret_cast<const uint64_t*>(dlsym(handle, "aot_n_blocks"));
+  const block *blocks = reinterpret_cast<const block*>(dlsym(handle, "aot_blocks"));
+  aot_env *env = reinterpret_cast<aot_env*>(dlsym(handle, "aot_env"));
+  if((so_abi == nullptr) or (so_n == nullptr) or (blocks == nullptr) or (env == nullptr) or
+     (*so_abi != abi(s))) {
+    std::cerr << "INTERP : " << so << " wasn't built by this interp_rv64\n";
+    exit(-1);
+  }
+  env->load = &jit_load;
+  env->store = &jit_store;
+  env->alu = &jit_alu;
+  env->link = &jit_link;
+
+  n_blocks = *so_n;
+  uint64_t sz = 1;
+  while(sz < (2*n_blocks)) {
+    sz *= 2;
+  }
+  slots.resize(sz);
+  for(slot &e : slots) {
+    e.b = nullptr;
+  }
+  for(uint64_t i = 0; i < n_blocks; i++) {
+    uint64_t j = (blocks[i].pc >> 1) & (sz-1);
+    while(slots[j].b) {
+      j = (j + 1) & (sz-1);
+    }
+    slots[j].b = &blocks[i];
+    slots[j].gen = ~0UL;
+    slots[j].ok = false;
+  }
+}
+
+aot_image::~aot_image() {
+  dlclose(handle);
+}
+
+const aot_image::block *aot_image::find(state_t *s, uint64_t pc) {
+  const uint64_t mask = slots.size() - 1;
+  for(uint64_t i = (pc >> 1) & mask; slots[i].b; i = (i + 1) & mask) {
+    slot &e = slots[i];
+    if(e.b->pc != pc) {
+      continue;
+    }
+    uint64_t gen = s->pdc->get_gen(pc);
+    if(e.gen != gen) {
+      e.gen = gen;
+      e.ok = ((pc + e.b->code_bytes) <= globals::phys_mem_size) and
+	(memcmp(s->mem + pc, e.b->code, e.b->code_bytes) == 0);
+      mismatches += not(e.ok);
+    }
+    runs += e.ok;
+    return e.ok ? e.b : nullptr;
+  }
+  return nullptr;
+}
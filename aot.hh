@@ -0,0 +1,59 @@
+#ifndef __AOT_HH__
+#define __AOT_HH__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct state_t;
+
+/* ahead-of-time translation of the executable sections of an elf.
+ * build() emits C with one function per straight-line block, the same
+ * blocks and calling convention as jit_cache, and compiles it into a
+ * shared object. a later run loads that with dlopen and the bare block
+ * loop calls a block's function whenever it reaches its pc. every
+ * block carries the guest code it was made from, compared with memory
+ * on first use and again whenever the pd_cache generation of its page
+ * moves, so a different binary or modified code falls back to the
+ * interpreter */
+class aot_image {
+public:
+  typedef void (*block_fn)(state_t *s, int64_t *gpr, uint64_t stop_icnt);
+  /* laid out as in the generated source */
+  struct block {
+    uint64_t pc;
+    uint32_t len;
+    uint32_t code_bytes;
+    const uint8_t *code;
+    block_fn fn;
+  };
+private:
+  static const uint32_t max_block_len = 256;
+  struct slot {
+    const block *b;
+    uint64_t gen;
+    bool ok;
+  };
+  void *handle;
+  std::vector<slot> slots;
+  uint64_t n_blocks, runs, mismatches;
+public:
+  /* exits when so can't be loaded or was built by another interp_rv64 */
+  aot_image(state_t *s, const std::string &so);
+  ~aot_image();
+  /* translates the ranges [start, end) of guest physical memory */
+  static bool build(state_t *s, const std::vector<std::pair<uint64_t, uint64_t>> &text,
+		    const std::string &so);
+  const block *find(state_t *s, uint64_t pc);
+  uint64_t get_blocks() const {
+    return n_blocks;
+  }
+  uint64_t get_runs() const {
+    return runs;
+  }
+  uint64_t get_mismatches() const {
+    return mismatches;
+  }
+};
+
+#endif
@@ -156,6 +156,7 @@ void load_elf(const char* fn, state_t *ms) {
     if(f & SHF_EXECINSTR) {
       uint32_t addr = (sh32->sh_addr);
       int32_t size = (sh32->sh_size);
+      globals::elf_text.push_back(std::make_pair(addr, addr + size));
       bool pgAligned = ((addr & 4095) == 0);
       if(pgAligned) {
 	size = (size / pgSize) * pgSize;
@@ -33,6 +33,7 @@
 #include <string>
 #include "globals.hh"
 #include "helper.hh"
+#include "fdt.hh"
 
 #define TEMU_JUST_DEFINES
 #include "temu_code.hh"
@@ -328,6 +329,20 @@ void fdt_end(FDTState *s)
     free(s);
 }
 
+int ram_banks(uint64_t start[2], uint64_t size[2]) {
+  start[0] = globals::ram_phys_start;
+  size[0] = globals::fdt_ram_size;
+  /* the devices start at the clint */
+  if(not(globals::ram_sparse) or (start[0] >= CLINT_BASE_ADDR) or
+     ((start[0] + size[0]) <= CLINT_BASE_ADDR)) {
+    return 1;
+  }
+  size[0] = CLINT_BASE_ADDR - start[0];
+  start[1] = 1UL<<32;
+  size[1] = globals::fdt_ram_size - size[0];
+  return 2;
+}
+
 int riscv_build_fdt(uint8_t *dst,
 		    uint64_t kernel_start, uint64_t kernel_size,
 		    uint64_t initrd_start, uint64_t initrd_size,
@@ -337,8 +352,9 @@ int riscv_build_fdt(uint8_t *dst,
     int size, max_xlen = 64, i, cur_phandle, intc_phandle, plic_phandle;
     char isa_string[128];
     uint32_t misa;
-    uint32_t tab[4];
-    uint64_t ram_size = globals::fdt_ram_size;
+    uint32_t tab[8];
+    uint64_t bank_start[2], bank_size[2];
+    int n_banks = ram_banks(bank_start, bank_size);
 
     
     s = fdt_init();
@@ -365,26 +381,38 @@ int riscv_build_fdt(uint8_t *dst,
 
     //misa = riscv_cpu_get_misa(m->cpu_state);
     /* blindly copied from tinyemu */
-    misa = 0x141101;
+    misa = 0x141129;
     
-    fdt_prop_str(s, "riscv,isa", "rv64ima");
+    fdt_prop_str(s, "riscv,isa", globals::vlen ? "rv64imafdcv" : "rv64imafdc");
 
     std::vector<std::string> rv_exts = {
       "i",
       "m",
       "a",
+      "f",
+      "d",
+      "c",
       "zba",
       "zbb",
+      "zbc",
+      "zbs",
       "zicsr",
       "zifencei",
-      "zicond"
+      "zicond",
+      "zawrs",
+      "sstc",
+      "svinval"
     };
+    if(globals::vlen) {
+      rv_exts.push_back("v");
+    }
     if(globals::svnapot) {
       rv_exts.push_back("svnapot");
     }
     fdt_prop_tab_str(s, "riscv,isa-extensions", rv_exts);
     
-    fdt_prop_str(s, "mmu-type", "riscv,sv39");
+    fdt_prop_str(s, "mmu-type", globals::va_bits == 57 ? "riscv,sv57" :
+		 globals::va_bits == 48 ? "riscv,sv48" : "riscv,sv39");
     fdt_prop_u32(s, "clock-frequency", globals::cpu_freq);
 
     fdt_begin_node(s, "interrupt-controller");
@@ -401,11 +429,13 @@ int riscv_build_fdt(uint8_t *dst,
 
     fdt_begin_node_num(s, "memory", globals::ram_phys_start);
     fdt_prop_str(s, "device_type", "memory");
-    tab[0] = (globals::ram_phys_start >> 32);
-    tab[1] = (globals::ram_phys_start) & ((1UL<<32) - 1);
-    tab[2] = ram_size >> 32;
-    tab[3] = ram_size;
-    fdt_prop_tab_u32(s, "reg", tab, 4);
+    for(i = 0; i < n_banks; i++) {
+      tab[4*i+0] = bank_start[i] >> 32;
+      tab[4*i+1] = bank_start[i] & ((1UL<<32) - 1);
+      tab[4*i+2] = bank_size[i] >> 32;
+      tab[4*i+3] = bank_size[i];
+    }
+    fdt_prop_tab_u32(s, "reg", tab, 4*n_banks);
     
     fdt_end_node(s); /* memory */
 
@@ -6,4 +6,7 @@ int riscv_build_fdt(uint8_t *dst,
 		    uint64_t initrd_start, uint64_t initrd_size,
 		    const char *cmd_line);
 
+/* the guest ram banks the memory node advertises, returns how many */
+int ram_banks(uint64_t start[2], uint64_t size[2]);
+
 #endif
@@ -0,0 +1,412 @@
+#include <cfenv>
+#include <cmath>
+#include <cstring>
+#include "fpu.hh"
+
+enum fp_rm {
+  rm_rne = 0,
+  rm_rtz,
+  rm_rdn,
+  rm_rup,
+  rm_rmm,
+  rm_dyn = 7
+};
+
+/* there is no host mode for rmm (round to nearest, ties away). the
+ * arithmetic ops approximate it with nearest-even, the conversions
+ * to integer round it exactly */
+static const int host_rm[5] = {
+  FE_TONEAREST, FE_TOWARDZERO, FE_DOWNWARD, FE_UPWARD, FE_TONEAREST
+};
+
+static inline uint32_t frm(const state_t *s) {
+  return (s->fcsr >> 5) & 7;
+}
+
+/* host rounding mode while the guest runs, a reserved frm only
+ * matters to instructions with a dynamic rounding mode and those
+ * trap */
+static inline int frm_host(const state_t *s) {
+  uint32_t rm = frm(s);
+  return rm <= rm_rmm ? host_rm[rm] : FE_TONEAREST;
+}
+
+static inline bool resolve_rm(const state_t *s, uint32_t &rm) {
+  if(rm == rm_dyn) {
+    rm = frm(s);
+  }
+  return rm <= rm_rmm;
+}
+
+static int64_t host_to_flags(int e) {
+  return ((e & FE_INEXACT) ? 1 : 0) |
+    ((e & FE_UNDERFLOW) ? 2 : 0) |
+    ((e & FE_OVERFLOW) ? 4 : 0) |
+    ((e & FE_DIVBYZERO) ? 8 : 0) |
+    ((e & FE_INVALID) ? 16 : 0);
+}
+
+static int flags_to_host(int64_t f) {
+  return ((f & 1) ? FE_INEXACT : 0) |
+    ((f & 2) ? FE_UNDERFLOW : 0) |
+    ((f & 4) ? FE_OVERFLOW : 0) |
+    ((f & 8) ? FE_DIVBYZERO : 0) |
+    ((f & 16) ? FE_INVALID : 0);
+}
+
+fp_guard::fp_guard(state_t *s) : s(s) {
+  fesetround(frm_host(s));
+  feclearexcept(FE_ALL_EXCEPT);
+  if(s->fcsr & 31) {
+    feraiseexcept(flags_to_host(s->fcsr & 31));
+  }
+}
+
+fp_guard::~fp_guard() {
+  s->fcsr = (s->fcsr & 0xe0) | host_to_flags(fetestexcept(FE_ALL_EXCEPT));
+  feclearexcept(FE_ALL_EXCEPT);
+  fesetround(FE_TONEAREST);
+}
+
+int64_t read_fcsr(const state_t *s, int csr_id) {
+  int64_t flags = host_to_flags(fetestexcept(FE_ALL_EXCEPT));
+  switch(csr_id)
+    {
+    case 0x001:
+      return flags;
+    case 0x002:
+      return frm(s);
+    default:
+      return (s->fcsr & 0xe0) | flags;
+    }
+}
+
+void write_fcsr(state_t *s, int csr_id, int64_t v) {
+  switch(csr_id)
+    {
+    case 0x001:
+      s->fcsr = (s->fcsr & 0xe0) | (v & 31);
+      break;
+    case 0x002:
+      s->fcsr = (s->fcsr & 31) | ((v & 7) << 5);
+      break;
+    default:
+      s->fcsr = v & 0xff;
+      break;
+    }
+  if(csr_id != 0x002) {
+    feclearexcept(FE_ALL_EXCEPT);
+    if(s->fcsr & 31) {
+      feraiseexcept(flags_to_host(s->fcsr & 31));
+    }
+  }
+  fesetround(frm_host(s));
+  fp_set_dirty(s);
+}
+
+/* keeps the compiler from moving fp arithmetic across the
+ * rounding mode switches around it */
+template <typename T>
+static inline T fp_barrier(T x) {
+  asm volatile("" : "+m"(x));
+  return x;
+}
+
+/* switches in a static rounding mode that differs from frm for the
+ * length of one instruction */
+struct rm_scope {
+  int restore;
+  rm_scope(const state_t *s, uint32_t rm) : restore(-1) {
+    int cur = frm_host(s);
+    if(host_rm[rm] != cur) {
+      fesetround(host_rm[rm]);
+      restore = cur;
+    }
+  }
+  ~rm_scope() {
+    if(restore != -1) {
+      fesetround(restore);
+    }
+  }
+};
+
+/* integral value of x under rm, without raising inexact */
+static double round_int(double x, uint32_t rm) {
+  switch(rm)
+    {
+    case rm_rtz:
+      return std::trunc(x);
+    case rm_rdn:
+      return std::floor(x);
+    case rm_rup:
+      return std::ceil(x);
+    case rm_rmm:
+      return std::round(x);
+    default:
+      if(std::fabs(x - std::trunc(x)) == 0.5) {
+	return 2.0 * std::round(x / 2.0);
+      }
+      return std::round(x);
+    }
+}
+
+int64_t fcvt_int(double x, bool nan, uint32_t rm, uint32_t kind) {
+  static const double lo[4] = {-2147483648.0, 0.0, -9223372036854775808.0, 0.0};
+  static const double hi[4] = {2147483648.0, 4294967296.0,
+			       9223372036854775808.0, 18446744073709551616.0};
+  static const int64_t min_v[4] = {INT32_MIN, 0, INT64_MIN, 0};
+  static const int64_t max_v[4] = {INT32_MAX, -1, INT64_MAX, -1};
+  if(nan) {
+    feraiseexcept(FE_INVALID);
+    return max_v[kind];
+  }
+  double r = round_int(x, rm);
+  if(not(r >= lo[kind] and r < hi[kind])) {
+    feraiseexcept(FE_INVALID);
+    return x < 0 ? min_v[kind] : max_v[kind];
+  }
+  if(r != x) {
+    feraiseexcept(FE_INEXACT);
+  }
+  switch(kind)
+    {
+    case 0:
+      return static_cast<int32_t>(r);
+    case 1:
+      return static_cast<int32_t>(static_cast<uint32_t>(r));
+    case 2:
+      return static_cast<int64_t>(r);
+    default:
+      return static_cast<int64_t>(static_cast<uint64_t>(r));
+    }
+}
+
+template <typename T>
+static bool exec_fused(state_t *s, uint32_t inst) {
+  uint32_t rd = (inst>>7) & 31, rs1 = (inst>>15) & 31;
+  uint32_t rs2 = (inst>>20) & 31, rs3 = inst>>27;
+  uint32_t rm = (inst>>12) & 7;
+  if(not(resolve_rm(s, rm))) {
+    return false;
+  }
+  T a = get_fp<T>(s, rs1), b = get_fp<T>(s, rs2), c = get_fp<T>(s, rs3), r;
+  /* 0 * inf raises invalid even when the addend is a quiet nan */
+  if((std::isinf(a) and b == 0) or (a == 0 and std::isinf(b))) {
+    feraiseexcept(FE_INVALID);
+  }
+  switch(inst & 127)
+    {
+    case 0x47: /* fmsub */
+      c = -c;
+      break;
+    case 0x4b: /* fnmsub */
+      a = -a;
+      break;
+    case 0x4f: /* fnmadd */
+      a = -a;
+      c = -c;
+      break;
+    default: /* fmadd */
+      break;
+    }
+  {
+    rm_scope scope(s, rm);
+    r = fp_barrier(std::fma(fp_barrier(a), fp_barrier(b), fp_barrier(c)));
+  }
+  set_fp<T>(s, rd, r);
+  return true;
+}
+
+template <typename T>
+static bool exec_op_fp(state_t *s, uint32_t inst) {
+  typedef fp_traits<T> F;
+  typedef typename F::bits_t bits_t;
+  typedef typename F::other_t O;
+  uint32_t rd = (inst>>7) & 31, rs1 = (inst>>15) & 31, rs2 = (inst>>20) & 31;
+  uint32_t rm = (inst>>12) & 7;
+  bits_t a = F::get(s, rs1), b = F::get(s, rs2);
+  switch(inst >> 27)
+    {
+    case 0x00: /* fadd */
+    case 0x01: /* fsub */
+    case 0x02: /* fmul */
+    case 0x03: /* fdiv */
+    case 0x0b: { /* fsqrt */
+      if(not(resolve_rm(s, rm))) {
+	return false;
+      }
+      if(((inst >> 27) == 0x0b) and (rs2 != 0)) {
+	return false;
+      }
+      T x = from_bits<T>(a), y = from_bits<T>(b), r;
+      {
+	rm_scope scope(s, rm);
+	x = fp_barrier(x);
+	y = fp_barrier(y);
+	switch(inst >> 27)
+	  {
+	  case 0x00:
+	    r = x + y;
+	    break;
+	  case 0x01:
+	    r = x - y;
+	    break;
+	  case 0x02:
+	    r = x * y;
+	    break;
+	  case 0x03:
+	    r = x / y;
+	    break;
+	  default:
+	    r = std::sqrt(x);
+	    break;
+	  }
+	r = fp_barrier(r);
+      }
+      set_fp<T>(s, rd, r);
+      return true;
+    }
+    case 0x04: /* fsgnj, fsgnjn, fsgnjx */
+      switch(rm)
+	{
+	case 0:
+	  F::set(s, rd, (a & ~F::sign) | (b & F::sign));
+	  return true;
+	case 1:
+	  F::set(s, rd, (a & ~F::sign) | (~b & F::sign));
+	  return true;
+	case 2:
+	  F::set(s, rd, a ^ (b & F::sign));
+	  return true;
+	default:
+	  return false;
+	}
+    case 0x05: /* fmin, fmax */
+      if(rm > 1) {
+	return false;
+      }
+      F::set(s, rd, fminmax<T>(a, b, rm == 1));
+      return true;
+    case 0x08: { /* fcvt.s.d, fcvt.d.s */
+      if(rs2 != (sizeof(T) == 4 ? 1 : 0)) {
+	return false;
+      }
+      if(not(resolve_rm(s, rm))) {
+	return false;
+      }
+      O x = get_fp<O>(s, rs1);
+      T r;
+      {
+	rm_scope scope(s, rm);
+	r = fp_barrier(static_cast<T>(fp_barrier(x)));
+      }
+      set_fp<T>(s, rd, r);
+      return true;
+    }
+    case 0x14: { /* fle, flt, feq */
+      int64_t r = 0;
+      if(rm > 2) {
+	return false;
+      }
+      if(is_nan<T>(a) or is_nan<T>(b)) {
+	/* feq is a quiet compare, flt and fle signal on any nan */
+	if((rm != 2) or is_snan<T>(a) or is_snan<T>(b)) {
+	  feraiseexcept(FE_INVALID);
+	}
+      }
+      else {
+	T x = from_bits<T>(a), y = from_bits<T>(b);
+	r = (rm == 0) ? (x <= y) : (rm == 1) ? (x < y) : (x == y);
+      }
+      if(rd != 0) {
+	s->gpr[rd] = r;
+      }
+      return true;
+    }
+    case 0x18: { /* fcvt.{w,wu,l,lu} */
+      if((rs2 > 3) or not(resolve_rm(s, rm))) {
+	return false;
+      }
+      int64_t r = fcvt_int(from_bits<T>(a), is_nan<T>(a), rm, rs2);
+      if(rd != 0) {
+	s->gpr[rd] = r;
+      }
+      return true;
+    }
+    case 0x1a: { /* fcvt from {w,wu,l,lu} */
+      if((rs2 > 3) or not(resolve_rm(s, rm))) {
+	return false;
+      }
+      int64_t v = fp_barrier(s->gpr[rs1]);
+      T r;
+      {
+	rm_scope scope(s, rm);
+	v = fp_barrier(v);
+	switch(rs2)
+	  {
+	  case 0:
+	    r = static_cast<T>(static_cast<int32_t>(v));
+	    break;
+	  case 1:
+	    r = static_cast<T>(static_cast<uint32_t>(v));
+	    break;
+	  case 2:
+	    r = static_cast<T>(v);
+	    break;
+	  default:
+	    r = static_cast<T>(static_cast<uint64_t>(v));
+	    break;
+	  }
+	r = fp_barrier(r);
+      }
+      set_fp<T>(s, rd, r);
+      return true;
+    }
+    case 0x1c: { /* fmv.x.w, fmv.x.d, fclass */
+      int64_t r;
+      if(rs2 != 0) {
+	return false;
+      }
+      if(rm == 0) {
+	r = sizeof(T) == 4 ? static_cast<int32_t>(s->fpr[rs1]) :
+	  static_cast<int64_t>(s->fpr[rs1]);
+      }
+      else if(rm == 1) {
+	r = fclass<T>(a);
+      }
+      else {
+	return false;
+      }
+      if(rd != 0) {
+	s->gpr[rd] = r;
+      }
+      return true;
+    }
+    case 0x1e: /* fmv.w.x, fmv.d.x */
+      if((rs2 != 0) or (rm != 0)) {
+	return false;
+      }
+      F::set(s, rd, static_cast<bits_t>(s->gpr[rs1]));
+      return true;
+    default:
+      return false;
+    }
+}
+
+bool exec_fp(state_t *s, uint32_t inst) {
+  uint32_t fmt = (inst >> 25) & 3;
+  bool ok = false;
+  if(not(fp_enabled(s)) or (fmt > 1)) {
+    return false;
+  }
+  if((inst & 127) == 0x53) {
+    ok = fmt ? exec_op_fp<double>(s, inst) : exec_op_fp<float>(s, inst);
+  }
+  else {
+    ok = fmt ? exec_fused<double>(s, inst) : exec_fused<float>(s, inst);
+  }
+  if(ok) {
+    fp_set_dirty(s);
+  }
+  return ok;
+}
@@ -0,0 +1,162 @@
+#ifndef __FPU_HH__
+#define __FPU_HH__
+
+#include <cfenv>
+#include <cstdint>
+#include <cstring>
+#include "interpret.hh"
+
+/* rv64 F and D on the host fpu. while the guest runs, the host
+ * rounding mode follows frm and the host exception flags hold
+ * fflags, so an fadd.d is one host add with nothing to fix up.
+ * fp_guard sets that up on entry to a run and folds the host flags
+ * back into fcsr when the run returns */
+struct fp_guard {
+  state_t *s;
+  fp_guard(state_t *s);
+  ~fp_guard();
+};
+
+static inline bool fp_enabled(const state_t *s) {
+  return (s->mstatus & MSTATUS_FS) != 0;
+}
+
+static inline void fp_set_dirty(state_t *s) {
+  s->mstatus |= MSTATUS_FS;
+}
+
+/* op-fp (0x53) and the fused multiply-adds (0x43-0x4f), false
+ * when the encoding or its rounding mode is illegal */
+bool exec_fp(state_t *s, uint32_t inst);
+
+/* fflags (0x001), frm (0x002) and fcsr (0x003) */
+int64_t read_fcsr(const state_t *s, int csr_id);
+void write_fcsr(state_t *s, int csr_id, int64_t v);
+
+/* flw results are nan-boxed */
+static inline uint64_t fp_box32(uint32_t x) {
+  return 0xffffffff00000000UL | x;
+}
+
+/* fcvt.{w,wu,l,lu} (kind 0-3) of x rounded with rm: nan and out of
+ * range saturate and raise invalid, inexact results raise inexact */
+int64_t fcvt_int(double x, bool nan, uint32_t rm, uint32_t kind);
+
+template <typename T> struct fp_traits;
+
+template <> struct fp_traits<float> {
+  typedef uint32_t bits_t;
+  typedef double other_t;
+  static const uint32_t sign = 0x80000000U;
+  static const uint32_t exp = 0x7f800000U;
+  static const uint32_t frac = 0x007fffffU;
+  static const uint32_t quiet = 0x00400000U;
+  static const uint32_t qnan = 0x7fc00000U;
+  /* a single that is not nan-boxed reads as the canonical nan */
+  static uint32_t get(const state_t *s, int r) {
+    uint64_t v = s->fpr[r];
+    return (v >> 32) == 0xffffffffUL ? static_cast<uint32_t>(v) : qnan;
+  }
+  static void set(state_t *s, int r, uint32_t b) {
+    s->fpr[r] = fp_box32(b);
+  }
+};
+
+template <> struct fp_traits<double> {
+  typedef uint64_t bits_t;
+  typedef float other_t;
+  static const uint64_t sign = 0x8000000000000000UL;
+  static const uint64_t exp = 0x7ff0000000000000UL;
+  static const uint64_t frac = 0x000fffffffffffffUL;
+  static const uint64_t quiet = 0x0008000000000000UL;
+  static const uint64_t qnan = 0x7ff8000000000000UL;
+  static uint64_t get(const state_t *s, int r) {
+    return s->fpr[r];
+  }
+  static void set(state_t *s, int r, uint64_t b) {
+    s->fpr[r] = b;
+  }
+};
+
+template <typename T>
+static inline T from_bits(typename fp_traits<T>::bits_t b) {
+  T x;
+  memcpy(&x, &b, sizeof(x));
+  return x;
+}
+
+template <typename T>
+static inline typename fp_traits<T>::bits_t to_bits(T x) {
+  typename fp_traits<T>::bits_t b;
+  memcpy(&b, &x, sizeof(b));
+  return b;
+}
+
+/* classified on the bits, a host compare would raise invalid on
+ * a signalling nan */
+template <typename T>
+static inline bool is_nan(typename fp_traits<T>::bits_t b) {
+  typedef fp_traits<T> F;
+  return ((b & F::exp) == F::exp) and (b & F::frac);
+}
+
+template <typename T>
+static inline bool is_snan(typename fp_traits<T>::bits_t b) {
+  return is_nan<T>(b) and not(b & fp_traits<T>::quiet);
+}
+
+template <typename T>
+static inline T get_fp(const state_t *s, int r) {
+  return from_bits<T>(fp_traits<T>::get(s, r));
+}
+
+/* arithmetic results that are nan are the canonical nan */
+template <typename T>
+static inline void set_fp(state_t *s, int r, T x) {
+  typedef fp_traits<T> F;
+  typename F::bits_t b = to_bits(x);
+  F::set(s, r, is_nan<T>(b) ? F::qnan : b);
+}
+
+template <typename T>
+static inline int64_t fclass(typename fp_traits<T>::bits_t b) {
+  typedef fp_traits<T> F;
+  bool neg = (b & F::sign) != 0;
+  if((b & F::exp) == F::exp) {
+    if((b & F::frac) == 0) {
+      return neg ? 1<<0 : 1<<7;
+    }
+    return (b & F::quiet) ? 1<<9 : 1<<8;
+  }
+  if((b & F::exp) == 0) {
+    if((b & F::frac) == 0) {
+      return neg ? 1<<3 : 1<<4;
+    }
+    return neg ? 1<<2 : 1<<5;
+  }
+  return neg ? 1<<1 : 1<<6;
+}
+
+/* fmin/fmax: a single nan operand returns the other one and -0 is
+ * less than +0 */
+template <typename T>
+static inline typename fp_traits<T>::bits_t fminmax(typename fp_traits<T>::bits_t a,
+						    typename fp_traits<T>::bits_t b,
+						    bool max) {
+  if(is_snan<T>(a) or is_snan<T>(b)) {
+    feraiseexcept(FE_INVALID);
+  }
+  if(is_nan<T>(a)) {
+    return is_nan<T>(b) ? fp_traits<T>::qnan : b;
+  }
+  if(is_nan<T>(b)) {
+    return a;
+  }
+  T x = from_bits<T>(a), y = from_bits<T>(b);
+  if(x == y) {
+    return (((a & fp_traits<T>::sign) != 0) != max) ? a : b;
+  }
+  return ((x < y) != max) ? a : b;
+}
+
+#endif
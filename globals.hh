@@ -34,10 +34,19 @@ struct trace;
 struct branch_trace;
 struct branch_predictor;
 #include <iostream>
+#include <vector>
 
 namespace globals {
   extern uint64_t tlb_accesses;
   extern uint64_t tlb_hits;  
+  /* tlb hits by ipgszcnt/dpgszcnt page size index */
+  extern uint64_t tlb_pg_hits[5];
+  extern uint64_t pwc_accesses;
+  extern uint64_t pwc_hits;
+  /* pte reads by page table level, 0 is the 4KB level */
+  extern uint64_t pte_reads[5];
+  /* wfis and wrs that moved time up to the next timer interrupt */
+  extern uint64_t wfi_skips;
   extern uint64_t tohost_addr;
   extern uint64_t fromhost_addr;
   extern int sysArgc;
@@ -48,20 +57,32 @@ namespace globals {
   extern bool interactive;
   extern bool fdt_uart;
   extern bool svnapot;
+  /* widest satp mode offered, 39, 48 or 57 */
+  extern int va_bits;
   extern uint64_t fdt_ram_size;
   extern uint64_t ram_phys_start;
+  /* ram that would run into the devices continues at 4GB */
+  extern bool ram_sparse;
+  /* guest physical addresses backed by host memory, pa indexes mem */
+  extern uint64_t phys_mem_size;
+  /* 0 small pages, 1 transparent huge pages, 2 hugetlbfs */
+  extern int hugepages;
   extern uint64_t fdt_addr;
   extern uint64_t fw_start_addr;
   extern uint32_t cpu_freq;
   extern trace *tracer;
   extern branch_trace *branch_tracer;
   extern std::map<std::string, uint64_t> symtab;
+  /* [start, end) of the executable sections load_elf copied in */
+  extern std::vector<std::pair<uint64_t, uint64_t>> elf_text;
   extern std::ofstream *console_log;
   extern branch_predictor *bpred;
   extern bool enable_zbb;
   extern std::map<uint64_t, std::map<uint64_t, uint64_t>> insn_histo;
   extern bool extract_kernel;
   extern bool hacky_fp32;
+  extern bool blocks;
+  extern uint64_t vlen;
 };
 
 #endif
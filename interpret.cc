@@ -35,6 +35,7 @@
 #include <limits>
 #include <set>
 #include <bitset>
+#include <memory>
 
 #include "interpret.hh"
 #include "temu_code.hh"
@@ -45,8 +46,19 @@
 #include "uart.hh"
 #include "trace.hh"
 #include "branch_predictor.hh"
+#include "predecode.hh"
+#include "jit.hh"
+#include "aot.hh"
+#include "rvc.hh"
+#include "fpu.hh"
+#include "vector.hh"
+#include "mmio.hh"
 
 #include <stack>
+#ifdef __PCLMUL__
+#include <immintrin.h>
+#endif
+
 static uint64_t curr_pc = 0;
 static uint64_t last_tval = 0;
 static std::stack<int64_t> calls;
@@ -54,22 +66,68 @@ static std::stack<int64_t> calls;
 static bool tracing_armed = false;
 static uint64_t tracing_start_icnt = 0;
 
-static uint64_t lookup_tlb(uint64_t va, bool &hit, bool &dirty) __attribute__((always_inline));
+static uint64_t lookup_tlb(uint64_t va, uint16_t asid, int priv,
+			   bool store, bool fetch, bool &hit) __attribute__((always_inline));
 
+/* masked so a rotate by 0 is defined, compiles to ror/rol */
 static inline uint64_t ror64(const uint64_t x, int amt) {
- return (x >> amt) | (x << (64 - amt));
+  return (x >> (amt & 63)) | (x << ((-amt) & 63));
 }
 
 static inline uint32_t ror32(const uint32_t x, int amt) {
- return (x >> amt) | (x << (32 - amt));
+  return (x >> (amt & 31)) | (x << ((-amt) & 31));
 }
 
 static inline uint64_t rol64(const uint64_t x, int amt) {
-  return (x << amt) | (x >> (64 - amt));
+  return (x << (amt & 63)) | (x >> ((-amt) & 63));
 }
 
 static inline uint32_t rol32(const uint32_t x, int amt) {
-  return (x << amt) | (x >> (32 - amt));
+  return (x << (amt & 31)) | (x >> ((-amt) & 31));
+}
+
+/* zbb counts, 0 gives the operand width as lzcnt/tzcnt do */
+static inline uint64_t clz64(uint64_t x) {
+  return x ? __builtin_clzl(x) : 64;
+}
+
+static inline uint64_t ctz64(uint64_t x) {
+  return x ? __builtin_ctzl(x) : 64;
+}
+
+static inline uint64_t clz32(uint32_t x) {
+  return x ? __builtin_clz(x) : 32;
+}
+
+static inline uint64_t ctz32(uint32_t x) {
+  return x ? __builtin_ctz(x) : 32;
+}
+
+/* orc.b: bit 7 of each byte of m is set iff the byte is nonzero */
+static inline uint64_t orc_b(uint64_t x) {
+  const uint64_t lo7 = 0x7f7f7f7f7f7f7f7fUL;
+  uint64_t m = (((x & lo7) + lo7) | x) & ~lo7;
+  return (m >> 7) * 255;
+}
+
+/* full 128b carry-less product, clmul/clmulh/clmulr pick
+ * their 64b window out of it */
+static inline __uint128_t clmul128(uint64_t a, uint64_t b) {
+#ifdef __PCLMUL__
+  uint64_t r[2];
+  __m128i p = _mm_clmulepi64_si128(_mm_cvtsi64_si128(a),
+				   _mm_cvtsi64_si128(b), 0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(r), p);
+  return (static_cast<__uint128_t>(r[1]) << 64) | r[0];
+#else
+  __uint128_t r = 0;
+  for(int i = 0; i < 64; i++) {
+    if((b >> i) & 1) {
+      r ^= static_cast<__uint128_t>(a) << i;
+    }
+  }
+  return r;
+#endif
 }
 
 static inline uint64_t sext(int32_t r) {
@@ -91,66 +149,144 @@ void dump_calls() {
 
 void initState(state_t *s) {
   memset(s, 0, sizeof(state_t));
-  s->misa = 0x8000000000141101L;
+  s->misa = 0x800000000014112DL;
   s->priv = priv_machine;
   s->mstatus = ((uint64_t)2 << MSTATUS_UXL_SHIFT) |((uint64_t)2 << MSTATUS_SXL_SHIFT);
+  /* fs starts out initial so bare-metal and user-mode binaries can
+   * use fp without having to turn it on */
+  s->mstatus |= (1 << MSTATUS_FS_SHIFT);
 }
 
 uint64_t mtimecmp_cnt = 0;
 
+/* virtio stays unregistered, nothing in the tree drives it yet */
+void initDevices(state_t *s) {
+  s->mmio = new mmio_map(globals::phys_mem_size);
+  s->mmio->add(PLIC_BASE_ADDR, PLIC_SIZE, nullptr, nullptr);
+  s->mmio->add(CLINT_BASE_ADDR, CLINT_SIZE, nullptr,
+	       [s](uint64_t pa, int64_t x) {
+		 if((pa - CLINT_BASE_ADDR) != 0x4000) {
+		   return;
+		 }
+		 s->mtimecmp = x;
+		 ++mtimecmp_cnt;
+		 csr_t cc(s->mip);
+		 cc.mie.mtie = 0;
+		 s->mip = cc.raw;
+		 s->update_next_event();
+	       });
+  if(globals::fdt_uart) {
+    std::shared_ptr<uart> u = std::make_shared<uart>(s);
+    s->mmio->add(UART_BASE_ADDR, UART_SIZE,
+		 [u](uint64_t pa) { u->handle(pa, false, 0); },
+		 [u](uint64_t pa, int64_t x) { u->handle(pa, true, x); });
+  }
+}
+
+/* htif. a store to the tohost word hands its command to the host:
+ * the console and exit protocol of riscv-tests and bbl with fullsim,
+ * a newlib proxy syscall (see handle_syscall) without */
+static void htif_tohost(state_t *s, uint64_t tohost) {
+  if(tohost == 0) {
+    return;
+  }
+  if(not(globals::fullsim)) {
+    handle_syscall(s, tohost & ((1UL<<32)-1));
+    return;
+  }
+  uint64_t dev = tohost >> 56;
+  uint64_t cmd = (tohost >> 48) & 255;
+  uint64_t payload = tohost & ((1UL<<48)-1);
+  if((dev == 0) and (payload & 1)) { /* shutdown, riscv-tests pass the failing test */
+    if(payload != 1) {
+      std::cerr << "INTERP : tohost exit code " << (payload >> 1) << "\n";
+    }
+    s->brk = 1;
+    return;
+  }
+  if((dev != 1) or (cmd != 1)) {
+    dump_calls();
+    assert(false);
+  }
+  std::cout << static_cast<char>(payload & 0xff);
+  *reinterpret_cast<uint64_t*>(s->mem + globals::tohost_addr) = 0;
+  *reinterpret_cast<uint64_t*>(s->mem + globals::fromhost_addr) = (dev << 56) | (cmd << 48);
+}
+
+void initHtif(state_t *s) {
+  if(globals::tohost_addr == 0) {
+    return;
+  }
+  s->mmio->watch(globals::tohost_addr, [s](uint64_t, int64_t x) {
+    htif_tohost(s, x);
+  });
+}
+
 //100 mhz and 1 IPC
 //inst = (cycles/time) * (inst/cycle)
 int64_t state_t::get_time() const {
-  return icnt;
+  return icnt + idle_time;
+}
+
+uint64_t state_t::next_timer() const {
+  csr_t ie(mie);
+  uint64_t t = ~0UL;
+  if(ie.mie.mtie and (mtimecmp >= 0)) {
+    t = mtimecmp;
+  }
+  if(ie.mie.stie and (menvcfg & MENVCFG_STCE)) {
+    t = std::min(t, static_cast<uint64_t>(stimecmp));
+  }
+  return t;
+}
+
+/* mtip is raised once time reaches mtimecmp and stays up until
+ * mtimecmp is written. with sstc stip is time >= stimecmp */
+void state_t::update_timer_pending() {
+  csr_t cc(0);
+  if(get_time() >= mtimecmp) {
+    cc.mip.mtip = 1;
+    mip |= cc.raw;
+  }
+  if(menvcfg & MENVCFG_STCE) {
+    cc.raw = 0;
+    cc.mip.stip = 1;
+    if(static_cast<uint64_t>(get_time()) >= static_cast<uint64_t>(stimecmp)) {
+      mip |= cc.raw;
+    }
+    else {
+      mip &= ~cc.raw;
+    }
+  }
+}
+
+/* called whenever mtimecmp, stimecmp, menvcfg, mie, mip, mideleg,
+ * the status interrupt enables or the privilege level change.
+ * execRiscv_ only polls the timers and take_interrupt once icnt
+ * reaches next_event */
+void state_t::update_next_event() {
+  uint64_t deadline = ~0UL;
+  update_timer_pending();
+  if(get_time() < mtimecmp) {
+    deadline = mtimecmp;
+  }
+  if((menvcfg & MENVCFG_STCE) and
+     (static_cast<uint64_t>(get_time()) < static_cast<uint64_t>(stimecmp))) {
+    deadline = std::min(deadline, static_cast<uint64_t>(stimecmp));
+  }
+  if(take_interrupt(this)) {
+    next_event = icnt;
+  }
+  else if(deadline != ~0UL) {
+    next_event = deadline - idle_time;
+  }
+  else {
+    next_event = ~0UL;
+  }
 }
 
 bool state_t::memory_map_check(uint64_t pa, bool store, int64_t x) {
-  // if((pa <= (1UL<<21)) and store) {
-  //   std::cout << std::hex << this->pc << " writing bbl code "
-  // 	      << std::dec << "\n";
-  //   dump_calls();
-  //   exit(-1);
-  // }
-  
-  //if(pa >= VIRTIO_BASE_ADDR and (pa < (VIRTIO_BASE_ADDR + VIRTIO_SIZE))) {
-  //assert(vio);
-  //return vio->handle(pa, store, x);
-  //}
-  if(pa >= PLIC_BASE_ADDR and (pa < (PLIC_BASE_ADDR + PLIC_SIZE))) {
-    //printf(">> %s plic range at pc %lx, offset %ld bytes\n", store ? "write" : "read", pc, pa-PLIC_BASE_ADDR);
-    //exit(-1);
-    return true;
-  }
-  if(pa >= CLINT_BASE_ADDR and (pa < (CLINT_BASE_ADDR + CLINT_SIZE))) {
-    //assert(store);
-    switch(pa-CLINT_BASE_ADDR)
-      {
-      case 0x0:
-	break;
-      case 0x4000:	
-	if(store) {
-	  mtimecmp = x;
-	  //std::cout << mtimecmp_cnt << "\n";
-	  ++mtimecmp_cnt;
-	  //dump_calls();
-	  //printf(">> mtimecmp = %ld at icnt %ld\n", mtimecmp, icnt);
-	  csr_t cc(mip);
-	  cc.mie.mtie = 0;
-	  mip = cc.raw;	  
-	}
-	break;
-      case 0xbff8:
-	//assert(not(store));
-	break;
-      default:
-	break;
-      }
-    //printf(">> %s clint range at pc %lx, offset %ld bytes, st value %lx\n",
-    //store ? "write" : "read", pc, pa-CLINT_BASE_ADDR, x);
-    //exit(-1);
-    return true;
-  }  
-  return false;
+  return mmio->is_device(pa) and mmio->access(pa, store, x);
 }
 
 int8_t state_t::load8(uint64_t pa) {
@@ -196,114 +332,636 @@ int64_t state_t::load64(uint64_t pa) {
 
 void state_t::store8(uint64_t pa,  int8_t x) {
   memory_map_check(pa,true,x);
+  if(pdc and pdc->is_code(pa)) {
+    pdc->invalidate(pa, sizeof(x));
+  }
   *reinterpret_cast<int8_t*>(mem + pa) = x;
+  if(mmio->is_device(pa)) {
+    mmio->stored(pa, sizeof(x), mem);
+  }
 }
 
 void state_t::store16(uint64_t pa, int16_t x) {
   memory_map_check(pa,true,x);
+  if(pdc and pdc->is_code(pa)) {
+    pdc->invalidate(pa, sizeof(x));
+  }
   *reinterpret_cast<int16_t*>(mem + pa) = x;
+  if(mmio->is_device(pa)) {
+    mmio->stored(pa, sizeof(x), mem);
+  }
 }
 
 void state_t::store32(uint64_t pa, int32_t x) {
   memory_map_check(pa,true,x);
+  if(pdc and pdc->is_code(pa)) {
+    pdc->invalidate(pa, sizeof(x));
+  }
   *reinterpret_cast<int32_t*>(mem + pa) = x;
+  if(mmio->is_device(pa)) {
+    mmio->stored(pa, sizeof(x), mem);
+  }
 }
 
 void state_t::store64(uint64_t pa, int64_t x) {
   memory_map_check(pa,true,x);
+  if(pdc and pdc->is_code(pa)) {
+    pdc->invalidate(pa, sizeof(x));
+  }
   *reinterpret_cast<int64_t*>(mem + pa) = x;
+  if(mmio->is_device(pa)) {
+    mmio->stored(pa, sizeof(x), mem);
+  }
 }
 
 
+/* software tlb, set associative and tagged with the satp asid so
+ * entries survive privilege switches and address space switches.
+ * there is one array per page size and a superpage takes a single
+ * entry. the pte permissions are folded into what s and u mode may do
+ * with the page, so a hit is checked the same way the walk would
+ * check it. ram pages also keep the host address of the page so loads
+ * and stores that hit skip the device checks */
 struct tlb_entry {
-  uint64_t pfn;
-  uint64_t paddr;
-  bool dirty;
+  uint64_t vpn; /* va >> lg of the array holding the entry */
+  uint64_t paddr; /* ppn, mask_bits in the low 12 bits */
+  uint8_t *host; /* nullptr for device pages */
+  uint16_t asid;
+  bool global;
+  uint8_t allow[2]; /* tlb_perm bits for s (0) and u (1) mode */
+  uint8_t pgsz; /* ipgszcnt/dpgszcnt index of the mapping */
   bool valid;
 };
 
+/* tlb_w is only granted once the pte is dirty */
+enum tlb_perm {
+  tlb_r = 1<<0, tlb_w = 1<<1, tlb_x = 1<<2
+};
 
+template <int lg, uint64_t sets, uint64_t ways>
+struct tlb_array {
+  std::array<tlb_entry, sets*ways> e;
+  std::array<uint8_t, sets> victim;
+  tlb_entry *find(uint64_t va, uint16_t asid) {
+    uint64_t vpn = va >> lg;
+    tlb_entry *w = &e[(vpn & (sets-1)) * ways];
+    for(uint64_t i = 0; i < ways; i++) {
+      if(w[i].valid and (w[i].vpn == vpn) and (w[i].global or (w[i].asid == asid))) {
+	return &w[i];
+      }
+    }
+    return nullptr;
+  }
+  /* the entry already holding va or the way to replace */
+  tlb_entry *alloc(uint64_t va, uint16_t asid) {
+    tlb_entry *f = find(va, asid);
+    if(f) {
+      return f;
+    }
+    uint64_t set = (va >> lg) & (sets-1);
+    tlb_entry *w = &e[set * ways];
+    for(uint64_t i = 0; i < ways; i++) {
+      if(not(w[i].valid)) {
+	return &w[i];
+      }
+    }
+    f = &w[victim[set]];
+    victim[set] = (victim[set] + 1) & (ways-1);
+    return f;
+  }
+  void clear() {
+    for(tlb_entry &x : e) {
+      x.valid = false;
+    }
+  }
+  void sfence(bool all_va, uint64_t va, bool all_asid, uint16_t asid) {
+    for(tlb_entry &x : e) {
+      if(not(x.valid)) {
+	continue;
+      }
+      if(not(all_asid) and (x.global or (x.asid != asid))) {
+	continue;
+      }
+      if(not(all_va) and (x.vpn != (va >> lg))) {
+	continue;
+      }
+      x.valid = false;
+    }
+  }
+};
 
-static const uint64_t TLB_SZ = 1UL<<5;
-
-static std::array< tlb_entry, TLB_SZ> tlb;
+static tlb_array<12, 64, 4> tlb_4k;
+static tlb_array<16, 8, 4> tlb_64k;
+static tlb_array<21, 16, 4> tlb_2m;
+static tlb_array<30, 2, 4> tlb_1g;
+/* bit per pgsz index with live entries, so a 4KB-only guest never
+ * probes the superpage arrays */
+static uint8_t tlb_sizes = 0;
 
 static void clear_tlb() {
-  for(size_t i = 0; i < TLB_SZ; i++) {
-    tlb[i].valid = false;
+  tlb_4k.clear();
+  tlb_64k.clear();
+  tlb_2m.clear();
+  tlb_1g.clear();
+  tlb_sizes = 0;
+}
+
+/* page walk cache. holds the table a valid non-leaf pte points at,
+ * pwc_l1 by va >> 30 (the root level) and pwc_l0 by va >> 21, so a
+ * tlb miss usually reads only the leaf pte. it belongs to the current
+ * satp and is dropped by satp writes and every sfence, which is
+ * where software has to fence changes to non-leaf ptes */
+struct pwc_entry {
+  uint64_t tag;
+  uint64_t table;
+  bool valid;
+};
+
+static const uint64_t PWC_ENTRIES = 16;
+static std::array<pwc_entry, PWC_ENTRIES> pwc_l1;
+static std::array<pwc_entry, PWC_ENTRIES> pwc_l0;
+
+static void clear_pwc() {
+  for(pwc_entry &w : pwc_l1) {
+    w.valid = false;
+  }
+  for(pwc_entry &w : pwc_l0) {
+    w.valid = false;
   }
 }
 
-static void insert_tlb(uint64_t va, uint64_t paddr, int mask_bits, bool dirty) {
-  uint64_t pfn = va >> 12;
-  uint64_t h = pfn & (TLB_SZ-1);
-  tlb[h].valid = true;
-  tlb[h].pfn = pfn;
-  tlb[h].dirty = dirty;
-  tlb[h].paddr = paddr | mask_bits;
+static inline const pwc_entry *find_pwc(const std::array<pwc_entry, PWC_ENTRIES> &c,
+					uint64_t tag) {
+  const pwc_entry &w = c[tag & (PWC_ENTRIES-1)];
+  return (w.valid and (w.tag == tag)) ? &w : nullptr;
 }
 
-static uint64_t lookup_tlb(uint64_t va, bool &hit, bool &dirty) {
-  ++globals::tlb_accesses;
-  uint64_t pfn = va >> 12;
-  uint64_t h = pfn & (TLB_SZ-1);
-  if(not(tlb[h].valid)) {
-    hit = false;
-    return 0;
+static inline void fill_pwc(std::array<pwc_entry, PWC_ENTRIES> &c,
+			    uint64_t tag, uint64_t table) {
+  pwc_entry &w = c[tag & (PWC_ENTRIES-1)];
+  w.tag = tag;
+  w.table = table;
+  w.valid = true;
+}
+
+/* sfence.vma and sinval.vma. a zero rs1 matches every address and a
+ * zero rs2 every asid, global entries only go for a flush of all
+ * asids */
+static void sfence_tlb(bool all_va, uint64_t va, bool all_asid, uint16_t asid) {
+  clear_pwc();
+  if(all_va and all_asid) {
+    clear_tlb();
+    return;
+  }
+  tlb_4k.sfence(all_va, va, all_asid, asid);
+  tlb_64k.sfence(all_va, va, all_asid, asid);
+  tlb_2m.sfence(all_va, va, all_asid, asid);
+  tlb_1g.sfence(all_va, va, all_asid, asid);
+}
+
+static inline const tlb_entry *find_tlb(uint64_t va, uint16_t asid) {
+  const tlb_entry *e = tlb_4k.find(va, asid);
+  if(e or ((tlb_sizes & ~(1<<2)) == 0)) {
+    return e;
   }
-  if(tlb[h].pfn != pfn) {
-    hit = false;
+  if((tlb_sizes & (1<<1)) and (e = tlb_2m.find(va, asid))) {
+    return e;
+  }
+  if((tlb_sizes & (1<<0)) and (e = tlb_1g.find(va, asid))) {
+    return e;
+  }
+  if(tlb_sizes & (1<<3)) {
+    return tlb_64k.find(va, asid);
+  }
+  return nullptr;
+}
+
+/* paddr is the base of the mapping, host its host address */
+static void insert_tlb(uint64_t va, uint64_t paddr, int mask_bits, int pgsz,
+		       uint16_t asid, const pte_t &r, uint8_t *host) {
+  tlb_entry *e = nullptr;
+  switch(mask_bits)
+    {
+    case 30:
+      e = tlb_1g.alloc(va, asid);
+      e->vpn = va >> 30;
+      tlb_sizes |= 1<<0;
+      break;
+    case 21:
+      e = tlb_2m.alloc(va, asid);
+      e->vpn = va >> 21;
+      tlb_sizes |= 1<<1;
+      break;
+    case 16:
+      e = tlb_64k.alloc(va, asid);
+      e->vpn = va >> 16;
+      tlb_sizes |= 1<<3;
+      break;
+    default:
+      e = tlb_4k.alloc(va, asid);
+      e->vpn = va >> 12;
+      tlb_sizes |= 1<<2;
+      break;
+    }
+  uint8_t rwx = (r.sv39.r ? tlb_r : 0) | ((r.sv39.w and r.sv39.d) ? tlb_w : 0) |
+    (r.sv39.x ? tlb_x : 0);
+  e->valid = true;
+  e->asid = asid;
+  e->global = r.sv39.g;
+  /* u pages are not executable from s mode, s pages not accessible
+   * from u mode */
+  e->allow[0] = r.sv39.u ? (rwx & ~tlb_x) : rwx;
+  e->allow[1] = r.sv39.u ? rwx : 0;
+  e->paddr = paddr | mask_bits;
+  e->pgsz = pgsz;
+  e->host = host;
+}
+
+/* hits only when the cached permissions allow the access at priv.
+ * anything else walks the table, which raises the fault or sets a/d */
+static uint64_t lookup_tlb(uint64_t va, uint16_t asid, int priv,
+			   bool store, bool fetch, bool &hit) {
+  ++globals::tlb_accesses;
+  const tlb_entry *e = find_tlb(va, asid);
+  uint8_t need = fetch ? tlb_x : (store ? tlb_w : tlb_r);
+  hit = false;
+  if((e == nullptr) or ((e->allow[priv == priv_user] & need) == 0)) {
     return 0;
   }
-  int mask_bits = tlb[h].paddr & 4095;
-  uint64_t ppn = tlb[h].paddr & (~4095UL);
+  int mask_bits = e->paddr & 4095;
   uint64_t m = ((1UL << mask_bits) - 1);
-  uint64_t pa = (ppn & (~m)) | (va & m);
-  dirty = tlb[h].dirty;
   hit = true;
   ++globals::tlb_hits;
-  return pa;
+  ++globals::tlb_pg_hits[e->pgsz];
+  return (e->paddr & (~4095UL)) | (va & m);
+}
+
+/* host address for a sz byte load or store that hits a ram page in
+ * the tlb and stays on its 4KB page. nullptr sends the access through
+ * translate and the load/store helpers. stores to pages holding
+ * predecoded instructions also go the slow way to invalidate them */
+template <int vm = vm_any>
+static inline uint8_t *tlb_host(state_t *s, uint64_t ea, int sz, bool store) {
+  if(((vm == vm_any) and s->unpaged_mode()) or (((ea & 4095) + sz) > 4096)) {
+    return nullptr;
+  }
+  csr_t c(s->satp);
+  const tlb_entry *e = find_tlb(ea, c.satp.asid);
+  if((e == nullptr) or (e->host == nullptr) or
+     ((e->allow[s->priv == priv_user] & (store ? tlb_w : tlb_r)) == 0)) {
+    return nullptr;
+  }
+  uint8_t *h = e->host + (ea & ((1UL << (e->paddr & 4095)) - 1));
+  if(store and s->pdc and s->pdc->is_code(h - s->mem)) {
+    return nullptr;
+  }
+  ++globals::tlb_accesses;
+  ++globals::tlb_hits;
+  ++globals::tlb_pg_hits[e->pgsz];
+  return h;
+}
+
+/* the same for an untranslated access, ea is the physical address */
+static inline uint8_t *bare_host(state_t *s, uint64_t ea, int sz, bool store) {
+  if(((ea + sz) > globals::phys_mem_size) or (((ea & 4095) + sz) > 4096) or
+     s->mmio->is_device(ea)) {
+    return nullptr;
+  }
+  if(store and s->pdc and s->pdc->is_code(ea)) {
+    return nullptr;
+  }
+  return s->mem + ea;
+}
+
+/* the pd_l* and pd_s* accesses on a host address */
+static inline int64_t host_load(const uint8_t *h, uint8_t op) {
+  switch(op)
+    {
+    case pd_lb:
+      return *reinterpret_cast<const int8_t*>(h);
+    case pd_lh:
+      return *reinterpret_cast<const int16_t*>(h);
+    case pd_lw:
+      return *reinterpret_cast<const int32_t*>(h);
+    case pd_ld:
+      return *reinterpret_cast<const int64_t*>(h);
+    case pd_lbu:
+      return *h;
+    case pd_lhu:
+      return *reinterpret_cast<const uint16_t*>(h);
+    default:
+      return *reinterpret_cast<const uint32_t*>(h);
+    }
+}
+
+static inline void host_store(uint8_t *h, uint8_t op, int64_t x) {
+  switch(op)
+    {
+    case pd_sb:
+      *reinterpret_cast<int8_t*>(h) = x;
+      break;
+    case pd_sh:
+      *reinterpret_cast<int16_t*>(h) = x;
+      break;
+    case pd_sw:
+      *reinterpret_cast<int32_t*>(h) = x;
+      break;
+    default:
+      *reinterpret_cast<int64_t*>(h) = x;
+      break;
+    }
+}
+
+/* runs whole iterations of the loop closed by the taken loop branch br
+ * in bulk, from the branch round to the branch again. stops before
+ * max_insns, a page boundary or an iteration that leaves the loop, so
+ * registers and memory end up as stepping would leave them. returns
+ * the instructions retired */
+template <int vm>
+static uint64_t run_loop(state_t *s, const pd_insn *br, uint64_t max_insns) {
+  pd_loop l;
+  if(not(match_loop(br, l))) {
+    return 0;
+  }
+  int64_t *gpr = s->gpr;
+  const uint64_t sz = l.stride;
+  uint64_t k = max_insns / l.n_insns;
+  if(l.cmp_ptr) {
+    uint64_t p = gpr[l.cmp_ptr], e = gpr[l.cmp_reg];
+    if(br->op == pd_bltu_loop) {
+      if(p >= e) {
+	return 0;
+      }
+      k = std::min(k, (e - p - 1) / sz + 1);
+    }
+    else {
+      if(p == e) {
+	return 0;
+      }
+      if((e > p) and (((e - p) % sz) == 0)) {
+	k = std::min(k, (e - p) / sz);
+      }
+    }
+  }
+  else if(gpr[l.ld->rd] == 0) {
+    return 0;
+  }
+  uint64_t ld_ea = 0, st_ea = 0;
+  if(l.ld) {
+    ld_ea = gpr[l.ld->rs1] + l.ld_off;
+    k = (ld_ea & (sz-1)) ? 0 : std::min(k, (4096 - (ld_ea & 4095)) / sz);
+  }
+  if(l.st) {
+    st_ea = gpr[l.st->rs1] + l.st_off;
+    k = (st_ea & (sz-1)) ? 0 : std::min(k, (4096 - (st_ea & 4095)) / sz);
+  }
+  if(k == 0) {
+    return 0;
+  }
+  uint8_t *hl = nullptr, *hs = nullptr;
+  if(l.ld) {
+    hl = (vm == vm_bare) ? bare_host(s, ld_ea, k*sz, false) :
+      tlb_host<vm>(s, ld_ea, k*sz, false);
+    if(hl == nullptr) {
+      return 0;
+    }
+  }
+  if(l.st) {
+    hs = (vm == vm_bare) ? bare_host(s, st_ea, k*sz, true) :
+      tlb_host<vm>(s, st_ea, k*sz, true);
+    if(hs == nullptr) {
+      return 0;
+    }
+  }
+  /* a copy forward onto its own source repeats a pattern, stop
+   * before the stores reach bytes still to be loaded */
+  if(hl and hs and (hs > hl) and (hs < (hl + k*sz))) {
+    k = (hs - hl) / sz;
+    if(k == 0) {
+      return 0;
+    }
+  }
+  /* a scan branch sees every loaded element but the last */
+  if(l.cmp_ptr == 0) {
+    for(uint64_t i = 0; (i + 1) < k; i++) {
+      if(host_load(hl + i*sz, l.ld->op) == 0) {
+	k = i + 1;
+	break;
+      }
+    }
+  }
+  int64_t x = hl ? host_load(hl + (k-1)*sz, l.ld->op) : 0;
+  if(hl and hs) {
+    memmove(hs, hl, k*sz);
+  }
+  else if(hs) {
+    uint64_t v = gpr[l.st->rs2], m = (sz == 8) ? ~0UL : ((1UL << (8*sz)) - 1);
+    if((v & m) == ((0x0101010101010101UL * (v & 255)) & m)) {
+      memset(hs, v & 255, k*sz);
+    }
+    else {
+      for(uint64_t i = 0; i < k; i++) {
+	host_store(hs + i*sz, l.st->op, v);
+      }
+    }
+  }
+  for(int i = 0; i < l.n_ptrs; i++) {
+    gpr[l.ptr[i]] += k*sz;
+  }
+  if(hl) {
+    gpr[l.ld->rd] = x;
+    s->loads += k;
+    s->va_track_pa += k * ((((ld_ea ^ (hl - s->mem)) >> 12) & 3) == 0);
+  }
+  return k * l.n_insns;
+}
+
+/* the spin branch last taken and the icnt it was taken at */
+static const pd_insn *spin_br = nullptr;
+static uint64_t spin_icnt = 0;
+
+/* skips whole iterations of the spin loop closed by the branch br,
+ * reached at icnt, once a full iteration ran since br was last taken.
+ * the iteration left every register as the next ones will, nothing but
+ * this hart writes memory and the loads all hit ram, so iterations only
+ * stop repeating at an interrupt. skips up to max_insns, which ends
+ * before the next event, and returns the instructions skipped */
+template <int vm>
+static uint64_t run_spin(state_t *s, const pd_insn *br, uint64_t icnt, uint64_t max_insns) {
+  pd_spin l;
+  if(not(match_spin(br, l))) {
+    return 0;
+  }
+  const int64_t *gpr = s->gpr;
+  uint64_t u_rs1 = gpr[br->rs1], u_rs2 = gpr[br->rs2];
+  int64_t s_rs1 = gpr[br->rs1], s_rs2 = gpr[br->rs2];
+  bool taken = false;
+  switch(pd_unfused(br->op))
+    {
+    case pd_beq:
+      taken = u_rs1 == u_rs2;
+      break;
+    case pd_bne:
+      taken = u_rs1 != u_rs2;
+      break;
+    case pd_blt:
+      taken = s_rs1 < s_rs2;
+      break;
+    case pd_bge:
+      taken = s_rs1 >= s_rs2;
+      break;
+    case pd_bltu:
+      taken = u_rs1 < u_rs2;
+      break;
+    default:
+      taken = u_rs1 >= u_rs2;
+      break;
+    }
+  if(not(taken)) {
+    return 0;
+  }
+  /* only a taken pass is recorded, so coming back to br n_insns
+   * later means the last iteration started at the loop head */
+  bool again = (spin_br == br) and (icnt == (spin_icnt + l.n_insns));
+  spin_br = br;
+  spin_icnt = icnt;
+  uint64_t k = max_insns / l.n_insns;
+  if(not(again) or (k == 0)) {
+    return 0;
+  }
+  uint64_t loads = 0, tracked = 0;
+  for(int i = 0; i < l.n_lds; i++) {
+    const pd_insn *d = l.ld[i];
+    int64_t ea = gpr[d->rs1] + d->imm;
+    int sz = 1 << ((d->inst >> 12) & 3);
+    uint8_t *h = (vm == vm_bare) ? bare_host(s, ea, sz, false) :
+      tlb_host<vm>(s, ea, sz, false);
+    if((h == nullptr) or (ea & (sz-1))) {
+      return 0;
+    }
+    /* lr is not counted as a load */
+    if(d->op != pd_slow) {
+      ++loads;
+      tracked += (((ea ^ (h - s->mem)) >> 12) & 3) == 0;
+    }
+  }
+  s->loads += k * loads;
+  s->va_track_pa += k * tracked;
+  spin_icnt += k * l.n_insns;
+  return k * l.n_insns;
 }
 
 static bool entered_user = false;
 
+/* one level of the walk above the 1GB level, see walk_upper */
+template <int lvl>
+static inline int walk_level(const uint8_t *mem, uint64_t ea, uint64_t &table,
+			     uint64_t &a, pte_t &r) {
+  a = table + (((ea >> (12 + 9*lvl)) & 511)*8);
+  r.r = *reinterpret_cast<const uint64_t*>(mem + a);
+  ++globals::pte_reads[lvl];
+  if((r.sv39.v == 0) or r.sv39.n) {
+    return -1;
+  }
+  if(r.sv39.x or r.sv39.w or r.sv39.r) {
+    return 12 + 9*lvl;
+  }
+  table = r.sv39.ppn * 4096;
+  return walk_level<lvl-1>(mem, ea, table, a, r);
+}
 
-uint64_t state_t::translate(uint64_t ea, int &fault, int sz, bool store, bool fetch) {
+template <>
+inline int walk_level<2>(const uint8_t *mem, uint64_t ea, uint64_t &table,
+			 uint64_t &a, pte_t &r) {
+  return 0;
+}
+
+/* the levels above the 1GB level, unrolled at compile time: none for
+ * sv39 (top = 2), 512GB for sv48 (top = 3) and 256TB for sv57
+ * (top = 4). checks the va is canonical for the mode, then returns
+ * -1 for a fault, the mask_bits of a leaf found up here (left in r,
+ * its address in a) or 0 with table set to the 1GB level table */
+template <int top>
+static inline int walk_upper(const uint8_t *mem, uint64_t ea, uint64_t &table,
+			     uint64_t &a, pte_t &r) {
+  const int va_bits = 12 + 9*(top + 1);
+  if((static_cast<int64_t>(ea << (64 - va_bits)) >> (64 - va_bits)) !=
+     static_cast<int64_t>(ea)) {
+    return -1;
+  }
+  return walk_level<top>(mem, ea, table, a, r);
+}
+
+
+template <uint32_t policy, int vm>
+inline uint64_t state_t::translate(uint64_t ea, int &fault, int sz, bool store, bool fetch) {
+  const bool useDcache = (policy & ep_dcache) != 0;
+  const bool useTrace = (policy & ep_trace) != 0;
   csr_t c(satp);
   pte_t r(0);
 
-  uint64_t a = 0, u = 0;
+  uint64_t a = 0, u = 0, table = 0;
   int mask_bits = -1;
   int pgsz = 0;
-  uint64_t tlb_pa = 0;
-  bool tlb_hit = false, tlb_dirty = false;
+  bool tlb_hit = false;
   
   fault = false;
   
-  if(unpaged_mode()) {
-    if(dcache and not(fetch)) {
+  if((vm == vm_bare) or ((vm == vm_any) and unpaged_mode())) {
+    if(useDcache and dcache and not(fetch)) {
       dcache->access(ea, icnt, pc, store);
     }
-    if(globals::tracer and entered_user) {
+    if(useTrace and globals::tracer and entered_user) {
       globals::tracer->add(ea, ea, fetch ? 1 : 2);      
     }
     return ea;
   }
   
   
-  uint64_t t_pa = lookup_tlb(ea, tlb_hit, tlb_dirty);
+  uint64_t t_pa = lookup_tlb(ea, c.satp.asid, priv, store, fetch, tlb_hit);
   
-  if((dtlb == nullptr) and tlb_hit and (tlb_dirty or not(store))) {
-    if(store) assert(tlb_dirty);
-    if(dcache and not(fetch)) {
+  if((not(useDcache) or (dtlb == nullptr)) and tlb_hit) {
+    if(useDcache and dcache and not(fetch)) {
       dcache->access(t_pa, icnt, pc, store);
     }
     return t_pa;
   }
   
-  assert(c.satp.mode == 8);
-  a = (c.satp.ppn * 4096) + (((ea >> 30) & 511)*8);
+  ++globals::pwc_accesses;
+  if(const pwc_entry *w = find_pwc(pwc_l0, ea >> 21)) {
+    ++globals::pwc_hits;
+    table = w->table;
+    goto walk_l0;
+  }
+  if(const pwc_entry *w = find_pwc(pwc_l1, ea >> 30)) {
+    ++globals::pwc_hits;
+    table = w->table;
+    goto walk_l1;
+  }
+  table = c.satp.ppn * 4096;
+  switch(c.satp.mode)
+    {
+    case 9:
+      mask_bits = walk_upper<3>(mem, ea, table, a, r);
+      break;
+    case 10:
+      mask_bits = walk_upper<4>(mem, ea, table, a, r);
+      break;
+    default:
+      mask_bits = walk_upper<2>(mem, ea, table, a, r);
+      break;
+    }
+  if(mask_bits < 0) {
+    fault = 1;
+    return 3;
+  }
+  if(mask_bits != 0) {
+    pgsz = 4;
+    goto translation_complete;
+  }
+  a = table + (((ea >> 30) & 511)*8);
   u = *reinterpret_cast<uint64_t*>(mem + a);
+  ++globals::pte_reads[2];
   r.r = u;
   assert(r.sv39.n == false);  
   if((u&1) == 0) {
@@ -317,8 +975,12 @@ uint64_t state_t::translate(uint64_t ea, int &fault, int sz, bool store, bool fe
     pgsz = 0;
     goto translation_complete;
   }
-  a = (r.sv39.ppn * 4096) + (((ea >> 21) & 511)*8);
+  table = r.sv39.ppn * 4096;
+  fill_pwc(pwc_l1, ea >> 30, table);
+ walk_l1:
+  a = table + (((ea >> 21) & 511)*8);
   u = *reinterpret_cast<uint64_t*>(mem + a);
+  ++globals::pte_reads[1];
   r.r = u;
   assert(r.sv39.n == false);
   if((u&1) == 0) {
@@ -330,8 +992,12 @@ uint64_t state_t::translate(uint64_t ea, int &fault, int sz, bool store, bool fe
     pgsz = 1;
     goto translation_complete;
   }
-  a = (r.sv39.ppn * 4096) + (((ea >> 12) & 511)*8);
+  table = r.sv39.ppn * 4096;
+  fill_pwc(pwc_l0, ea >> 21, table);
+ walk_l0:
+  a = table + (((ea >> 12) & 511)*8);
   u = *reinterpret_cast<uint64_t*>(mem + a);
+  ++globals::pte_reads[0];
   r.r = u;    
   if((u&1) == 0) {
     //std::cout << "mapping does not exist for " << std::hex << ea << std::dec << " <<\n";
@@ -392,7 +1058,7 @@ uint64_t state_t::translate(uint64_t ea, int &fault, int sz, bool store, bool fe
   
   if(r.sv39.a == 0) {
     r.sv39.a = 1;
-    if(dcache) {
+    if(useDcache and dcache) {
       dcache->access(a, icnt, ~0UL, true);
     }    
     store64(a, r.r);
@@ -401,7 +1067,7 @@ uint64_t state_t::translate(uint64_t ea, int &fault, int sz, bool store, bool fe
     //printf("marking %lx dirty\n", ea & (~4095UL));
     //abort();
     r.sv39.d = 1;
-    if(dcache) {
+    if(useDcache and dcache) {
       dcache->access(a, icnt, ~0UL, true);
     }
     store64(a, r.r);    
@@ -416,27 +1082,44 @@ uint64_t state_t::translate(uint64_t ea, int &fault, int sz, bool store, bool fe
   int64_t m = ((1L << mask_bits) - 1);
   int64_t pa = ((r.sv39.ppn * 4096) & (~m)) | (ea & m);
 
-  if(dtlb and not(fetch)) {
+  if(useDcache and dtlb and not(fetch)) {
     if(not(dtlb->access(ea))) {
       dtlb->add((ea & (~m)), m);
     }
   }
   
-  if(globals::tracer and entered_user) {
+  if(useTrace and globals::tracer and entered_user) {
     globals::tracer->add(ea, pa, fetch ? 1 : 2);
   }
-  if(dcache and not(fetch)) {
+  if(useDcache and dcache and not(fetch)) {
     dcache->access(pa, icnt, pc, store);
   }
 
-  insert_tlb(ea, r.sv39.ppn * 4096, mask_bits, r.sv39.d);
+  /* 512GB and larger leaves are cached a 1GB page at a time. a
+   * superpage that shares its range with a device is cached a 4KB
+   * page at a time, so the ram pages in it still get a host address */
+  if(mask_bits > 30) {
+    mask_bits = 30;
+    m = (1L << 30) - 1;
+  }
+  if((mask_bits != 12) and mmio->overlaps(pa & (~m), 1UL << mask_bits)) {
+    mask_bits = 12;
+    m = 4095;
+  }
+  insert_tlb(ea, pa & (~m), mask_bits, pgsz, c.satp.asid, r,
+	     mmio->is_device(pa) ? nullptr : mem + (pa & (~m)));
   return pa;
 }
 
+uint64_t state_t::translate(uint64_t ea, int &fault, int sz, bool store, bool fetch) {
+  return translate<ep_all>(ea, fault, sz, store, fetch);
+}
+
 static void set_priv(state_t *s, int priv) {
   if (s->priv != priv) {
-    clear_tlb();
-    
+    /* the tlb keeps its entries, only the cached fetch translation
+     * was made for the old privilege */
+    s->last_phys_pc = 0;
     int mxl = 2;
     if (priv == priv_supervisor) {
       mxl = (s->mstatus >> MSTATUS_SXL_SHIFT) & 3;
@@ -452,6 +1135,7 @@ static void set_priv(state_t *s, int priv) {
     //assert(mxl == 2);
   }
   s->priv = static_cast<riscv_priv>(priv);
+  s->update_next_event();
 }
 
 static void set_mstatus(state_t *s, int64_t v) {
@@ -477,12 +1161,45 @@ std::ostream &operator<<(std::ostream &out, const state_t & s) {
   return out;
 }
 
+/* sd summarizes a dirty fs or vs */
+static inline int64_t status_sd(const state_t *s) {
+  return (((s->mstatus & MSTATUS_FS) == MSTATUS_FS) or
+	  ((s->mstatus & MSTATUS_VS) == MSTATUS_VS)) ? MSTATUS_SD : 0;
+}
+
+/* stimecmp is always there for m-mode, below that it needs
+ * menvcfg.stce and mcounteren.tm */
+static bool stimecmp_ok(const state_t *s) {
+  return (s->priv == priv_machine) or
+    ((s->menvcfg & MENVCFG_STCE) and ((s->mcounteren >> 1) & 1));
+}
+
 static int64_t read_csr(int csr_id, state_t *s, bool &undef) {
   undef = false;
   switch(csr_id)
     {
+    case 0x001:
+    case 0x002:
+    case 0x003:
+      if(not(fp_enabled(s))) {
+	undef = true;
+	return 0;
+      }
+      return read_fcsr(s, csr_id);
+    case 0x008:
+    case 0x009:
+    case 0x00a:
+    case 0x00f:
+    case 0xc20:
+    case 0xc21:
+    case 0xc22:
+      if(not(vec_enabled(s))) {
+	undef = true;
+	return 0;
+      }
+      return read_vcsr(s, csr_id);
     case 0x100: {
-      return s->mstatus & 0x3000de133UL;
+      return (s->mstatus & 0x3000de733UL) | status_sd(s);
     }
     case 0x104:
       return s->mie & s->mideleg;
@@ -498,10 +1215,16 @@ static int64_t read_csr(int csr_id, state_t *s, bool &undef) {
       return s->stval;
     case 0x144:
       return s->mip & s->mideleg;
+    case 0x14d:
+      if(not(stimecmp_ok(s))) {
+	undef = true;
+	return 0;
+      }
+      return s->stimecmp;
     case 0x180:
       return s->satp;
     case 0x300:
-      return s->mstatus;
+      return s->mstatus | status_sd(s);
     case 0x301: /* misa */
       return s->misa;
     case 0x302:
@@ -512,6 +1235,12 @@ static int64_t read_csr(int csr_id, state_t *s, bool &undef) {
       return s->mie;
     case 0x305:
       return s->mtvec;
+    case 0x306:
+      return s->mcounteren;
+    case 0x30a:
+      return s->menvcfg;
+    case 0x320: /* mcountinhibit, the counters never stop */
+      return 0;
     case 0x340:
       return s->mscratch;
     case 0x341:
@@ -581,13 +1310,33 @@ static void write_csr(int csr_id, state_t *s, int64_t v, bool &undef) {
   csr_t c(v);
   switch(csr_id)
     {
+    case 0x001:
+    case 0x002:
+    case 0x003:
+      if(not(fp_enabled(s))) {
+	undef = true;
+	break;
+      }
+      write_fcsr(s, csr_id, v);
+      break;
+    case 0x008:
+    case 0x009:
+    case 0x00a:
+    case 0x00f:
+    case 0xc20:
+    case 0xc21:
+    case 0xc22:
+      undef = not(vec_enabled(s)) or not(write_vcsr(s, csr_id, v));
+      break;
     case 0x100:
       //printf("writing sstatus at pc %lx\n", s->pc);
-      s->mstatus = (v & 0x0000de133UL) | ((s->mstatus & (~0x000de133UL)));
+      s->mstatus = (v & 0x0000de733UL) | ((s->mstatus & (~0x000de733UL)));
       assert( ((s->mstatus >> MSTATUS_UXL_SHIFT) & 3) == 2);
+      s->update_next_event();
       break;
     case 0x104:
       s->mie = (s->mie & ~(s->mideleg)) | (v & s->mideleg);      
+      s->update_next_event();
       break;
     case 0x105:
       assert((v&3)  == 0);
@@ -600,7 +1349,7 @@ static void write_csr(int csr_id, state_t *s, int64_t v, bool &undef) {
       s->sscratch = v;
       break;
     case 0x141:
-      s->sepc = v;
+      s->sepc = v & ~1UL;
       break;
     case 0x142:
       s->scause = v;
@@ -610,6 +1359,7 @@ static void write_csr(int csr_id, state_t *s, int64_t v, bool &undef) {
       break;
     case 0x144: {
       s->mip = (s->mip & ~(s->mideleg)) | (v & s->mideleg);
+      s->update_next_event();
       // if(s->mip != v) {
       // 	std::cout << "mip changes to " << std::hex << v
       // 		  << " at " << s->pc << std::dec
@@ -619,17 +1369,32 @@ static void write_csr(int csr_id, state_t *s, int64_t v, bool &undef) {
       // }            
       break;
     }
+    case 0x14d:
+      if(not(stimecmp_ok(s))) {
+	undef = true;
+	break;
+      }
+      s->stimecmp = v;
+      s->update_next_event();
+      break;
     case 0x180:
-      if(c.satp.mode == 8 &&
-	 c.satp.asid == 0) {
+      /* the tlb is asid tagged, an address space switch needs no
+       * flush. software fences stale entries with sfence.vma. the
+       * page walk cache only holds the current root's tables */
+      /* bare is always writable, modes past --va_bits are not
+       * supported and leave satp as it was (warl) */
+      if((c.satp.mode == 0) or
+	 ((c.satp.mode >= 8) and (c.satp.mode <= (8 + (globals::va_bits - 39) / 9)))) {
+	if(s->satp != v) {
+	  clear_pwc();
+	}
 	s->satp = v;
-	//printf("tlb had %lu entries\n", tlb.size());
-	clear_tlb();
 	s->last_phys_pc = 0;	
       }
       break;
     case 0x300:
       set_mstatus(s,v);
+      s->update_next_event();
       break;
     case 0x301:
       s->misa = v;
@@ -639,6 +1404,7 @@ static void write_csr(int csr_id, state_t *s, int64_t v, bool &undef) {
       break;
     case 0x303:
       s->mideleg = v;
+      s->update_next_event();
       break;
     case 0x304:
       //if(s->mie != v) {
@@ -647,6 +1413,7 @@ static void write_csr(int csr_id, state_t *s, int64_t v, bool &undef) {
       //std::cout << c.mie << "\n";
       //}
       s->mie = v;
+      s->update_next_event();
       break;
     case 0x305:
       s->mtvec = v;
@@ -654,14 +1421,22 @@ static void write_csr(int csr_id, state_t *s, int64_t v, bool &undef) {
     case 0x306:
       s->mcounteren = v;
       break;
+    case 0x30a:
+      /* of the envcfg fields only sstc's stce is implemented */
+      s->menvcfg = v & MENVCFG_STCE;
+      s->update_next_event();
+      break;
+    case 0x320:
+      break;
     case 0x340:
       s->mscratch = v;
       break;
     case 0x341:
-      s->mepc = v;
+      s->mepc = v & ~1UL;
       break;
     case 0x344:
       s->mip = v;
+      s->update_next_event();
       break;
     case 0x3a0:
       s->pmpcfg0 = v;
@@ -719,16 +1494,223 @@ static void write_csr(int csr_id, state_t *s, int64_t v, bool &undef) {
       break;
     }
 }
-template <bool useIcache, bool useDcache, bool useBBV, bool useMAV = false>
+
+static inline int64_t div64(int64_t a, int64_t b) {
+  if(b == 0) {
+    return -1;
+  }
+  if((a == std::numeric_limits<int64_t>::min()) and (b == -1)) {
+    return a;
+  }
+  return a / b;
+}
+
+static inline int64_t rem64(int64_t a, int64_t b) {
+  if(b == 0) {
+    return a;
+  }
+  if((a == std::numeric_limits<int64_t>::min()) and (b == -1)) {
+    return 0;
+  }
+  return a % b;
+}
+
+static inline int64_t divw32(int32_t a, int32_t b) {
+  if(b == 0) {
+    return -1;
+  }
+  if((a == std::numeric_limits<int32_t>::min()) and (b == -1)) {
+    return a;
+  }
+  return a / b;
+}
+
+static inline int64_t remw32(int32_t a, int32_t b) {
+  if(b == 0) {
+    return a;
+  }
+  if((a == std::numeric_limits<int32_t>::min()) and (b == -1)) {
+    return 0;
+  }
+  return a % b;
+}
+
+static inline uint32_t divuw32(uint32_t a, uint32_t b) {
+  return b == 0 ? ~0U : a / b;
+}
+
+static inline uint32_t remuw32(uint32_t a, uint32_t b) {
+  return b == 0 ? a : a % b;
+}
+
+/* integer ops shared by the predecoded fast path and the block
+ * executor, expressed over u_rs1/u_rs2 (unsigned), s_rs1/s_rs2
+ * (signed) and pd->imm */
+#define PD_ALU_OPS(OP)							\
+  OP(pd_addi, u_rs1 + pd->imm)						\
+  OP(pd_slti, s_rs1 < pd->imm)						\
+  OP(pd_sltiu, u_rs1 < static_cast<uint64_t>(pd->imm))			\
+  OP(pd_xori, u_rs1 ^ pd->imm)						\
+  OP(pd_ori, u_rs1 | pd->imm)						\
+  OP(pd_andi, u_rs1 & pd->imm)						\
+  OP(pd_slli, u_rs1 << pd->imm)						\
+  OP(pd_srli, u_rs1 >> pd->imm)						\
+  OP(pd_srai, s_rs1 >> pd->imm)						\
+  OP(pd_addiw, static_cast<int32_t>(u_rs1 + pd->imm))			\
+  OP(pd_slliw, static_cast<int32_t>(u_rs1 << pd->imm))			\
+  OP(pd_srliw, static_cast<int32_t>(static_cast<uint32_t>(u_rs1) >> pd->imm)) \
+  OP(pd_sraiw, static_cast<int32_t>(u_rs1) >> pd->imm)			\
+  OP(pd_slliuw, static_cast<uint64_t>(static_cast<uint32_t>(u_rs1)) << pd->imm) \
+  OP(pd_bseti, u_rs1 | (1UL << pd->imm))				\
+  OP(pd_bclri, u_rs1 & ~(1UL << pd->imm))				\
+  OP(pd_binvi, u_rs1 ^ (1UL << pd->imm))				\
+  OP(pd_bexti, (u_rs1 >> pd->imm) & 1)					\
+  OP(pd_rori, ror64(u_rs1, pd->imm))					\
+  OP(pd_roriw, static_cast<int32_t>(ror32(u_rs1, pd->imm)))		\
+  OP(pd_clz, clz64(u_rs1))						\
+  OP(pd_ctz, ctz64(u_rs1))						\
+  OP(pd_cpop, __builtin_popcountl(u_rs1))				\
+  OP(pd_clzw, clz32(u_rs1))						\
+  OP(pd_ctzw, ctz32(u_rs1))						\
+  OP(pd_cpopw, __builtin_popcount(static_cast<uint32_t>(u_rs1)))	\
+  OP(pd_sextb, static_cast<int8_t>(u_rs1))				\
+  OP(pd_sexth, static_cast<int16_t>(u_rs1))				\
+  OP(pd_zexth, static_cast<uint16_t>(u_rs1))				\
+  OP(pd_orcb, orc_b(u_rs1))						\
+  OP(pd_rev8, __builtin_bswap64(u_rs1))					\
+  OP(pd_add, u_rs1 + u_rs2)						\
+  OP(pd_sub, u_rs1 - u_rs2)						\
+  OP(pd_sll, u_rs1 << (u_rs2 & 63))					\
+  OP(pd_slt, s_rs1 < s_rs2)						\
+  OP(pd_sltu, u_rs1 < u_rs2)						\
+  OP(pd_xor, u_rs1 ^ u_rs2)						\
+  OP(pd_srl, u_rs1 >> (u_rs2 & 63))					\
+  OP(pd_sra, s_rs1 >> (u_rs2 & 63))					\
+  OP(pd_or, u_rs1 | u_rs2)						\
+  OP(pd_and, u_rs1 & u_rs2)						\
+  OP(pd_addw, static_cast<int32_t>(u_rs1 + u_rs2))			\
+  OP(pd_subw, static_cast<int32_t>(u_rs1 - u_rs2))			\
+  OP(pd_sllw, static_cast<int32_t>(u_rs1 << (u_rs2 & 31)))		\
+  OP(pd_srlw, static_cast<int32_t>(static_cast<uint32_t>(u_rs1) >> (u_rs2 & 31))) \
+  OP(pd_sraw, static_cast<int32_t>(u_rs1) >> (u_rs2 & 31))		\
+  OP(pd_mul, u_rs1 * u_rs2)						\
+  OP(pd_mulh, (static_cast<__int128>(s_rs1) * static_cast<__int128>(s_rs2)) >> 64) \
+  OP(pd_mulhu, (static_cast<__uint128_t>(u_rs1) * static_cast<__uint128_t>(u_rs2)) >> 64) \
+  OP(pd_div, div64(s_rs1, s_rs2))					\
+  OP(pd_divu, u_rs2 == 0 ? ~0UL : u_rs1 / u_rs2)			\
+  OP(pd_rem, rem64(s_rs1, s_rs2))					\
+  OP(pd_remu, u_rs2 == 0 ? u_rs1 : u_rs1 % u_rs2)			\
+  OP(pd_mulw, static_cast<int32_t>(u_rs1 * u_rs2))			\
+  OP(pd_divw, divw32(u_rs1, u_rs2))					\
+  OP(pd_divuw, static_cast<int32_t>(divuw32(u_rs1, u_rs2)))		\
+  OP(pd_remw, remw32(u_rs1, u_rs2))					\
+  OP(pd_remuw, static_cast<int32_t>(remuw32(u_rs1, u_rs2)))		\
+  OP(pd_sh1add, (u_rs1 << 1) + u_rs2)					\
+  OP(pd_sh2add, (u_rs1 << 2) + u_rs2)					\
+  OP(pd_sh3add, (u_rs1 << 3) + u_rs2)					\
+  OP(pd_adduw, static_cast<uint64_t>(static_cast<uint32_t>(u_rs1)) + u_rs2) \
+  OP(pd_sh1adduw, (static_cast<uint64_t>(static_cast<uint32_t>(u_rs1)) << 1) + u_rs2) \
+  OP(pd_sh2adduw, (static_cast<uint64_t>(static_cast<uint32_t>(u_rs1)) << 2) + u_rs2) \
+  OP(pd_sh3adduw, (static_cast<uint64_t>(static_cast<uint32_t>(u_rs1)) << 3) + u_rs2) \
+  OP(pd_andn, u_rs1 & ~u_rs2)						\
+  OP(pd_orn, u_rs1 | ~u_rs2)						\
+  OP(pd_xnor, ~(u_rs1 ^ u_rs2))						\
+  OP(pd_min, std::min(s_rs1, s_rs2))					\
+  OP(pd_minu, std::min(u_rs1, u_rs2))					\
+  OP(pd_max, std::max(s_rs1, s_rs2))					\
+  OP(pd_maxu, std::max(u_rs1, u_rs2))					\
+  OP(pd_rol, rol64(u_rs1, u_rs2))					\
+  OP(pd_ror, ror64(u_rs1, u_rs2))					\
+  OP(pd_rolw, static_cast<int32_t>(rol32(u_rs1, u_rs2)))		\
+  OP(pd_rorw, static_cast<int32_t>(ror32(u_rs1, u_rs2)))		\
+  OP(pd_bset, u_rs1 | (1UL << (u_rs2 & 63)))				\
+  OP(pd_bclr, u_rs1 & ~(1UL << (u_rs2 & 63)))				\
+  OP(pd_binv, u_rs1 ^ (1UL << (u_rs2 & 63)))				\
+  OP(pd_bext, (u_rs1 >> (u_rs2 & 63)) & 1)				\
+  OP(pd_clmul, static_cast<uint64_t>(clmul128(u_rs1, u_rs2)))		\
+  OP(pd_clmulh, static_cast<uint64_t>(clmul128(u_rs1, u_rs2) >> 64))	\
+  OP(pd_clmulr, static_cast<uint64_t>(clmul128(u_rs1, u_rs2) >> 63))
+
+static void take_trap(state_t *s, int except_cause, uint64_t tval) {
+  bool delegate = false;
+  s->last_phys_pc = 0;
+  if(s->priv == priv_user || s->priv == priv_supervisor) {
+    if(except_cause & CAUSE_INTERRUPT) {
+      uint32_t cc = (except_cause & 0x7fffffffUL);
+      delegate = ((s->mideleg) >> cc) & 1;
+    }
+    else {
+      delegate = (s->medeleg >> except_cause) & 1;
+    }
+  }
+
+  uint64_t cause = (except_cause & 0x7fffffffUL);
+  if(except_cause & CAUSE_INTERRUPT) {
+    cause |= 1UL<<63;
+  }
+  
+  if( /*(cause != 9 and cause < 16)*/ not(globals::silent) and false) {
+    std::cout << "--> took fault at pc "
+	      << std::hex << s->pc
+	      << ", tval " << tval
+	      << std::dec
+	      << ", icnt " << s->icnt
+	      << ", cause " << std::hex
+	      << cause << std::dec << " : ";
+    if(cause < 16) {
+      std::cout << cause_reasons.at(cause);
+      dump_calls();	
+    }
+    else {
+      std::cout << "irq " << (cause & 31);
+    }
+    std::cout << ", delegate " << delegate
+	      << ", priv "
+	      << s->priv << "\n";
+  }
+  
+  if(delegate) {
+    s->scause = cause;
+    s->sepc = s->pc;
+    s->stval = tval;
+    s->mstatus = (s->mstatus & ~MSTATUS_SPIE) |
+      (((s->mstatus >> s->priv) & 1) << MSTATUS_SPIE_SHIFT);
+    s->mstatus = (s->mstatus & ~MSTATUS_SPP) |
+      (s->priv << MSTATUS_SPP_SHIFT);
+    s->mstatus &= ~MSTATUS_SIE;
+    set_priv(s, priv_supervisor);
+    s->pc = s->stvec;
+  }
+  else {
+    s->mcause = cause;
+    s->mepc = s->pc;
+    s->mtval = tval;
+    s->mstatus = (s->mstatus & ~MSTATUS_MPIE) |
+      (((s->mstatus >> s->priv) & 1) << MSTATUS_MPIE_SHIFT);
+    s->mstatus = (s->mstatus & ~MSTATUS_MPP) |
+      (s->priv << MSTATUS_MPP_SHIFT);
+    s->mstatus &= ~MSTATUS_MIE;
+    set_priv(s, priv_machine);
+    s->pc = s->mtvec;
+  }
+}
+
+template <uint32_t policy>
 void execRiscv_(state_t *s) {
+  const bool useIcache = (policy & ep_icache) != 0;
+  const bool useBBV = (policy & ep_simpoint) != 0;
+  const bool useMAV = (policy & ep_simpoint) != 0;
+  const bool useBranch = (policy & ep_branch) != 0;
+  const bool useTrace = (policy & ep_trace) != 0;
   uint8_t *mem = s->mem;
   int fetch_fault = 0, except_cause = -1;
   uint64_t tval = -1;
-  uint64_t tohost = 0;
   uint64_t phys_pc = 0;
-  uint32_t inst = 0, opcode = 0, rd = 0, lop = 0;
+  uint32_t inst = 0, opcode = 0, rd = 0;
+  int64_t isz = 4;
   int64_t irq = 0;
   riscv_t m(0);
+  pd_insn *pd = nullptr;
   curr_pc = s->pc;
 
   if(useBBV) {
@@ -754,7 +1736,7 @@ void execRiscv_(state_t *s) {
     exit(-1);
   }
 
-  if(s->priv == priv_user) {
+  if(useTrace and (s->priv == priv_user)) {
     entered_user = true;
   }
 
@@ -768,25 +1750,21 @@ void execRiscv_(state_t *s) {
   //}
   
 
-  csr_t c(s->mie);
   //if(c.mie.mtie) {
   //std::cout << "(s->get_time() = " << s->get_time() << "\n";
   //std::cout << "s->mtimecmp = "<< s->mtimecmp << "\n";
   //}
   
-  if(s->get_time() >= s->mtimecmp) {
-    csr_t cc(0);
-    cc.mip.mtip = 1;
-    s->mip |= cc.raw;
-  }
-
-  
-  irq = take_interrupt(s);
-  if(irq) {
-    //printf(">> taking interrupt, irq %ld, time %ld, mtimecmp %ld <<\n",
-    //irq, s->get_time(), s->mtimecmp);
-    except_cause = CAUSE_INTERRUPT | irq;
-    goto handle_exception;
+  if(s->icnt >= s->next_event) {
+    s->update_timer_pending();
+    irq = take_interrupt(s);
+    if(irq) {
+      //printf(">> taking interrupt, irq %ld, time %ld, mtimecmp %ld <<\n",
+      //irq, s->get_time(), s->mtimecmp);
+      except_cause = CAUSE_INTERRUPT | irq;
+      goto handle_exception;
+    }
+    s->update_next_event();
   }
 
   /* if we're on the same page as the past instruction, reuse
@@ -797,7 +1775,7 @@ void execRiscv_(state_t *s) {
     phys_pc = (s->pc & pg_mask) | (s->last_phys_pc & (~pg_mask));
   }
   else {
-    phys_pc = s->translate(s->pc, fetch_fault, 4, false, true);
+    phys_pc = s->translate<policy>(s->pc, fetch_fault, 4, false, true);
   }
   if(useIcache) {
     s->icache->access(phys_pc, s->icnt, s->pc);
@@ -817,10 +1795,41 @@ void execRiscv_(state_t *s) {
     //std::cout << csr_t(s->mstatus).mstatus << "\n";
     goto handle_exception;
   }
-  assert(phys_pc < (1UL << 32));
+  assert(phys_pc < globals::phys_mem_size);
   // assert(!fetch_fault);
   
-  inst = s->load32(phys_pc);
+  if(s->pdc) {
+    pd = s->pdc->lookup(phys_pc, mem);
+    inst = pd->inst;
+    isz = pd->len;
+  }
+  else {
+    inst = s->load16u(phys_pc);
+    if((inst & 3) != 3) {
+      inst = rvc_expand(inst);
+      isz = 2;
+    }
+    else if((phys_pc & pg_mask) != (pg_mask - 1)) {
+      inst = s->load32(phys_pc);
+    }
+  }
+  /* the upper half of the instruction is on the next page */
+  if((isz == 4) and ((s->pc & pg_mask) == (pg_mask - 1))) {
+    uint64_t phys_hi = s->translate<policy>(s->pc + 2, fetch_fault, 2, false, true);
+    if(fetch_fault) {
+      except_cause = CAUSE_FETCH_PAGE_FAULT;
+      tval = s->pc + 2;
+      goto handle_exception;
+    }
+    inst = (inst & 0xffff) | (static_cast<uint32_t>(s->load16u(phys_hi)) << 16);
+    pd = nullptr;
+  }
+  /* reserved compressed encodings expand to 0 */
+  if(inst == 0) {
+    except_cause = CAUSE_ILLEGAL_INSTRUCTION;
+    tval = s->pc;
+    goto handle_exception;
+  }
   m.raw = inst;
   opcode = inst & 127;
 
@@ -837,44 +1846,11 @@ void execRiscv_(state_t *s) {
   }
 #endif  
   
-  if(false and (s->priv == priv_machine)) {
-    tohost = *reinterpret_cast<uint64_t*>(mem + globals::tohost_addr);
-    if(tohost) {
-      if(globals::fullsim) {
-	uint64_t dev = tohost >> 56;
-	uint64_t cmd = (tohost >> 48) & 255;
-	uint64_t payload = tohost & ((1UL<<48)-1);
-	if(tohost == 1) { /* shutdown */
-	  s->brk = 1;
-	  return;
-	}
-	if(dev != 1) {
-	  dump_calls();
-	  assert(false);
-	}
-	
-	if(cmd == 1) {
-	  std::cout << static_cast<char>(payload & 0xff);
-	  *reinterpret_cast<uint64_t*>(mem + globals::tohost_addr) = 0;
-	  *reinterpret_cast<uint64_t*>(mem + globals::fromhost_addr) = (dev << 56) | (cmd << 48);
-	}
-	else {
-	  assert(false);
-	}
-      }
-      else {
-	tohost &= ((1UL<<32)-1);      
-	handle_syscall(s, tohost);
-      }
-    }
-  }
-  
-  lop = (opcode & 3);
   rd = (inst>>7) & 31;
 
   assert(s->gpr[0] == 0);
   
-  if(/*s->priv == 3 and */globals::log) {
+  if(useTrace and globals::log) {
     std::cout << std::hex << s->pc << std::dec
 	      << " : " << getAsmString(inst, s->pc)
 	      << " , raw " << std::hex
@@ -886,266 +1862,302 @@ void execRiscv_(state_t *s) {
   }
   s->last_pc = s->pc;  
 
-
-  if(lop != 3) { /* compressed instructions generate exceptions */
-    int sel = ((inst>>13)&7);
-    std::cout << "lop " << lop <<  ", sel " << sel << "\n";
-    abort();
-    bool ok = false;
-    inst &= 65535;
-    switch(lop)
+  if(pd and (pd->op != pd_slow)) {
+    int64_t *gpr = s->gpr;
+    uint64_t u_rs1 = *reinterpret_cast<uint64_t*>(&gpr[pd->rs1]);
+    uint64_t u_rs2 = *reinterpret_cast<uint64_t*>(&gpr[pd->rs2]);
+    int64_t s_rs1 = gpr[pd->rs1], s_rs2 = gpr[pd->rs2];
+    switch(pd_unfused(pd->op))
       {
-      case 0:
-	switch(sel)
+      case pd_nop:
+	break;
+      case pd_lui:
+	gpr[pd->rd] = pd->imm;
+	break;
+      case pd_auipc:
+	gpr[pd->rd] = s->pc + pd->imm;
+	break;
+      case pd_jal: {
+	uint64_t bpu_idx = 0;
+	if(pd->rd != 0) {
+	  gpr[pd->rd] = s->pc + isz;
+	}
+	if(useBranch and globals::bpred) {
+	  globals::bpred->predict(s->pc, bpu_idx);
+	}
+	s->last_call = s->pc;
+	bool rd_is_link = pd->rd==1 or pd->rd==5;
+	if(rd_is_link) {
+	  calls.push(s->pc);
+	  if(useBranch and globals::branch_tracer) {
+	    globals::branch_tracer->add(s->pc, s->pc + pd->imm, true, true, false, false);
+	  }
+	}
+	if(useBranch and globals::bpred) {
+	  globals::bpred->update(s->pc, bpu_idx, true, true,
+				 pd->rd==0 ? branch_predictor::br_type::direct_br : branch_predictor::br_type::call);
+	}
+	if(useBBV) {
+	  int ff = -1;
+	  s->bblog->addSample(s->translate<policy>(s->pc, ff, 4, false, true), s->bbsz);
+	  s->bbsz = 0;
+	}
+	s->pc += pd->imm;
+	goto instruction_complete;
+      }
+      case pd_jalr: {
+	int64_t tgt64 = (gpr[pd->rs1] + pd->imm) & ~(1L);
+	uint64_t bpu_idx = 0;
+	if(useBranch and globals::bpred) {
+	  globals::bpred->predict(s->pc, bpu_idx);
+	}
+	if(pd->rd != 0) {
+	  gpr[pd->rd] = s->pc + isz;
+	}
+	s->last_call = s->pc;
+	bool rs1_is_link = pd->rs1==1 or pd->rs1==5;
+	bool rd_is_link = pd->rd==1 or pd->rd==5;
+	if((pd->rd == 0) and rs1_is_link) {
+	  if(useBranch and globals::branch_tracer) {
+	    globals::branch_tracer->add(s->pc, tgt64, true, false, false, true);
+	  }
+	  if(!calls.empty())
+	    calls.pop();
+	}
+	if(rd_is_link) {
+	  calls.push(s->pc);
+	  if(useBranch and globals::branch_tracer) {
+	    globals::branch_tracer->add(s->pc, tgt64, true, false, true, false);
+	  }
+	}
+	if(useBranch and globals::bpred) {
+	  globals::bpred->update(s->pc, bpu_idx, true, true, branch_predictor::br_type::call);
+	}
+	if(useBBV) {
+	  int ff = -1;
+	  s->bblog->addSample(s->translate<policy>(s->pc, ff, 4, false, true), s->bbsz);
+	  s->bbsz = 0;
+	}
+	s->pc = tgt64;
+	goto instruction_complete;
+      }
+      case pd_beq:
+      case pd_bne:
+      case pd_blt:
+      case pd_bge:
+      case pd_bltu:
+      case pd_bgeu: {
+	bool takeBranch = false;
+	uint64_t bpu_idx = 0;
+	bool bpu_pred = false;
+	if(useBranch and globals::bpred) {
+	  bpu_pred = globals::bpred->predict(s->pc, bpu_idx);
+	}
+	switch(pd_unfused(pd->op))
 	  {
-	  case 2: { /* c.lw */
-	    int rd = ((inst>>2) & 7) + 8;
-	    int rs1 = ((inst>>7) & 7) + 8;
-	    /* data in rs2, rs1 used for addr */
-	    //printf("rs1 = %d, rs2 = %d\n", rs1, rs2);
-	    uint32_t uimm26 = (inst>>5)&3;
-	    uint32_t uimm53 = (inst>>10)&7;
-	    uint32_t disp = (uimm26>>1) | (uimm53 << 1) | ((uimm26&1) << 4);
-	    //printf("disp = %u\n", disp);	    
-	    disp <<= 2;
-	    //printf("disp = %u\n", disp);
-	    assert(disp == 0);
-	    int64_t ea = disp + s->gpr[rs1];
-	    int fault;
-	    int64_t pa = s->translate(ea, fault, 4, false);	    
-	    if(fault) {
-	      except_cause = CAUSE_LOAD_PAGE_FAULT;
-	      tval = ea;
-	      goto handle_exception;
-	    }
-	    s->sext_xlen( s->load32(pa), rd);	    
-	    ok = true;
-	    s->pc += 2;
+	  case pd_beq:
+	    takeBranch = gpr[pd->rs1] == gpr[pd->rs2];
 	    break;
-	  }
-	
-	  case 6: { /* c.sw */
-	    int rs2 = ((inst>>2) & 7) + 8;
-	    int rs1 = ((inst>>7) & 7) + 8;
-	    /* data in rs2, rs1 used for addr */
-	    //printf("rs1 = %d, rs2 = %d\n", rs1, rs2);
-	    uint32_t uimm26 = (inst>>5)&3;
-	    uint32_t uimm53 = (inst>>10)&7;
-	    uint32_t disp = (uimm26>>1) | (uimm53 << 1) | ((uimm26&1) << 4);
-	    //printf("disp = %u\n", disp);	    
-	    disp <<= 2;
-	    //printf("disp = %u\n", disp);
-	    assert(disp == 0);
-	    int64_t ea = disp + s->gpr[rs1];
-	    int fault;
-	    int64_t pa = s->translate(ea, fault, 4, true);	    
-	    if(fault) {
-	      except_cause = CAUSE_STORE_PAGE_FAULT;
-	      tval = ea;
-	      goto handle_exception;
-	    }
-	    s->store32(pa, s->gpr[rs2]);
-	    ok = true;
-	    s->pc += 2;
+	  case pd_bne:
+	    takeBranch = gpr[pd->rs1] != gpr[pd->rs2];
+	    break;
+	  case pd_blt:
+	    takeBranch = gpr[pd->rs1] < gpr[pd->rs2];
+	    break;
+	  case pd_bge:
+	    takeBranch = gpr[pd->rs1] >= gpr[pd->rs2];
+	    break;
+	  case pd_bltu:
+	    takeBranch = u_rs1 < u_rs2;
 	    break;
-	  }
 	  default:
+	    takeBranch = u_rs1 >= u_rs2;
 	    break;
 	  }
-	break;
-      case 1:
-	switch(sel)
+	if(useBranch and globals::branch_tracer) {
+	  globals::branch_tracer->add(s->pc, s->pc + pd->imm, takeBranch);
+	}
+	if(useBranch and globals::bpred) {
+	  globals::bpred->update(s->pc, bpu_idx, bpu_pred, takeBranch,
+				 branch_predictor::br_type::cond);
+	}
+	if(useBBV) {
+	  int ff = -1;
+	  s->bblog->addSample(s->translate<policy>(s->pc, ff, 4, false, true), s->bbsz);
+	  s->bbsz = 0;
+	}
+	s->pc += takeBranch ? pd->imm : isz;
+	goto instruction_complete;
+      }
+      case pd_lb:
+      case pd_lh:
+      case pd_lw:
+      case pd_ld:
+      case pd_lbu:
+      case pd_lhu:
+      case pd_lwu: {
+	int64_t ea = gpr[pd->rs1] + pd->imm;
+	int page_fault = 0;
+	uint8_t *h = nullptr;
+	if((policy == 0) and (h = tlb_host(s, ea, 1<<((inst>>12) & 3), false))) {
+	  s->va_track_pa += (((ea ^ (h - mem)) >> 12) & 3) == 0;
+	  s->loads++;
+	  gpr[pd->rd] = host_load(h, pd->op);
+	  break;
+	}
+	int64_t pa = s->translate<policy>(ea, page_fault, 1<<((inst>>12) & 3));
+	if(page_fault) {
+	  except_cause = CAUSE_LOAD_PAGE_FAULT;
+	  tval = ea;
+	  goto handle_exception;
+	}
+	if(useMAV) {
+	  s->mlog->addSample((pa >> 12) << 12, 1);
+	}
+	s->va_track_pa += (((ea >> 12) & 3) == ((pa >> 12) & 3));
+	s->loads++;
+	switch(pd->op)
 	  {
-	  case 0: { /* c.addi */
-	    int rd = (inst>>7)&31;
-	    int simm32 = (((inst >> 12)&1)<<5) | ((inst >> 2) & 31);
-	    simm32 = (simm32<<26) >> 26;
-	    if(rd) {
-	      s->sext_xlen(s->gpr[rd] + static_cast<int64_t>(simm32), rd);
-	    }
-	    ok = true;
-	    s->pc += 2;
+	  case pd_lb:
+	    gpr[pd->rd] = s->load8(pa);
 	    break;
-	  }
-	  case 1: { /* c.jal or c.addiw */
-	    int rd = (inst>>7)&31;
-	    if(rd==0) { /* c.jal */
-	      
-	    }
-	    else { /* c.addiw */
-	      int simm32 = (((inst >> 12)&1)<<5) | ((inst >> 2) & 31);
-	      simm32 = (simm32<<26) >> 26;
-	      int32_t r = simm32 + *reinterpret_cast<int32_t*>(&s->gpr[rd]);
-	      s->sext_xlen(r, rd);
-	      s->pc += 2;
-	      ok = true;
-	    }
+	  case pd_lh:
+	    gpr[pd->rd] = s->load16(pa);
 	    break;
-	  }
-	  case 2: { /* c.li */
-	    int rd = (inst>>7)&31;
-	    int simm32 = (((inst >> 12)&1)<<5) | ((inst >> 2) & 31);
-	    simm32 = (simm32<<26) >> 26;
-	    if(rd) {
-	      s->sext_xlen(static_cast<int64_t>(simm32), rd);
-	    }
-	    s->pc += 2;
-	    ok = true;
+	  case pd_lw:
+	    gpr[pd->rd] = s->load32(pa);
 	    break;
-	  }
-	  case 5: { /* c.j */
-	    /* offset[11|4|9:8|10|6|7|3:1|5 */
-	    rvc_t c(inst);
-	    int32_t imm = 0;
-	    imm = c.j.imm31 << 1;
-	    imm |= c.j.imm4 << 4;
-	    imm |= c.j.imm5 << 5;
-	    imm |= c.j.imm6 << 6;
-	    imm |= c.j.imm7 << 7;
-	    imm |= c.j.imm98 << 8;
-	    imm |= c.j.imm10 << 10;
-	    imm |= c.j.imm11 << 11;
-	    imm = (imm << 20) >> 20;
-	    s->pc += imm;
-	    ok = true;
+	  case pd_ld:
+	    gpr[pd->rd] = s->load64(pa);
+	    break;
+	  case pd_lbu:
+	    gpr[pd->rd] = s->load8u(pa);
+	    break;
+	  case pd_lhu:
+	    gpr[pd->rd] = s->load16u(pa);
 	    break;
-	  }
 	  default:
+	    gpr[pd->rd] = s->load32u(pa);
 	    break;
 	  }
 	break;
-      case 2:
-	switch(sel)
+      }
+      case pd_sb:
+      case pd_sh:
+      case pd_sw:
+      case pd_sd: {
+	int64_t ea = gpr[pd->rs1] + pd->imm;
+	int fault = 0;
+	uint8_t *h = nullptr;
+	if((policy == 0) and (h = tlb_host(s, ea, 1<<((inst>>12) & 3), true))) {
+	  host_store(h, pd->op, gpr[pd->rs2]);
+	  break;
+	}
+	int64_t pa = s->translate<policy>(ea, fault, 1<<((inst>>12) & 3), true);
+	if(fault) {
+	  except_cause = CAUSE_STORE_PAGE_FAULT;
+	  tval = ea;
+	  goto handle_exception;
+	}
+	if(useMAV) {
+	  s->mlog->addSample((pa >> 12) << 12, 1);
+	}
+	switch(pd->op)
 	  {
-	  case 4: /* c.jr, c.mv, c.ebreak, c.jalr, c.add */{
-	    int rs2 = (inst>>2) & 31;
-	    int rd = (inst>>7) & 31;
-	    if((inst>>12) & 1) {
-	      if(rd!=0 && rs2!=0) { /* c.add */
-		ok = true;
-		s->sext_xlen(s->gpr[rd] + s->gpr[rs2], rd);		
-		s->pc += 2;
-	      }
-	    }
-	    else {
-	      if(rd!=0 && rs2!=0) { /* reg-reg mv */
-		ok = true;
-		s->gpr[rd] = s->gpr[rs2];
-		s->pc += 2;
-	      }
-	    }
+	  case pd_sb:
+	    s->store8(pa, gpr[pd->rs2]);
 	    break;
-	  }
-	  case 7: { /* SDSP */
-	    int rs2 = (inst >> 2) & 31;
-	    uint32_t ds = (inst >> 7) & 63;
-	    uint32_t hi = ds & 7;
-	    uint32_t lo = (ds>>3) & 7;
-	    uint32_t d = ((hi<<3) | lo)<<3;
-	    int64_t ea = d + s->gpr[2];
-	    int fault;
-	    int64_t pa = s->translate(ea, fault, 8, true);	    
-	    if(fault) {
-	      except_cause = CAUSE_STORE_PAGE_FAULT;
-	      tval = ea;
-	      goto handle_exception;
-	    }
-	    s->store64(pa, s->gpr[rs2]);
-	    s->pc += 2;
-	    ok = true;
+	  case pd_sh:
+	    s->store16(pa, gpr[pd->rs2]);
+	    break;
+	  case pd_sw:
+	    s->store32(pa, gpr[pd->rs2]);
 	    break;
-	  }
 	  default:
+	    s->store64(pa, gpr[pd->rs2]);
 	    break;
 	  }
 	break;
-      default:
+      }
+#define PD_ALU_CASE(NAME, EXPR)		\
+      case NAME:				\
+	gpr[pd->rd] = (EXPR);			\
 	break;
+	PD_ALU_OPS(PD_ALU_CASE)
+#undef PD_ALU_CASE
+      default:
+	assert(false);
       }
-
-    if(ok) {
-      goto instruction_complete;
-    }
-    
-    except_cause = CAUSE_ILLEGAL_INSTRUCTION;
-    tval = s->pc;
-    std::cout << std::hex << s->pc << std::dec
-	      << " : " << getAsmString(inst, s->pc)
-	      << " , raw " << std::hex
-	      << inst
-	      << std::dec
-	      << " , icnt " << s->icnt
-	      << " ,  priv " << s->priv
-	      << "\n";
-    
-    goto handle_exception;
+    /* a load into x0 still runs for its faults and side effects */
+    gpr[0] = 0;
+    s->pc += isz;
+    goto instruction_complete;
   }
 
   switch(opcode)
     {
     case 0x3: {
-      if(m.l.rd != 0) {
-	int32_t disp = m.l.imm11_0;
-	if((inst>>31)&1) {
-	  disp |= 0xfffff000;
-	}
-	int64_t disp64 = disp;
-	int64_t ea = ((disp64 << 32) >> 32) + s->gpr[m.l.rs1];
-	int sz = 1<<(m.s.sel & 3);
+      int32_t disp = m.l.imm11_0;
+      if((inst>>31)&1) {
+	disp |= 0xfffff000;
+      }
+      int64_t disp64 = disp;
+      int64_t ea = ((disp64 << 32) >> 32) + s->gpr[m.l.rs1];
+      int sz = 1<<(m.s.sel & 3);
 	
-	int page_fault = 0;
-	int64_t pa = s->translate(ea, page_fault, sz);
+      int page_fault = 0;
+      int64_t pa = s->translate<policy>(ea, page_fault, sz);
 	  
-	if(page_fault) {
-	  except_cause = CAUSE_LOAD_PAGE_FAULT;
-	  tval = ea;
-	  //std::cout << "ea = " << std::hex << ea << std::dec << " causes ld pf\n";
-	  //std::cout << "pa = " << std::hex << pa << std::dec << "\n";
-	  //std::cout << "pc = " << std::hex << s->pc << std::dec << "\n";
-	  goto handle_exception;
-	}
-	if(useMAV) {
-	  s->mlog->addSample((pa >> 12) << 12, 1);
-	}
+      if(page_fault) {
+	except_cause = CAUSE_LOAD_PAGE_FAULT;
+	tval = ea;
+	//std::cout << "ea = " << std::hex << ea << std::dec << " causes ld pf\n";
+	//std::cout << "pa = " << std::hex << pa << std::dec << "\n";
+	//std::cout << "pc = " << std::hex << s->pc << std::dec << "\n";
+	goto handle_exception;
+      }
+      if(useMAV) {
+	s->mlog->addSample((pa >> 12) << 12, 1);
+      }
 	
-	int p = (pa >> 12) & 3;
-	int v = (ea >> 12) & 3;
-	s->va_track_pa += (v==p);
-	s->loads++;
+      int p = (pa >> 12) & 3;
+      int v = (ea >> 12) & 3;
+      s->va_track_pa += (v==p);
+      s->loads++;
 
 	
 	
-	switch(m.s.sel)
-	  {
-	  case 0x0: /* lb */
-	    s->gpr[m.l.rd] = s->load8(pa);
-	    break;
-	  case 0x1: /* lh */
-	    s->gpr[m.l.rd] = s->load16(pa);
-	    break;
-	  case 0x2: /* lw */
-	    s->sext_xlen( s->load32(pa), m.l.rd);
-	    break;
-	  case 0x3: /* ld */
-	    s->gpr[m.l.rd] = s->load64(pa);
-	    break;
-	  case 0x4:/* lbu */
-	    s->gpr[m.l.rd] = s->load8u(pa);
-	    break;
-	  case 0x5: /* lhu */
-	    s->gpr[m.l.rd] = s->load16u(pa);	    
-	    break;
-	  case 0x6: /* lwu */
-	    s->gpr[m.l.rd] = s->load32u(pa);	    	    
-	    break;
-	  default:
-	    goto report_unimplemented;
-	    assert(0);
-	  }
+      switch(m.s.sel)
+	{
+	case 0x0: /* lb */
+	  s->gpr[m.l.rd] = s->load8(pa);
+	  break;
+	case 0x1: /* lh */
+	  s->gpr[m.l.rd] = s->load16(pa);
+	  break;
+	case 0x2: /* lw */
+	  s->sext_xlen( s->load32(pa), m.l.rd);
+	  break;
+	case 0x3: /* ld */
+	  s->gpr[m.l.rd] = s->load64(pa);
+	  break;
+	case 0x4:/* lbu */
+	  s->gpr[m.l.rd] = s->load8u(pa);
+	  break;
+	case 0x5: /* lhu */
+	  s->gpr[m.l.rd] = s->load16u(pa);	    
+	  break;
+	case 0x6: /* lwu */
+	  s->gpr[m.l.rd] = s->load32u(pa);	    	    
+	  break;
+	default:
+	  goto report_unimplemented;
+	  assert(0);
+	}
 
-	s->pc += 4;
-	break;
-      }
+      s->gpr[0] = 0;
+      s->pc += isz;
+      break;
     }
     case 0xb: {
       /* davids hacks */
@@ -1154,7 +2166,7 @@ void execRiscv_(state_t *s) {
 	case 0x2: {/* lwx */
 	  int64_t ea = s->gpr[m.r.rs1] + s->gpr[m.r.rs2];
 	  int page_fault = 0;
-	  int64_t pa = s->translate(ea, page_fault, 4);
+	  int64_t pa = s->translate<policy>(ea, page_fault, 4);
 	  if(page_fault) {
 	    except_cause = CAUSE_LOAD_PAGE_FAULT;
 	    tval = ea;
@@ -1170,11 +2182,14 @@ void execRiscv_(state_t *s) {
 	  assert(false);
 	}
       }
-      s->pc += 4;      
+      s->pc += isz;      
       break;
     }
     case 0xf:/* fence - there's a bunch of 'em */
-      s->pc += 4;
+      if((m.r.sel == 1) and s->pdc) { /* fence.i */
+	s->pdc->flush();
+      }
+      s->pc += isz;
       break;
     case 0x13: {
       int32_t simm32 = (inst >> 20);
@@ -1195,12 +2210,10 @@ void execRiscv_(state_t *s) {
 	  }
 	  case 1: /* slli */
 	    if((inst>>20) == 0x600) { /* clz */
-	      uint64_t u = *reinterpret_cast<uint64_t*>(&s->gpr[m.i.rs1]);
-	      s->gpr[m.i.rd] = u==0 ? ~0UL : __builtin_clzl(u);
+	      s->gpr[m.i.rd] = clz64(s->get_reg_u64(m.i.rs1));
 	    }
 	    else if((inst>>20) == 0x601) { /* ctz */
-	      uint64_t u = *reinterpret_cast<uint64_t*>(&s->gpr[m.i.rs1]);
-	      s->gpr[m.i.rd] = u==0 ? ~0UL : __builtin_ctzl(u);
+	      s->gpr[m.i.rd] = ctz64(s->get_reg_u64(m.i.rs1));
 	    }
 	    else if((inst>>20) == 0x602) { /* cpop */
 	      uint64_t u = *reinterpret_cast<uint64_t*>(&s->gpr[m.i.rs1]);
@@ -1239,6 +2252,15 @@ void execRiscv_(state_t *s) {
 	      if(sel == 0) {
 		s->sext_xlen((*reinterpret_cast<uint64_t*>(&s->gpr[m.i.rs1])) << shamt, rd);
 	      }
+	      else if(sel == 0x0a) { /* bseti */
+		s->gpr[rd] = s->get_reg_u64(m.i.rs1) | (1UL << shamt);
+	      }
+	      else if(sel == 0x12) { /* bclri */
+		s->gpr[rd] = s->get_reg_u64(m.i.rs1) & ~(1UL << shamt);
+	      }
+	      else if(sel == 0x1a) { /* binvi */
+		s->gpr[rd] = s->get_reg_u64(m.i.rs1) ^ (1UL << shamt);
+	      }
 	      else {
 		std::cout << "WTF at PC " << FMT_HEX(s->pc) << "\n";
 		assert(0);
@@ -1262,20 +2284,14 @@ void execRiscv_(state_t *s) {
 	      s->gpr[rd] = (*reinterpret_cast<uint64_t*>(&s->gpr[m.i.rs1]) >> shamt);
 	    }
 	    else if(sel == 0xa) { /* orcb */
-	      uint64_t u = s->get_reg_u64(m.i.rs1), x = 0;
-	      x = (u & 255) == 0 ? 0 : 255UL;
-	      x |= ((u>>8) & 255) == 0 ? 0 : 255UL<<8;
-	      x |= ((u>>16) & 255) == 0 ? 0 : 255UL<<16;
-	      x |= ((u>>24) & 255) == 0 ? 0 : 255UL<<24;	      	      	      
-	      x |= ((u>>32) & 255) == 0 ? 0 : 255UL<<32;
-	      x |= ((u>>40) & 255) == 0 ? 0 : 255UL<<40;
-	      x |= ((u>>48) & 255) == 0 ? 0 : 255UL<<48;
-	      x |= ((u>>56) & 255) == 0 ? 0 : 255UL<<56;
-	      s->gpr[rd] = x;
+	      s->gpr[rd] = orc_b(s->get_reg_u64(m.i.rs1));
 	    }	    
 	    else if(sel == 16) { /* srai */
 	      s->gpr[rd] = s->gpr[m.i.rs1] >> shamt;
 	    }
+	    else if(sel == 0x12) { /* bexti */
+	      s->gpr[rd] = (s->get_reg_u64(m.i.rs1) >> shamt) & 1;
+	    }
 	    else if(sel == 0x18) { /* rori */
 	      s->gpr[rd] = ror64(s->get_reg_u64(m.i.rs1), shamt);
 	    }
@@ -1300,7 +2316,7 @@ void execRiscv_(state_t *s) {
 	    assert(false);
 	  }
       }
-      s->pc += 4;
+      s->pc += isz;
       break;
     }
     case 0x1b: {      
@@ -1322,30 +2338,25 @@ void execRiscv_(state_t *s) {
 	      s->gpr[m.i.rd] = sext(r);
 	    }
 	    else if(sel == 2) {  /*SLLIUW*/
-	      uint64_t c = static_cast<uint64_t>(s->get_reg_u32(m.i.rs1)) << shamt;
+	      uint64_t c = static_cast<uint64_t>(s->get_reg_u32(m.i.rs1)) << ((inst>>20) & 63);
 	      s->sext_xlen(c, m.r.rd);	      
 	    }
-	    else if(sel == 0x18) { /* clzw */
-	      uint32_t u = *reinterpret_cast<uint32_t*>(&s->gpr[m.i.rs1]);	      
-	      if(u == 0) {
-		s->gpr[m.i.rd] = ~0UL;
-	      }
-	      else {
-		switch( (inst>>20)&31 )
-		  {
-		  case 0: /* clzw */
-		    s->gpr[m.i.rd] = __builtin_clz(u);
-		    break;
-		  case 1: /* ctzw */
-		    s->gpr[m.i.rd] = __builtin_ctz(u);		    
-		    break;
-		  case 2: /* cpopw */
-		    s->gpr[m.i.rd] = __builtin_popcount(u);		    
-		    break;		    
-		  default:
-		    assert(0);
-		  }
-	      }
+	    else if(sel == 0x18) { /* clzw */
+	      uint32_t u = *reinterpret_cast<uint32_t*>(&s->gpr[m.i.rs1]);	      
+	      switch( (inst>>20)&31 )
+		{
+		case 0: /* clzw */
+		  s->gpr[m.i.rd] = clz32(u);
+		  break;
+		case 1: /* ctzw */
+		  s->gpr[m.i.rd] = ctz32(u);
+		  break;
+		case 2: /* cpopw */
+		  s->gpr[m.i.rd] = __builtin_popcount(u);		    
+		  break;		    
+		default:
+		  assert(0);
+		}
 	    }
 	    else {
 	      goto report_unimplemented;
@@ -1379,18 +2390,18 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
       }
-      s->pc += 4;
+      s->pc += isz;
       break;
     }
     case 0x2f: {
       int page_fault = 0;
       uint64_t pa = 0;
       if(m.a.sel == 2) {
-	pa = s->translate(s->gpr[m.a.rs1], page_fault, 4, true);
+	pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 4, true);
 	switch(m.a.hiop)
 	  {
 	  case 0x0: {/* amoadd.w */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 4, true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 4, true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1404,7 +2415,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0x1: {/* amoswap.w */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 4,  true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 4,  true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1418,7 +2429,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0x2: { /* lr.w */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 4);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 4);
 	    if(page_fault) {
 	      except_cause = CAUSE_LOAD_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1432,7 +2443,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0x3 : { /* sc.w */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 4, true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 4, true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1448,7 +2459,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0x8: {/* amoor.w */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 4, true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 4, true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1463,7 +2474,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0xc: {/* amoand.w */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 4, true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 4, true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1477,7 +2488,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0x1c: {/* amomaxu.w */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 4, true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 4, true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1497,11 +2508,11 @@ void execRiscv_(state_t *s) {
 	  }
       }
       else if(m.a.sel == 3) {
-	pa = s->translate(s->gpr[m.a.rs1], page_fault, 8, false);
+	pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 8, false);
 	switch(m.a.hiop)
 	  {
 	  case 0x0: {/* amoadd.d */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 8, true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 8, true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1515,7 +2526,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0x1: {/* amoswap.d */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 8, true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 8, true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1529,7 +2540,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0x2: { /* lr.d */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 8);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 8);
 	    if(page_fault) {
 	      except_cause = CAUSE_LOAD_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1543,7 +2554,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0x3 : { /* sc.d */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 8,  true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 8,  true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1559,7 +2570,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0x4: {/* amoxor.d */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 8, true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 8, true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1574,7 +2585,7 @@ void execRiscv_(state_t *s) {
 	  }	    
 	    
 	  case 0x8: {/* amoor.d */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 8, true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 8, true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1588,7 +2599,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0xc: {/* amoand.d */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 8, true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 8, true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1603,7 +2614,7 @@ void execRiscv_(state_t *s) {
 	    break;
 	  }
 	  case 0x1c: {/* amoand.d */
-	    pa = s->translate(s->gpr[m.a.rs1], page_fault, 8, true);
+	    pa = s->translate<policy>(s->gpr[m.a.rs1], page_fault, 8, true);
 	    if(page_fault) {
 	      except_cause = CAUSE_STORE_PAGE_FAULT;
 	      tval = s->gpr[m.a.rs1];
@@ -1624,7 +2635,7 @@ void execRiscv_(state_t *s) {
       else {	
 	assert(false);
       }
-      s->pc += 4;
+      s->pc += isz;
       break;
     }
     case 0x3b: {
@@ -1661,7 +2672,10 @@ void execRiscv_(state_t *s) {
 	}		
 	else if((m.r.sel == 4) & (m.r.special == 1)) { /* divw */
 	  int32_t c = ~0;
-	  if(b != 0) {
+	  if((a == std::numeric_limits<int32_t>::min()) and (b == -1)) {
+	    c = a;
+	  }
+	  else if(b != 0) {
 	    c = a/b;
 	  }
 	  s->sext_xlen(c, m.r.rd);
@@ -1711,8 +2725,11 @@ void execRiscv_(state_t *s) {
 	  s->sext_xlen(c, m.r.rd);	  
 	}
 	else if((m.r.sel == 6) & (m.r.special == 1)) { /* remw */
-	  int32_t c = ~0;
-	  if (b != 0) {
+	  int32_t c = a;
+	  if((a == std::numeric_limits<int32_t>::min()) and (b == -1)) {
+	    c = 0;
+	  }
+	  else if (b != 0) {
 	    c= a % b;
 	  }
 	  s->sext_xlen(c, m.r.rd);
@@ -1720,7 +2737,7 @@ void execRiscv_(state_t *s) {
 	else if((m.r.sel == 7) & (m.r.special == 1)) { /* remuw */
 	  uint32_t aa = s->get_reg_u32(m.r.rs1);
 	  uint32_t bb = s->get_reg_u32(m.r.rs2);
-	  uint32_t c = ~0;
+	  uint32_t c = aa;
 	  if(bb != 0) {
 	    c = aa%bb;
 	  }
@@ -1737,7 +2754,7 @@ void execRiscv_(state_t *s) {
 	}
 	
       }
-      s->pc += 4;
+      s->pc += isz;
       break;
     }      
     case 0x23: {
@@ -1748,7 +2765,7 @@ void execRiscv_(state_t *s) {
       int fault;
 
       int sz = 1<<(m.s.sel);
-      int64_t pa = s->translate(ea, fault, sz, true);
+      int64_t pa = s->translate<policy>(ea, fault, sz, true);
       
       if(fault) {
 	except_cause = CAUSE_STORE_PAGE_FAULT;
@@ -1776,9 +2793,94 @@ void execRiscv_(state_t *s) {
 	default:
 	  assert(0);
 	}
-      s->pc += 4;
+      s->pc += isz;
+      break;
+    }
+    case 0x07: { /* flw, fld */
+      int sz = 1<<(m.l.sel & 7);
+      if((sz == 1) or (sz >= 32)) { /* vector loads */
+	if(not(exec_vector(s, inst, except_cause, tval))) {
+	  goto handle_exception;
+	}
+	s->pc += isz;
+	break;
+      }
+      if(not(fp_enabled(s)) or ((sz != 4) and (sz != 8))) {
+	except_cause = CAUSE_ILLEGAL_INSTRUCTION;
+	tval = s->pc;
+	goto handle_exception;
+      }
+      int64_t ea = s->gpr[m.l.rs1] + (static_cast<int32_t>(inst) >> 20);
+      int page_fault = 0;
+      int64_t pa = s->translate<policy>(ea, page_fault, sz);
+      if(page_fault) {
+	except_cause = CAUSE_LOAD_PAGE_FAULT;
+	tval = ea;
+	goto handle_exception;
+      }
+      if(useMAV) {
+	s->mlog->addSample((pa >> 12) << 12, 1);
+      }
+      s->loads++;
+      s->fpr[m.l.rd] = (sz == 4) ? fp_box32(s->load32u(pa)) : s->load64(pa);
+      fp_set_dirty(s);
+      s->pc += isz;
+      break;
+    }
+    case 0x27: { /* fsw, fsd */
+      int sz = 1<<(m.s.sel & 7);
+      if((sz == 1) or (sz >= 32)) { /* vector stores */
+	if(not(exec_vector(s, inst, except_cause, tval))) {
+	  goto handle_exception;
+	}
+	s->pc += isz;
+	break;
+      }
+      if(not(fp_enabled(s)) or ((sz != 4) and (sz != 8))) {
+	except_cause = CAUSE_ILLEGAL_INSTRUCTION;
+	tval = s->pc;
+	goto handle_exception;
+      }
+      int32_t disp = m.s.imm4_0 | (m.s.imm11_5 << 5);
+      disp |= ((inst>>31)&1) ? 0xfffff000 : 0x0;
+      int64_t ea = s->gpr[m.s.rs1] + disp;
+      int fault = 0;
+      int64_t pa = s->translate<policy>(ea, fault, sz, true);
+      if(fault) {
+	except_cause = CAUSE_STORE_PAGE_FAULT;
+	tval = ea;
+	goto handle_exception;
+      }
+      if(useMAV) {
+	s->mlog->addSample((pa >> 12) << 12, 1);
+      }
+      if(sz == 4) {
+	s->store32(pa, s->fpr[m.s.rs2]);
+      }
+      else {
+	s->store64(pa, s->fpr[m.s.rs2]);
+      }
+      s->pc += isz;
       break;
     }
+    case 0x43: /* fmadd */
+    case 0x47: /* fmsub */
+    case 0x4b: /* fnmsub */
+    case 0x4f: /* fnmadd */
+    case 0x53: /* op-fp */
+      if(not(exec_fp(s, inst))) {
+	except_cause = CAUSE_ILLEGAL_INSTRUCTION;
+	tval = s->pc;
+	goto handle_exception;
+      }
+      s->pc += isz;
+      break;
+    case 0x57: /* op-v */
+      if(not(exec_vector(s, inst, except_cause, tval))) {
+	goto handle_exception;
+      }
+      s->pc += isz;
+      break;
 
       
       //imm[31:12] rd 011 0111 LUI
@@ -1787,7 +2889,7 @@ void execRiscv_(state_t *s) {
 	int32_t imm32 = inst & 0xfffff000;
 	s->sext_xlen(imm32, rd);
       }
-      s->pc += 4;
+      s->pc += isz;
       break;
       //imm[31:12] rd 0010111 AUIPC
     case 0x17: /* is this sign extended */
@@ -1797,7 +2899,7 @@ void execRiscv_(state_t *s) {
 	int64_t y = s->pc + imm;
 	s->sext_xlen(y, rd);
       }
-      s->pc += 4;
+      s->pc += isz;
       break;
       
       //imm[11:0] rs1 000 rd 1100111 JALR
@@ -1812,12 +2914,12 @@ void execRiscv_(state_t *s) {
       
       branch_predictor::br_type ty = branch_predictor::br_type::call;
 	
-      if(globals::bpred) {
+      if(useBranch and globals::bpred) {
 	globals::bpred->predict(s->pc, bpu_idx);
       }
       
       if(m.jj.rd != 0) {
-	s->gpr[m.jj.rd] = s->pc + 4;
+	s->gpr[m.jj.rd] = s->pc + isz;
       }
       //std::cout << "target = " << std::hex << tgt64 << std::dec << "\n";
       s->last_call = s->pc;
@@ -1827,7 +2929,7 @@ void execRiscv_(state_t *s) {
       bool rd_is_link = m.jj.rd==1 or m.jj.rd==5;
       
       if((m.jj.rd == 0) and rs1_is_link) {
-	if(globals::branch_tracer) {
+	if(useBranch and globals::branch_tracer) {
 	  globals::branch_tracer->add(s->pc, tgt64, true, false, false, true);
 	}	
 	
@@ -1837,17 +2939,17 @@ void execRiscv_(state_t *s) {
       
       if(rd_is_link) {
 	calls.push(s->pc);
-	if(globals::branch_tracer) {
+	if(useBranch and globals::branch_tracer) {
 	  globals::branch_tracer->add(s->pc, tgt64, true, false, true, false);
 	}	
 	
       }
-      if(globals::bpred) {
+      if(useBranch and globals::bpred) {
 	globals::bpred->update(s->pc, bpu_idx, true, true, ty);
       }      
       if(useBBV) {
 	int ff = -1;
-	s->bblog->addSample(s->translate(s->pc, ff, 4, false, true), s->bbsz);
+	s->bblog->addSample(s->translate<policy>(s->pc, ff, 4, false, true), s->bbsz);
 	s->bbsz = 0;
       }
       s->pc = tgt64;
@@ -1865,27 +2967,27 @@ void execRiscv_(state_t *s) {
       int64_t jaddr = jaddr32;
       jaddr = (jaddr << 32) >> 32;
       if(rd != 0) {
-	s->gpr[rd] = s->pc + 4;
+	s->gpr[rd] = s->pc + isz;
       }
       uint64_t bpu_idx = 0;
-      if(globals::bpred) {
+      if(useBranch and globals::bpred) {
 	globals::bpred->predict(s->pc, bpu_idx);
       }      
       s->last_call = s->pc;
       bool rd_is_link = rd==1 or rd==5;      
       if(rd_is_link) {
 	calls.push(s->pc);
-	if(globals::branch_tracer) {
+	if(useBranch and globals::branch_tracer) {
 	  globals::branch_tracer->add(s->pc, s->pc + jaddr, true, true, false, false);
 	}		
       }
-      if(globals::bpred) {
+      if(useBranch and globals::bpred) {
 	globals::bpred->update(s->pc, bpu_idx, true, true,
 			       rd==0 ? branch_predictor::br_type::direct_br : branch_predictor::br_type::call);
       }      
       if(useBBV) {
 	int ff = -1;
-	s->bblog->addSample(s->translate(s->pc, ff, 4, false, true), s->bbsz);
+	s->bblog->addSample(s->translate<policy>(s->pc, ff, 4, false, true), s->bbsz);
 	s->bbsz = 0;	
       }
       s->pc += jaddr;      
@@ -1994,9 +3096,21 @@ void execRiscv_(state_t *s) {
 		s->gpr[m.r.rd] = (t>>64);
 		break;
 	      }
+	      case 0x5: /* clmul */
+		s->gpr[m.r.rd] = static_cast<uint64_t>(clmul128(u_rs1, u_rs2));
+		break;
+	      case 0x14: /* bset */
+		s->gpr[m.r.rd] = u_rs1 | (1UL << (u_rs2 & 63));
+		break;
+	      case 0x24: /* bclr */
+		s->gpr[m.r.rd] = u_rs1 & ~(1UL << (u_rs2 & 63));
+		break;
 	      case 0x30: /* rol */
 		s->gpr[rd] = rol64(s->get_reg_u64(m.i.rs1), s->gpr[m.r.rs2] & (s->xlen()-1));		
 		break;	
+	      case 0x34: /* binv */
+		s->gpr[m.r.rd] = u_rs1 ^ (1UL << (u_rs2 & 63));
+		break;
 	      default:
 		std::cout << "sel = " << m.r.sel << ", special = " << m.r.special << "\n";
 		std::cout << std::hex << s->pc << std::dec << "\n";
@@ -2009,6 +3123,9 @@ void execRiscv_(state_t *s) {
 	      case 0x0:
 		s->gpr[m.r.rd] = s->gpr[m.r.rs1] < s->gpr[m.r.rs2];
 		break;
+	      case 0x5: /* clmulr */
+		s->gpr[m.r.rd] = static_cast<uint64_t>(clmul128(u_rs1, u_rs2) >> 63);
+		break;
 	      case 0x10: /* sh1add */
 		s->sext_xlen(((s->gpr[m.r.rs1]<<1) + s->gpr[m.r.rs2]), m.r.rd);
 		break;
@@ -2028,6 +3145,9 @@ void execRiscv_(state_t *s) {
 		*reinterpret_cast<uint64_t*>(&s->gpr[m.r.rd]) = (t>>64);
 		break;
 	      }
+	      case 0x5: /* clmulh */
+		s->gpr[m.r.rd] = static_cast<uint64_t>(clmul128(u_rs1, u_rs2) >> 64);
+		break;
 	      default:
 		std::cout << "sel = " << m.r.sel << ", special = " << m.r.special << "\n";
 		std::cout << "pc = " << std::hex << s->pc << std::dec << "\n";
@@ -2041,7 +3161,12 @@ void execRiscv_(state_t *s) {
 		s->gpr[m.r.rd] = s->gpr[m.r.rs1] ^ s->gpr[m.r.rs2];
 		break;
 	      case 0x1:
-		s->gpr[m.r.rd] =s->gpr[m.r.rs2]==0 ? ~0L : s->gpr[m.r.rs1] / s->gpr[m.r.rs2];
+		if((s->gpr[m.r.rs1] == std::numeric_limits<int64_t>::min()) and (s->gpr[m.r.rs2] == -1)) {
+		  s->gpr[m.r.rd] = s->gpr[m.r.rs1];
+		}
+		else {
+		  s->gpr[m.r.rd] =s->gpr[m.r.rs2]==0 ? ~0L : s->gpr[m.r.rs1] / s->gpr[m.r.rs2];
+		}
 		break;
 	      case 0x5: /* min */
 		s->gpr[m.r.rd] = std::min(s->gpr[m.r.rs1], s->gpr[m.r.rs2]);	
@@ -2075,6 +3200,9 @@ void execRiscv_(state_t *s) {
 	      case 0x20: /* sra */
 		s->gpr[rd] = s->gpr[m.r.rs1] >> (s->gpr[m.r.rs2] & (s->xlen()-1));
 		break;
+	      case 0x24: /* bext */
+		s->gpr[m.r.rd] = (u_rs1 >> (u_rs2 & 63)) & 1;
+		break;
 	      case 0x30: /* ror */
 		s->gpr[rd] = ror64(s->get_reg_u64(m.i.rs1), s->gpr[m.r.rs2] & (s->xlen()-1));
 		break;
@@ -2102,7 +3230,10 @@ void execRiscv_(state_t *s) {
 		break;
 	      case 0x1:
 		if(s->gpr[m.r.rs2] == 0) {
-		  s->gpr[m.r.rd] = ~(0L);
+		  s->gpr[m.r.rd] = s->gpr[m.r.rs1];
+		}
+		else if((s->gpr[m.r.rs1] == std::numeric_limits<int64_t>::min()) and (s->gpr[m.r.rs2] == -1)) {
+		  s->gpr[m.r.rd] = 0;
 		}
 		else {
 		  s->gpr[m.r.rd] = s->gpr[m.r.rs1] % s->gpr[m.r.rs2];
@@ -2130,7 +3261,7 @@ void execRiscv_(state_t *s) {
 		s->gpr[m.r.rd] = s->gpr[m.r.rs1] & s->gpr[m.r.rs2];
 		break;
 	      case 0x1: { /* remu */
-		*reinterpret_cast<uint64_t*>(&s->gpr[m.r.rd]) = u_rs1 % u_rs2;
+		*reinterpret_cast<uint64_t*>(&s->gpr[m.r.rd]) = u_rs2 == 0 ? u_rs1 : u_rs1 % u_rs2;
 		break;
 	      }
 	      case 0x5: /* maxu */
@@ -2153,7 +3284,7 @@ void execRiscv_(state_t *s) {
 	    assert(0);
 	  }
       }
-      s->pc += 4;
+      s->pc += isz;
       break;
     }
 #if 0
@@ -2178,7 +3309,7 @@ void execRiscv_(state_t *s) {
       uint64_t u_rs2 = *reinterpret_cast<uint64_t*>(&s->gpr[m.b.rs2]);
       uint64_t bpu_idx = 0;
       bool bpu_pred = false;
-      if(globals::bpred) {
+      if(useBranch and globals::bpred) {
 	bpu_pred = globals::bpred->predict(s->pc, bpu_idx);
       }
       switch(m.b.sel)
@@ -2211,19 +3342,19 @@ void execRiscv_(state_t *s) {
 	  assert(0);
 	}
       //assert(not(takeBranch));
-      if(globals::branch_tracer) {
+      if(useBranch and globals::branch_tracer) {
 	globals::branch_tracer->add(s->pc, (disp+s->pc), takeBranch);
       }
-      if(globals::bpred) {
+      if(useBranch and globals::bpred) {
 	globals::bpred->update(s->pc, bpu_idx, bpu_pred, takeBranch,
 			       branch_predictor::br_type::cond);
       }
       if(useBBV) {
 	int ff;
-	s->bblog->addSample(s->translate(s->pc, ff, 4, false, true), s->bbsz);
+	s->bblog->addSample(s->translate<policy>(s->pc, ff, 4, false, true), s->bbsz);
 	s->bbsz = 0;	
       }
-      s->pc = takeBranch ? disp + s->pc : s->pc + 4;
+      s->pc = takeBranch ? disp + s->pc : s->pc + isz;
       break;
     }
 
@@ -2242,14 +3373,54 @@ void execRiscv_(state_t *s) {
 	  goto handle_exception;
 	}
       }
-      else if(upper7 == 9 && ((inst & (16384-1)) == 0x73 )) {
-	//std::cout << "warn : got sfence\n";
-	//printf("tlb had %lu entries\n", tlb.size());	
-	clear_tlb();
+      else if(((upper7 == 9) or (upper7 == 0xb)) && ((inst & (16384-1)) == 0x73 )) {
+	/* sfence.vma and svinval's sinval.vma */
+	if(s->priv == priv_user) {
+	  except_cause = CAUSE_ILLEGAL_INSTRUCTION;
+	  tval = s->pc;
+	  goto handle_exception;
+	}
+	uint32_t rs1 = (inst >> 15) & 31, rs2 = (inst >> 20) & 31;
+	/* the pd_cache is physically indexed and kept coherent by
+	 * stores, only the cached fetch translation goes stale */
+	sfence_tlb(rs1 == 0, s->gpr[rs1], rs2 == 0, s->gpr[rs2]);
+	s->last_phys_pc = 0;
+      }
+      else if((upper7 == 0xc) && (((inst >> 20) & 31) <= 1) && ((inst & 0xfffff) == 0x73)) {
+	/* sfence.w.inval and sfence.inval.ir, the tlb is flushed
+	 * synchronously by sinval.vma so there is nothing to order */
+	if(s->priv == priv_user) {
+	  except_cause = CAUSE_ILLEGAL_INSTRUCTION;
+	  tval = s->pc;
+	  goto handle_exception;
+	}
       }
       else if(bits19to7z and (csr_id == 0x105)) {  /* wfi */
-	//globals::log = 1;
-	s->pc += 4;
+	/* only the timers can wake the hart (the uart raises no
+	 * interrupts), move time up so the wfi retires at the next
+	 * compare value instead of spinning through the idle loop. the
+	 * interrupt, if enabled, is taken before the next instruction */
+	uint64_t t = s->next_timer(), now = static_cast<uint64_t>(s->get_time());
+	if(((s->mip & s->mie) == 0) and (t != ~0UL) and ((now + 1) < t)) {
+	  s->idle_time += t - now - 1;
+	  ++globals::wfi_skips;
+	  s->update_next_event();
+	}
+	s->pc += isz;
+	break;
+      }
+      else if(bits19to7z and ((csr_id == 0x00d) or (csr_id == 0x01d))) {  /* wrs.nto and wrs.sto */
+	/* zawrs. no other hart or device can write the reservation set,
+	 * so with one held only the timer ends the wait (the timeout of
+	 * wrs.sto is taken to be the same). without one wrs is a nop */
+	uint64_t t = s->next_timer(), now = static_cast<uint64_t>(s->get_time());
+	if(s->llsc_addr and ((s->mip & s->mie) == 0) and (t != ~0UL) and
+	   ((now + 1) < t)) {
+	  s->idle_time += t - now - 1;
+	  ++globals::wfi_skips;
+	  s->update_next_event();
+	}
+	s->pc += isz;
 	break;
       }
       else if(bits19to7z and (csr_id == 0x002)) {  /* uret */
@@ -2444,7 +3615,7 @@ void execRiscv_(state_t *s) {
 	    goto report_unimplemented;	    
 	  }
       }
-      s->pc += 4;
+      s->pc += isz;
       break;
     }
       
@@ -2469,146 +3640,706 @@ void execRiscv_(state_t *s) {
   s->icnt++;
   return;
   
- handle_exception: {
-    bool delegate = false;
-    s->last_phys_pc = 0;
-    if(s->priv == priv_user || s->priv == priv_supervisor) {
-      if(except_cause & CAUSE_INTERRUPT) {
-	uint32_t cc = (except_cause & 0x7fffffffUL);
-	delegate = ((s->mideleg) >> cc) & 1;
+ handle_exception:
+  take_trap(s, except_cause, tval);
+  return;
+  
+ report_unimplemented:
+  std::cout << std::hex << s->pc << std::dec
+	    << " : " << getAsmString(inst, s->pc)
+	    << " , raw " << std::hex
+	    << inst
+	    << std::dec
+	    << " , icnt " << s->icnt
+	    << "\n";  
+  assert(false);
+  
+  
+}
+
+/* instrumentation the current configuration needs */
+static uint32_t exec_policy(const state_t *s) {
+  uint32_t policy = 0;
+  if(s->icache)
+    policy |= ep_icache;
+  if(s->dcache or s->dtlb)
+    policy |= ep_dcache;
+  if(s->bblog and s->mlog)
+    policy |= ep_simpoint;
+  if(globals::bpred or globals::branch_tracer)
+    policy |= ep_branch;
+  if(globals::tracer or globals::log)
+    policy |= ep_trace;
+  return policy;
+}
+
+static bool can_run_blocks(const state_t *s) {
+  return globals::blocks and s->pdc and (exec_policy(s) == 0);
+}
+
+/* block executor: runs straight-line sequences of predecoded
+ * instructions within one physical page with threaded dispatch.
+ * interrupts, the timer and the run limits are only checked when a
+ * block is entered. inside a block only the timer (the budget stops
+ * at next_event) and stores to the clint (which end the block) can make
+ * an interrupt pending, so the instruction stream is the same as
+ * stepping with execRiscv_. taken branches that stay on the page are
+ * chained without leaving the dispatch loop. blocks that get hot are
+ * handed to the jit when one is configured, in bare mode blocks found in
+ * an aot image run from there first. there is one instantiation
+ * for bare (vm_bare) and one for translated (vm_paged) execution.
+ * the paging mode only changes in the slow paths (traps, csr writes,
+ * xret), each of them hands back to runRiscvBlocks when it did */
+template <int vm>
+static void runRiscvBlocks_(state_t *s, uint64_t stop_icnt) {
+  /* indexed by op and by whether the instruction is compressed. the
+   * rvc_ entries set the length and fall into the same handler, so
+   * the step to the next instruction never waits on a load of len */
+  static const void *const handlers[][2] = {
+    {&&op_pd_undecoded, &&op_pd_undecoded}, {&&op_pd_slow, &&op_pd_slow},
+    {&&op_pd_nop, &&rvc_pd_nop}, {&&op_pd_lui, &&rvc_pd_lui},
+    {&&op_pd_auipc, &&rvc_pd_auipc}, {&&op_pd_jal, &&rvc_pd_jal},
+    {&&op_pd_jalr, &&rvc_pd_jalr},
+    {&&op_branch, &&rvc_branch}, {&&op_branch, &&rvc_branch},
+    {&&op_branch, &&rvc_branch}, {&&op_branch, &&rvc_branch},
+    {&&op_branch, &&rvc_branch}, {&&op_branch, &&rvc_branch},
+    {&&op_load, &&rvc_load}, {&&op_load, &&rvc_load},
+    {&&op_load, &&rvc_load}, {&&op_load, &&rvc_load},
+    {&&op_load, &&rvc_load}, {&&op_load, &&rvc_load},
+    {&&op_load, &&rvc_load},
+    {&&op_store, &&rvc_store}, {&&op_store, &&rvc_store},
+    {&&op_store, &&rvc_store}, {&&op_store, &&rvc_store},
+#define PD_ALU_LABEL(NAME, EXPR) {&&op_##NAME, &&rvc_##NAME},
+    PD_ALU_OPS(PD_ALU_LABEL)
+#undef PD_ALU_LABEL
+    {&&op_pd_page_end, &&op_pd_page_end},
+    {&&op_pd_lui_addi, &&rvc_pd_lui_addi}, {&&op_pd_lui_addiw, &&rvc_pd_lui_addiw},
+    {&&op_pd_auipc_addi, &&rvc_pd_auipc_addi}, {&&op_pd_auipc_jalr, &&rvc_pd_auipc_jalr},
+    {&&op_pd_auipc_ld, &&rvc_pd_auipc_ld}, {&&op_pd_slli_srli, &&rvc_pd_slli_srli},
+    {&&op_loop, &&rvc_loop}, {&&op_loop, &&rvc_loop},
+    {&&op_spin, &&rvc_spin}, {&&op_spin, &&rvc_spin},
+    {&&op_spin, &&rvc_spin}, {&&op_spin, &&rvc_spin},
+    {&&op_spin, &&rvc_spin}, {&&op_spin, &&rvc_spin}
+  };
+  static_assert(sizeof(handlers)/sizeof(handlers[0]) == pd_num_ops,
+		"handler table out of sync with pd_op");
+  static const uint64_t lg_pg_sz = 12;
+  static const uint64_t pg_mask = (1UL<<lg_pg_sz)-1;
+  uint8_t *mem = s->mem;
+  int64_t *gpr = s->gpr;
+  pd_cache *pdc = s->pdc;
+  jit_cache *jit = s->jit;
+  aot_image *aot = (vm == vm_bare) ? s->aot : nullptr;
+
+  while((s->brk == 0) and (s->icnt < stop_icnt)) {
+    uint64_t stop = std::min(stop_icnt, s->next_event), phys_pc = 0;
+    int fetch_fault = 0;
+    if(s->icnt >= s->next_event) {
+      execRiscv_<0>(s);
+      if(s->unpaged_mode() != (vm == vm_bare)) {
+	return;
       }
-      else {
-	delegate = (s->medeleg >> except_cause) & 1;
+      continue;
+    }
+    if(s->priv == priv_user) {
+      entered_user = true;
+    }
+    if((s->last_pc>>lg_pg_sz) == (s->pc>>lg_pg_sz) && s->last_phys_pc) {
+      phys_pc = (s->pc & pg_mask) | (s->last_phys_pc & (~pg_mask));
+    }
+    else {
+      phys_pc = s->translate<0, vm>(s->pc, fetch_fault, 4, false, true);
+    }
+    if(fetch_fault) {
+      execRiscv_<0>(s);
+      if(s->unpaged_mode() != (vm == vm_bare)) {
+	return;
+      }
+      continue;
+    }
+    s->last_pc = s->pc;
+    s->last_phys_pc = phys_pc;
+    
+    pd_insn *pd = pdc->lookup(phys_pc, mem);
+    if(pd->op == pd_slow) {
+      execRiscv_<0>(s);
+      if(s->unpaged_mode() != (vm == vm_bare)) {
+	return;
+      }
+      continue;
+    }
+    if(aot) {
+      const aot_image::block *b = aot->find(s, phys_pc);
+      if(b and ((s->icnt + b->len) <= stop)) {
+	b->fn(s, gpr, stop);
+	if(s->unpaged_mode() != (vm == vm_bare)) {
+	  return;
+	}
+	continue;
+      }
+    }
+    if(jit) {
+      jit_cache::block *b = jit->find(s, phys_pc);
+      if(b and ((s->icnt + b->len) <= stop)) {
+	b->fn(s, gpr, stop);
+	/* a load or store in the block may have trapped */
+	if(s->unpaged_mode() != (vm == vm_bare)) {
+	  return;
+	}
+	continue;
       }
     }
+    
+    uint64_t pc = s->pc, icnt = s->icnt;
+    const uint64_t pg = phys_pc & (~pg_mask);
+    const uint64_t next_event = s->next_event;
+    const uint64_t invalidations = pdc->get_invalidations();
+    int64_t ea = 0, pa = 0, tgt = 0, len = 4;
+    int fault = 0;
+    pd_insn *n = nullptr;
 
-    uint64_t cause = (except_cause & 0x7fffffffUL);
-    if(except_cause & CAUSE_INTERRUPT) {
-      cause |= 1UL<<63;
+#define DISPATCH() goto *handlers[pd->op][pd->len == 2]
+#define NEXT() {				\
+      pc += len;				\
+      pd += len >> 1;				\
+      len = 4;					\
+      if(++icnt == stop)			\
+	goto block_exit;			\
+      DISPATCH();				\
     }
+    /* retire a control transfer to tgt, stay in the dispatch loop if
+     * tgt is on the same page. with a jit or aot image every block head
+     * goes back through the block loop so it can find translations */
+#define CHAIN() {							\
+      ++icnt;								\
+      if((icnt == stop) or (((pc ^ tgt) >> lg_pg_sz) != 0) or jit or aot) { \
+	pc = tgt;							\
+	goto block_exit;						\
+      }									\
+      pd += (tgt - static_cast<int64_t>(pc)) >> 1;			\
+      pc = tgt;								\
+      len = 4;								\
+      DISPATCH();							\
+    }
+    /* retire the fused pair at pd, n is its second instruction */
+#define PAIR_NEXT() {				\
+      pc += len + n->len;			\
+      pd = n + (n->len >> 1);			\
+      len = 4;					\
+      icnt += 2;				\
+      if(icnt == stop)				\
+	goto block_exit;			\
+      DISPATCH();				\
+    }
+#define PD_ALU_RVC(NAME, EXPR)			\
+    rvc_##NAME:					\
+      len = 2;					\
+      goto op_##NAME;
     
-    if( /*(cause != 9 and cause < 16)*/ not(globals::silent) and false) {
-      std::cout << "--> took fault at pc "
-		<< std::hex << s->pc
-		<< ", tval " << tval
-		<< std::dec
-		<< ", icnt " << s->icnt
-		<< ", cause " << std::hex
-		<< cause << std::dec << " : ";
-      if(cause < 16) {
-	std::cout << cause_reasons.at(cause);
-	dump_calls();	
+    DISPATCH();
+
+  rvc_pd_nop:
+    len = 2;
+    goto op_pd_nop;
+  rvc_pd_lui:
+    len = 2;
+    goto op_pd_lui;
+  rvc_pd_auipc:
+    len = 2;
+    goto op_pd_auipc;
+  rvc_pd_jal:
+    len = 2;
+    goto op_pd_jal;
+  rvc_pd_jalr:
+    len = 2;
+    goto op_pd_jalr;
+  rvc_branch:
+    len = 2;
+    goto op_branch;
+  rvc_loop:
+    len = 2;
+    goto op_loop;
+  rvc_spin:
+    len = 2;
+    goto op_spin;
+  rvc_load:
+    len = 2;
+    goto op_load;
+  rvc_store:
+    len = 2;
+    goto op_store;
+  rvc_pd_lui_addi:
+    len = 2;
+    goto op_pd_lui_addi;
+  rvc_pd_lui_addiw:
+    len = 2;
+    goto op_pd_lui_addiw;
+  rvc_pd_auipc_addi:
+    len = 2;
+    goto op_pd_auipc_addi;
+  rvc_pd_auipc_jalr:
+    len = 2;
+    goto op_pd_auipc_jalr;
+  rvc_pd_auipc_ld:
+    len = 2;
+    goto op_pd_auipc_ld;
+  rvc_pd_slli_srli:
+    len = 2;
+    goto op_pd_slli_srli;
+    PD_ALU_OPS(PD_ALU_RVC)
+
+  op_pd_undecoded:
+    pd = pdc->lookup(pg | (pc & pg_mask), mem);
+    DISPATCH();
+  op_pd_slow:
+  op_pd_page_end:
+    goto block_exit;
+  op_pd_nop:
+    NEXT();
+  op_pd_lui:
+    gpr[pd->rd] = pd->imm;
+    NEXT();
+  op_pd_auipc:
+    gpr[pd->rd] = pc + pd->imm;
+    NEXT();
+    /* fused pairs. with a single instruction left before stop only
+     * the first one runs. auipc+jalr and auipc+ld retire the auipc and
+     * continue in the 32b handler of the second, which takes its
+     * exceptions as usual */
+  op_pd_lui_addi:
+    if((stop - icnt) < 2) {
+      goto op_pd_lui;
+    }
+    pdc->count_fused(pd_lui_addi);
+    n = pd + (len >> 1);
+    gpr[pd->rd] = static_cast<int64_t>(pd->imm) + n->imm;
+    PAIR_NEXT();
+  op_pd_lui_addiw:
+    if((stop - icnt) < 2) {
+      goto op_pd_lui;
+    }
+    pdc->count_fused(pd_lui_addiw);
+    n = pd + (len >> 1);
+    gpr[pd->rd] = static_cast<int32_t>(static_cast<uint32_t>(pd->imm) +
+				       static_cast<uint32_t>(n->imm));
+    PAIR_NEXT();
+  op_pd_auipc_addi:
+    if((stop - icnt) < 2) {
+      goto op_pd_auipc;
+    }
+    pdc->count_fused(pd_auipc_addi);
+    n = pd + (len >> 1);
+    gpr[pd->rd] = pc + pd->imm + n->imm;
+    PAIR_NEXT();
+  op_pd_slli_srli:
+    if((stop - icnt) < 2) {
+      goto op_pd_slli;
+    }
+    pdc->count_fused(pd_slli_srli);
+    n = pd + (len >> 1);
+    gpr[pd->rd] = (static_cast<uint64_t>(gpr[pd->rs1]) << pd->imm) >> n->imm;
+    PAIR_NEXT();
+  op_pd_auipc_jalr:
+    if((stop - icnt) < 2) {
+      goto op_pd_auipc;
+    }
+    pdc->count_fused(pd_auipc_jalr);
+    gpr[pd->rd] = pc + pd->imm;
+    pc += len;
+    pd += len >> 1;
+    len = 4;
+    ++icnt;
+    goto op_pd_jalr;
+  op_pd_auipc_ld:
+    if((stop - icnt) < 2) {
+      goto op_pd_auipc;
+    }
+    pdc->count_fused(pd_auipc_ld);
+    gpr[pd->rd] = pc + pd->imm;
+    pc += len;
+    pd += len >> 1;
+    len = 4;
+    ++icnt;
+    goto op_load;
+  op_pd_jal:
+    if(pd->rd != 0) {
+      gpr[pd->rd] = pc + len;
+    }
+    s->last_call = pc;
+    if(pd->rd==1 or pd->rd==5) {
+      calls.push(pc);
+    }
+    tgt = pc + pd->imm;
+    CHAIN();
+  op_pd_jalr:
+    tgt = (gpr[pd->rs1] + pd->imm) & ~(1L);
+    if(pd->rd != 0) {
+      gpr[pd->rd] = pc + len;
+    }
+    s->last_call = pc;
+    if((pd->rd == 0) and (pd->rs1==1 or pd->rs1==5)) {
+      if(!calls.empty())
+	calls.pop();
+    }
+    if(pd->rd==1 or pd->rd==5) {
+      calls.push(pc);
+    }
+    CHAIN();
+    /* a spin branch first skips iterations up to stop */
+  op_spin:
+    if(uint64_t k = run_spin<vm>(s, pd, icnt, stop - icnt - 1)) {
+      pdc->count_spin(k);
+      icnt += k;
+    }
+    goto op_branch;
+    /* a taken loop branch first runs whole iterations in bulk */
+  op_loop:
+    if(uint64_t k = run_loop<vm>(s, pd, stop - icnt - 1)) {
+      pdc->count_loop(k);
+      icnt += k;
+    }
+  op_branch: {
+      uint64_t u_rs1 = gpr[pd->rs1], u_rs2 = gpr[pd->rs2];
+      int64_t s_rs1 = gpr[pd->rs1], s_rs2 = gpr[pd->rs2];
+      bool takeBranch = false;
+      switch(pd_unfused(pd->op))
+	{
+	case pd_beq:
+	  takeBranch = u_rs1 == u_rs2;
+	  break;
+	case pd_bne:
+	  takeBranch = u_rs1 != u_rs2;
+	  break;
+	case pd_blt:
+	  takeBranch = s_rs1 < s_rs2;
+	  break;
+	case pd_bge:
+	  takeBranch = s_rs1 >= s_rs2;
+	  break;
+	case pd_bltu:
+	  takeBranch = u_rs1 < u_rs2;
+	  break;
+	default:
+	  takeBranch = u_rs1 >= u_rs2;
+	  break;
+	}
+      tgt = pc + (takeBranch ? pd->imm : len);
+      CHAIN();
+    }
+  op_load:
+    ea = gpr[pd->rs1] + pd->imm;
+    if(uint8_t *h = (vm == vm_bare) ? bare_host(s, ea, 1<<((pd->inst>>12) & 3), false) :
+       tlb_host<vm>(s, ea, 1<<((pd->inst>>12) & 3), false)) {
+      s->va_track_pa += (((ea ^ (h - mem)) >> 12) & 3) == 0;
+      s->loads++;
+      gpr[pd->rd] = host_load(h, pd->op);
+      gpr[0] = 0;
+      NEXT();
+    }
+    s->pc = pc;
+    s->icnt = icnt;
+    pa = s->translate<0, vm>(ea, fault, 1<<((pd->inst>>12) & 3));
+    if(fault) {
+      take_trap(s, CAUSE_LOAD_PAGE_FAULT, ea);
+      if(s->unpaged_mode() != (vm == vm_bare)) {
+	return;
       }
-      else {
-	std::cout << "irq " << (cause & 31);
+      continue;
+    }
+    s->va_track_pa += (((ea >> 12) & 3) == ((pa >> 12) & 3));
+    s->loads++;
+    switch(pd->op)
+      {
+      case pd_lb:
+	gpr[pd->rd] = s->load8(pa);
+	break;
+      case pd_lh:
+	gpr[pd->rd] = s->load16(pa);
+	break;
+      case pd_lw:
+	gpr[pd->rd] = s->load32(pa);
+	break;
+      case pd_ld:
+	gpr[pd->rd] = s->load64(pa);
+	break;
+      case pd_lbu:
+	gpr[pd->rd] = s->load8u(pa);
+	break;
+      case pd_lhu:
+	gpr[pd->rd] = s->load16u(pa);
+	break;
+      default:
+	gpr[pd->rd] = s->load32u(pa);
+	break;
+      }
+    gpr[0] = 0;
+    NEXT();
+  op_store:
+    ea = gpr[pd->rs1] + pd->imm;
+    if(uint8_t *h = (vm == vm_bare) ? bare_host(s, ea, 1<<((pd->inst>>12) & 3), true) :
+       tlb_host<vm>(s, ea, 1<<((pd->inst>>12) & 3), true)) {
+      host_store(h, pd->op, gpr[pd->rs2]);
+      NEXT();
+    }
+    s->pc = pc;
+    s->icnt = icnt;
+    pa = s->translate<0, vm>(ea, fault, 1<<((pd->inst>>12) & 3), true);
+    if(fault) {
+      take_trap(s, CAUSE_STORE_PAGE_FAULT, ea);
+      if(s->unpaged_mode() != (vm == vm_bare)) {
+	return;
+      }
+      continue;
+    }
+    switch(pd->op)
+      {
+      case pd_sb:
+	s->store8(pa, gpr[pd->rs2]);
+	break;
+      case pd_sh:
+	s->store16(pa, gpr[pd->rs2]);
+	break;
+      case pd_sw:
+	s->store32(pa, gpr[pd->rs2]);
+	break;
+      default:
+	s->store64(pa, gpr[pd->rs2]);
+	break;
       }
-      std::cout << ", delegate " << delegate
-		<< ", priv "
-		<< s->priv << "\n";
+    /* the store hit code, rescheduled the timer or went to the host,
+     * leave the block */
+    if((s->next_event != next_event) or s->brk or
+       (pdc->get_invalidations() != invalidations)) {
+      pc += len;
+      ++icnt;
+      goto block_exit;
+    }
+    NEXT();
+    /* each op reads only some of the operands */
+#define PD_ALU_HANDLER(NAME, EXPR) op_##NAME: {				\
+      __attribute__((unused)) uint64_t u_rs1 = gpr[pd->rs1];		\
+      __attribute__((unused)) uint64_t u_rs2 = gpr[pd->rs2];		\
+      __attribute__((unused)) int64_t s_rs1 = gpr[pd->rs1];		\
+      __attribute__((unused)) int64_t s_rs2 = gpr[pd->rs2];		\
+      gpr[pd->rd] = (EXPR);						\
+      NEXT();								\
     }
+    PD_ALU_OPS(PD_ALU_HANDLER)
+#undef PD_ALU_HANDLER
+#undef PD_ALU_RVC
+#undef PAIR_NEXT
+#undef CHAIN
+#undef NEXT
+#undef DISPATCH
     
-    if(delegate) {
-      s->scause = cause;
-      s->sepc = s->pc;
-      s->stval = tval;
-      s->mstatus = (s->mstatus & ~MSTATUS_SPIE) |
-	(((s->mstatus >> s->priv) & 1) << MSTATUS_SPIE_SHIFT);
-      s->mstatus = (s->mstatus & ~MSTATUS_SPP) |
-	(s->priv << MSTATUS_SPP_SHIFT);
-      s->mstatus &= ~MSTATUS_SIE;
-      set_priv(s, priv_supervisor);
-      s->pc = s->stvec;
+  block_exit:
+    s->pc = pc;
+    s->icnt = icnt;
+  }
+}
+
+static void runRiscvBlocks(state_t *s, uint64_t stop_icnt) {
+  while((s->brk == 0) and (s->icnt < stop_icnt)) {
+    if(s->unpaged_mode()) {
+      runRiscvBlocks_<vm_bare>(s, stop_icnt);
     }
     else {
-      s->mcause = cause;
-      s->mepc = s->pc;
-      s->mtval = tval;
-      s->mstatus = (s->mstatus & ~MSTATUS_MPIE) |
-	(((s->mstatus >> s->priv) & 1) << MSTATUS_MPIE_SHIFT);
-      s->mstatus = (s->mstatus & ~MSTATUS_MPP) |
-	(s->priv << MSTATUS_MPP_SHIFT);
-      s->mstatus &= ~MSTATUS_MIE;
-      set_priv(s, priv_machine);
-      s->pc = s->mtvec;
+      runRiscvBlocks_<vm_paged>(s, stop_icnt);
     }
   }
-  return;
-  
- report_unimplemented:
-  std::cout << std::hex << s->pc << std::dec
-	    << " : " << getAsmString(inst, s->pc)
-	    << " , raw " << std::hex
-	    << inst
-	    << std::dec
-	    << " , icnt " << s->icnt
-	    << "\n";  
-  assert(false);
-  
-  
 }
 
-void runRiscvSimPoint(state_t *s) {
-  bool keep_going = (s->brk==0) and
-    (s->icnt < s->maxicnt);
-  
-  if(not(keep_going))
-    return;
+static int pd_mem_size(uint64_t op) {
+  switch(op)
+    {
+    case pd_lb:
+    case pd_lbu:
+    case pd_sb:
+      return 1;
+    case pd_lh:
+    case pd_lhu:
+    case pd_sh:
+      return 2;
+    case pd_lw:
+    case pd_lwu:
+    case pd_sw:
+      return 4;
+    default:
+      return 8;
+    }
+}
+
+jit_ret jit_load(state_t *s, int64_t ea, uint64_t op, uint64_t pc, uint64_t k) {
+  jit_ret r = {0, 0};
+  int fault = 0;
+  if(uint8_t *h = s->unpaged_mode() ? bare_host(s, ea, pd_mem_size(op), false) :
+     tlb_host<vm_paged>(s, ea, pd_mem_size(op), false)) {
+    s->va_track_pa += (((ea ^ (h - s->mem)) >> 12) & 3) == 0;
+    s->loads++;
+    r.value = host_load(h, op);
+    return r;
+  }
+  int64_t pa = s->translate<0>(ea, fault, pd_mem_size(op));
+  if(fault) {
+    s->pc = pc;
+    s->icnt += k;
+    take_trap(s, CAUSE_LOAD_PAGE_FAULT, ea);
+    r.fault = 1;
+    return r;
+  }
+  s->va_track_pa += (((ea >> 12) & 3) == ((pa >> 12) & 3));
+  s->loads++;
+  switch(op)
+    {
+    case pd_lb:
+      r.value = s->load8(pa);
+      break;
+    case pd_lh:
+      r.value = s->load16(pa);
+      break;
+    case pd_lw:
+      r.value = s->load32(pa);
+      break;
+    case pd_ld:
+      r.value = s->load64(pa);
+      break;
+    case pd_lbu:
+      r.value = s->load8u(pa);
+      break;
+    case pd_lhu:
+      r.value = s->load16u(pa);
+      break;
+    default:
+      r.value = s->load32u(pa);
+      break;
+    }
+  return r;
+}
+
+uint64_t jit_store(state_t *s, int64_t ea, int64_t x, uint64_t op, uint64_t pc, uint64_t k) {
+  const uint64_t len = (op & jit_rvc) ? 2 : 4;
+  int fault = 0;
+  op &= ~jit_rvc;
+  if(uint8_t *h = s->unpaged_mode() ? bare_host(s, ea, pd_mem_size(op), true) :
+     tlb_host<vm_paged>(s, ea, pd_mem_size(op), true)) {
+    host_store(h, op, x);
+    return 0;
+  }
+  int64_t pa = s->translate<0>(ea, fault, pd_mem_size(op), true);
+  if(fault) {
+    s->pc = pc;
+    s->icnt += k;
+    take_trap(s, CAUSE_STORE_PAGE_FAULT, ea);
+    return 1;
+  }
+  const uint64_t next_event = s->next_event;
+  const uint64_t invalidations = s->pdc->get_invalidations();
+  switch(op)
+    {
+    case pd_sb:
+      s->store8(pa, x);
+      break;
+    case pd_sh:
+      s->store16(pa, x);
+      break;
+    case pd_sw:
+      s->store32(pa, x);
+      break;
+    default:
+      s->store64(pa, x);
+      break;
+    }
+  if((s->next_event != next_event) or s->brk or
+     (s->pdc->get_invalidations() != invalidations)) {
+    s->pc = pc + len;
+    s->icnt += k + 1;
+    return 1;
+  }
+  return 0;
+}
+
+int64_t jit_alu(uint64_t op, uint64_t u_rs1, uint64_t u_rs2, int64_t imm) {
+  int64_t s_rs1 = u_rs1, s_rs2 = u_rs2;
+  pd_insn d;
+  d.imm = imm;
+  const pd_insn *pd = &d;
+  switch(op)
+    {
+#define PD_ALU_RETURN(NAME, EXPR)		\
+      case NAME:				\
+	return (EXPR);
+      PD_ALU_OPS(PD_ALU_RETURN)
+#undef PD_ALU_RETURN
+    default:
+      assert(false);
+    }
+  return 0;
+}
+
+void jit_link(state_t *s, uint64_t pc, uint64_t rd, uint64_t rs1) {
+  if((rd == 0) and (rs1==1 or rs1==5)) {
+    if(!calls.empty())
+      calls.pop();
+  }
+  if(rd==1 or rd==5) {
+    calls.push(pc);
+  }
+}
 
-  do {
-    execRiscv_<false,false,true,true>(s);
-    keep_going = (s->brk==0) and
-      (s->icnt < s->maxicnt);
-  } while(keep_going);  
+/* execute until icnt reaches stop_icnt or brk is set */
+template <uint32_t policy>
+static void runRiscv_(state_t *s, uint64_t stop_icnt) {
+  while((s->brk == 0) and (s->icnt < stop_icnt)) {
+    execRiscv_<policy>(s);
+  }
 }
 
+/* one runRiscv_ per instrumentation policy, indexed by exec_policy() */
+typedef void (*run_fn)(state_t *, uint64_t);
+static run_fn run_table[ep_all+1];
+
+template <uint32_t policy>
+struct policy_table {
+  static void fill(run_fn *t) {
+    t[policy] = runRiscv_<policy>;
+    policy_table<policy-1>::fill(t);
+  }
+};
+
+template <>
+struct policy_table<0> {
+  static void fill(run_fn *t) {
+    t[0] = runRiscv_<0>;
+  }
+};
+
+static struct run_table_init {
+  run_table_init() {
+    policy_table<ep_all>::fill(run_table);
+  }
+} run_table_init_;
+
+void runRiscvSimPoint(state_t *s) {
+  runRiscv(s, s->maxicnt);
+}
 
-void runRiscv(state_t *s, uint64_t dumpIcnt) {
-  bool keep_going = (s->brk==0) and
-    (s->icnt < s->maxicnt) and
-    (s->icnt < dumpIcnt);
-  if(not(keep_going))
+void runRiscv(state_t *s, uint64_t stop_icnt) {
+  stop_icnt = std::min(stop_icnt, s->maxicnt);
+  if((s->brk != 0) or (s->icnt >= stop_icnt))
     return;
 
-  if(s->icache and s->dcache) {
-    do {
-      execRiscv_<true,true,false>(s);
-      bool dump = (s->icnt >= dumpIcnt) /*and (s->priv == 0)*/;
-      keep_going = (s->brk==0) and
-	(s->icnt < s->maxicnt) and
-	not(dump);
-    } while(keep_going);        
-  }
-  else if(s->icache and s->dcache == nullptr) {
-    do {
-      execRiscv_<true,false,false>(s);
-      bool dump = (s->icnt >= dumpIcnt) /*and (s->priv == 0)*/;
-      keep_going = (s->brk==0) and
-	(s->icnt < s->maxicnt) and
-	not(dump);
-    } while(keep_going);        
-  }
-  else if(s->icache==nullptr and s->dcache) {
-    do {
-      execRiscv_<false,true,false>(s);
-      bool dump = (s->icnt >= dumpIcnt) /*and (s->priv == 0)*/;
-      keep_going = (s->brk==0) and
-	(s->icnt < s->maxicnt) and
-	not(dump);
-    } while(keep_going);    
+  fp_guard fp(s);
+  if(can_run_blocks(s)) {
+    runRiscvBlocks(s, stop_icnt);
   }
   else {
-    do {
-      execRiscv_<false,false,false>(s);
-      bool dump = (s->icnt >= dumpIcnt) /*and (s->priv == 0)*/;
-      keep_going = (s->brk==0) and
-	(s->icnt < s->maxicnt) and
-	not(dump);
-    } while(keep_going);
+    run_table[exec_policy(s)](s, stop_icnt);
   }
 }
 
 void execRiscv(state_t *s) {
-  execRiscv_<false,false,false>(s);
+  fp_guard fp(s);
+  run_table[exec_policy(s)](s, s->icnt + 1);
 }
 
 void runInteractiveRiscv(state_t *s) {
@@ -2624,14 +4355,11 @@ void runInteractiveRiscv(state_t *s) {
     }
 
     std::cout << "running for " << steps <<  " steps\n";
-    
-    while(steps) {
-      execRiscv_<false,false,false>(s);
-      run = s->brk==0 and (s->icnt < s->maxicnt);
-      if(not(run))
-	break;
-      --steps;
+    {
+      fp_guard fp(s);
+      run_table[exec_policy(s)](s, steps > 0 ? std::min(s->maxicnt, s->icnt + steps) : s->maxicnt);
     }
+    run = s->brk==0 and (s->icnt < s->maxicnt);
     uint64_t phys_pc = s->translate(s->pc, fault, 8, false, false);
     uint32_t insn = s->load32(phys_pc);
     std::cout << "priv " << s->priv << " vpc "
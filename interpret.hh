@@ -43,6 +43,25 @@
 
 #define MARGS 20
 
+/* instrumentation compiled into an execRiscv_ instantiation, a
+ * run with none of these set has no instrumentation checks */
+enum exec_policy : uint32_t {
+  ep_icache = 1U<<0,   /* icache model */
+  ep_dcache = 1U<<1,   /* dcache and dtlb models */
+  ep_simpoint = 1U<<2, /* basic block and memory access vectors */
+  ep_branch = 1U<<3,   /* branch predictor and branch tracer */
+  ep_trace = 1U<<4,    /* memory tracer and instruction log */
+  ep_all = (1U<<5)-1
+};
+
+/* paging mode a translate instantiation is specialized for, vm_any
+ * looks at priv and satp on every call */
+enum vm_mode {
+  vm_any = 0,
+  vm_bare,
+  vm_paged
+};
+
 enum riscv_priv {
   priv_user = 0,
   priv_supervisor,
@@ -93,6 +112,10 @@ struct satp_t {
 
 struct virtio;
 struct uart;
+class pd_cache;
+class jit_cache;
+class aot_image;
+class mmio_map;
 
 struct state_t{
   uint64_t pc;
@@ -100,6 +123,7 @@ struct state_t{
   uint64_t last_phys_pc;
   uint64_t last_call;
   int64_t gpr[32];
+  uint64_t fpr[32];
   uint8_t *mem;
   uint8_t brk;
   uint64_t epc;
@@ -112,6 +136,9 @@ struct state_t{
   cache *icache;
   cache *dcache;
   tlb *dtlb;  
+  pd_cache *pdc;
+  jit_cache *jit;
+  aot_image *aot;
   riscv_priv priv;
   
   /* lots of CSRs */
@@ -123,6 +150,7 @@ struct state_t{
   int64_t mhartid;
   int64_t mtvec;
   int64_t mcounteren;
+  int64_t menvcfg;
   int64_t mie;
   int64_t mip;
   int64_t mcause;
@@ -142,7 +170,27 @@ struct state_t{
   int64_t pmpaddr3;
   int64_t pmpcfg0;
   int64_t mtimecmp;
+  /* sstc, stip follows it while menvcfg.stce is set */
+  int64_t stimecmp;
+  /* time wfi skipped while the hart idled, time is icnt + idle_time */
+  uint64_t idle_time;
+  /* frm in 7:5, fflags in 4:0. fflags live in the host fpu while
+   * the guest runs, see fp_guard */
+  int64_t fcsr;
+  /* rvv, see vector.hh. the register file is allocated apart from
+   * state_t since it grows with vlen */
+  uint8_t *vrf;
+  uint64_t vlenb;
+  uint64_t vl;
+  int64_t vtype;
+  uint64_t vstart;
+  int64_t vxrm;
+  int64_t vxsat;
+  /* icnt at which the timer and pending interrupts need
+   * to be looked at again, see update_next_event() */
+  uint64_t next_event;
   virtio *vio;
+  mmio_map *mmio;
   av *bblog;
   av *mlog;
   uint64_t va_track_pa;
@@ -152,6 +200,10 @@ struct state_t{
     return 64;
   }
   int64_t get_time() const;
+  /* the earliest compare value whose interrupt mie enables, ~0 if none */
+  uint64_t next_timer() const;
+  void update_timer_pending();
+  void update_next_event();
   
   void sext_xlen(int64_t x, int i) {
     gpr[i] = (x << (64-xlen())) >> (64-xlen());
@@ -205,6 +257,9 @@ struct state_t{
   void store64(uint64_t pa, int64_t x);
 
   
+  uint64_t translate(uint64_t ea, int &fault, int sz,
+		     bool store = false, bool fetch = false);
+  template <uint32_t policy, int vm = vm_any>
   uint64_t translate(uint64_t ea, int &fault, int sz,
 		     bool store = false, bool fetch = false) __attribute__((always_inline));
 
@@ -306,25 +361,6 @@ union riscv_t {
   riscv_t(uint32_t x) : raw(x) {}
 };
 
-struct rvcj_t {
-  uint16_t lop : 2;
-  uint16_t imm5 : 1;
-  uint16_t imm31 : 3;
-  uint16_t imm7 : 1;
-  uint16_t imm6 : 1;
-  uint16_t imm10 : 1;
-  uint16_t imm98 : 2;
-  uint16_t imm4 : 1;
-  uint16_t imm11 : 1;
-  uint16_t hop : 3;
-};
-
-union rvc_t {
-  rvcj_t j;
-  uint16_t raw;  
-  rvc_t(uint16_t x) : raw(x) {}
-};
-
 
 
 struct mstatus_t {
@@ -493,7 +529,11 @@ union pte_t {
 };
 
 void initState(state_t *s);
-void runRiscv(state_t *s, uint64_t dumpIcnt);
+void initDevices(state_t *s);
+/* watches tohost, once its address is known */
+void initHtif(state_t *s);
+/* run until icnt reaches min(stop_icnt, maxicnt) or brk is set */
+void runRiscv(state_t *s, uint64_t stop_icnt);
 void execRiscv(state_t *s);
 void runRiscvSimPoint(state_t *s);
 void runInteractiveRiscv(state_t *s);
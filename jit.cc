@@ -0,0 +1,804 @@
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include "interpret.hh"
+#include "predecode.hh"
+#include "jit.hh"
+
+namespace {
+  enum host_reg {
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+  };
+  enum host_cc {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+    CC_A = 0x7, CC_L = 0xc, CC_GE = 0xd
+  };
+  /* group 1 opcodes (op r/m, r) and their /digit for imm forms */
+  enum host_alu {
+    ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29,
+    ALU_XOR = 0x31, ALU_CMP = 0x39, ALU_TEST = 0x85
+  };
+  enum host_ext {
+    EXT_ADD = 0, EXT_OR = 1, EXT_AND = 4, EXT_SUB = 5,
+    EXT_XOR = 6, EXT_CMP = 7, EXT_SHL = 4, EXT_SHR = 5, EXT_SAR = 7,
+    EXT_ROL = 0, EXT_ROR = 1
+  };
+  /* 0f-prefixed bit test ops, register form and /digit for imm8 */
+  enum host_bt {
+    BT_BTS = 0xab, BT_BTR = 0xb3, BT_BTC = 0xbb
+  };
+  enum host_bt_ext {
+    BT_EXT_BTS = 5, BT_EXT_BTR = 6, BT_EXT_BTC = 7
+  };
+  /* f3 0f ops */
+  enum host_count {
+    CNT_POPCNT = 0xb8, CNT_TZCNT = 0xbc, CNT_LZCNT = 0xbd
+  };
+
+  /* guest registers live in these callee-saved host registers inside
+   * a block. r14 holds the state_t pointer and r15 the gpr array */
+  const int mapped_regs[] = {RBX, RBP, R12, R13};
+  const int n_mapped = sizeof(mapped_regs)/sizeof(mapped_regs[0]);
+
+  class emitter {
+    std::vector<uint8_t> &buf;
+    void rex(bool w, int reg, int rm) {
+      uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+      if(r != 0x40) {
+	byte(r);
+      }
+    }
+    void modrm_rr(int reg, int rm) {
+      byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+    }
+    /* [base + disp32] */
+    void modrm_mem(int reg, int base, int32_t disp) {
+      byte(0x80 | ((reg & 7) << 3) | (base & 7));
+      if((base & 7) == RSP) {
+	byte(0x24);
+      }
+      imm32(disp);
+    }
+  public:
+    emitter(std::vector<uint8_t> &buf) : buf(buf) {}
+    size_t pos() const {
+      return buf.size();
+    }
+    void byte(uint8_t x) {
+      buf.push_back(x);
+    }
+    void imm32(int32_t x) {
+      for(int i = 0; i < 4; i++) {
+	byte((x >> (8*i)) & 255);
+      }
+    }
+    void imm64(uint64_t x) {
+      for(int i = 0; i < 8; i++) {
+	byte((x >> (8*i)) & 255);
+      }
+    }
+    void mov_rr(int dst, int src) {
+      rex(true, src, dst);
+      byte(0x89);
+      modrm_rr(src, dst);
+    }
+    void load(int dst, int base, int32_t disp) {
+      rex(true, dst, base);
+      byte(0x8b);
+      modrm_mem(dst, base, disp);
+    }
+    void store(int base, int32_t disp, int src) {
+      rex(true, src, base);
+      byte(0x89);
+      modrm_mem(src, base, disp);
+    }
+    void mov_ri(int dst, int64_t x) {
+      if(x == static_cast<int32_t>(x)) {
+	rex(true, 0, dst);
+	byte(0xc7);
+	modrm_rr(0, dst);
+	imm32(x);
+      }
+      else {
+	rex(true, 0, dst);
+	byte(0xb8 + (dst & 7));
+	imm64(x);
+      }
+    }
+    void zero(int dst) {
+      alu_rr(ALU_XOR, dst, dst, false);
+    }
+    void alu_rr(int op, int dst, int src, bool w = true) {
+      rex(w, src, dst);
+      byte(op);
+      modrm_rr(src, dst);
+    }
+    void alu_ri(int ext, int dst, int32_t x, bool w = true) {
+      rex(w, 0, dst);
+      byte(0x81);
+      modrm_rr(ext, dst);
+      imm32(x);
+    }
+    void add_mi(int base, int32_t disp, int32_t x) {
+      rex(true, 0, base);
+      byte(0x81);
+      modrm_mem(EXT_ADD, base, disp);
+      imm32(x);
+    }
+    void shift_ri(int ext, int dst, uint8_t amt, bool w = true) {
+      rex(w, 0, dst);
+      byte(0xc1);
+      modrm_rr(ext, dst);
+      byte(amt);
+    }
+    void shift_rcl(int ext, int dst, bool w = true) {
+      rex(w, 0, dst);
+      byte(0xd3);
+      modrm_rr(ext, dst);
+    }
+    void imul_rr(int dst, int src, bool w = true) {
+      rex(w, dst, src);
+      byte(0x0f);
+      byte(0xaf);
+      modrm_rr(dst, src);
+    }
+    void movsxd(int dst, int src) {
+      rex(true, dst, src);
+      byte(0x63);
+      modrm_rr(dst, src);
+    }
+    /* movzx/movsx from the low 8 or 16 bits, op is the byte after 0f */
+    void movx(uint8_t op, int dst, int src) {
+      rex(true, dst, src);
+      byte(0x0f);
+      byte(op);
+      modrm_rr(dst, src);
+    }
+    /* mov r32, r32 clears the upper half */
+    void zext32(int r) {
+      rex(false, r, r);
+      byte(0x89);
+      modrm_rr(r, r);
+    }
+    void not_r(int r) {
+      rex(true, 0, r);
+      byte(0xf7);
+      modrm_rr(2, r);
+    }
+    void bswap(int r) {
+      rex(true, 0, r);
+      byte(0x0f);
+      byte(0xc8 + (r & 7));
+    }
+    void bt_rr(int op, int dst, int bit) {
+      rex(true, bit, dst);
+      byte(0x0f);
+      byte(op);
+      modrm_rr(bit, dst);
+    }
+    void bt_ri(int ext, int dst, uint8_t bit) {
+      rex(true, 0, dst);
+      byte(0x0f);
+      byte(0xba);
+      modrm_rr(ext, dst);
+      byte(bit);
+    }
+    void count(int op, int dst, int src, bool w = true) {
+      byte(0xf3);
+      rex(w, dst, src);
+      byte(0x0f);
+      byte(op);
+      modrm_rr(dst, src);
+    }
+    /* setcc al, movzx eax, al */
+    void setcc_rax(int cc) {
+      byte(0x0f);
+      byte(0x90 | cc);
+      modrm_rr(0, RAX);
+      byte(0x0f);
+      byte(0xb6);
+      modrm_rr(RAX, RAX);
+    }
+    size_t jcc(int cc) {
+      byte(0x0f);
+      byte(0x80 | cc);
+      imm32(0);
+      return pos() - 4;
+    }
+    size_t jmp() {
+      byte(0xe9);
+      imm32(0);
+      return pos() - 4;
+    }
+    void jmp_to(size_t target) {
+      size_t at = jmp();
+      patch(at, target);
+    }
+    void patch(size_t at, size_t target) {
+      int32_t rel = static_cast<int64_t>(target) - static_cast<int64_t>(at + 4);
+      memcpy(&buf[at], &rel, sizeof(rel));
+    }
+    void call(const void *fn) {
+      rex(true, 0, R11);
+      byte(0xb8 + (R11 & 7));
+      imm64(reinterpret_cast<uint64_t>(fn));
+      rex(false, 0, R11);
+      byte(0xff);
+      modrm_rr(2, R11);
+    }
+    void push(int r) {
+      rex(false, 0, r);
+      byte(0x50 + (r & 7));
+    }
+    void pop(int r) {
+      rex(false, 0, r);
+      byte(0x58 + (r & 7));
+    }
+    void ret() {
+      byte(0xc3);
+    }
+  };
+
+  bool is_cti(uint8_t op) {
+    return (op >= pd_jal) and (op <= pd_bgeu);
+  }
+  bool is_alu_imm(uint8_t op) {
+    return (op >= pd_addi) and (op <= pd_rev8);
+  }
+  bool is_alu_reg(uint8_t op) {
+    return (op >= pd_add) and (op < pd_page_end);
+  }
+}
+
+jit_cache::jit_cache() :
+  translations(0), translated_insns(0), code_flushes(0) {
+  blocks = new block[1UL<<lg_n_blocks];
+  memset(blocks, 0, sizeof(block)*(1UL<<lg_n_blocks));
+  void *p = mmap(nullptr, code_sz, PROT_READ|PROT_WRITE|PROT_EXEC,
+		 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  assert(p != MAP_FAILED);
+  code = code_ptr = reinterpret_cast<uint8_t*>(p);
+}
+
+jit_cache::~jit_cache() {
+  munmap(code, code_sz);
+  delete [] blocks;
+}
+
+jit_cache::block *jit_cache::find(state_t *s, uint64_t phys_pc) {
+  uint64_t gen = s->pdc->get_gen(phys_pc);
+  block &b = blocks[(phys_pc >> 2) & ((1UL<<lg_n_blocks)-1)];
+  if((b.phys_pc != phys_pc) or (b.pc != s->pc) or (b.gen != gen)) {
+    b.phys_pc = phys_pc;
+    b.pc = s->pc;
+    b.gen = gen;
+    b.hits = 0;
+    b.len = 0;
+    b.fn = nullptr;
+  }
+  if(b.fn == nullptr) {
+    if(++b.hits != hot_threshold) {
+      return nullptr;
+    }
+    if(not(translate(s, b))) {
+      return nullptr;
+    }
+  }
+  return &b;
+}
+
+bool jit_cache::translate(state_t *s, block &b) {
+  static const uint64_t pg_mask = 4095;
+  std::vector<pd_insn> insns;
+  for(uint64_t pa = b.phys_pc;
+      ((pa & pg_mask) or (pa == b.phys_pc)) and (insns.size() < max_block_len);
+      pa += insns.back().len) {
+    pd_insn *pd = s->pdc->lookup(pa, s->mem);
+    /* loop and spin branches stay with the block executor, which can
+     * run or skip their iterations in bulk */
+    if((pd->op == pd_slow) or (pd->op >= pd_bne_loop)) {
+      break;
+    }
+    insns.push_back(*pd);
+    /* fused pairs are translated an instruction at a time */
+    insns.back().op = pd_unfused(pd->op);
+    if(is_cti(pd->op)) {
+      break;
+    }
+  }
+  if(insns.empty()) {
+    return false;
+  }
+  const uint64_t n = insns.size();
+
+  /* map the most used guest registers */
+  uint64_t uses[32] = {0};
+  for(const pd_insn &d : insns) {
+    if(d.op == pd_nop) {
+      continue;
+    }
+    if((d.op != pd_lui) and (d.op != pd_auipc) and (d.op != pd_jal)) {
+      uses[d.rs1]++;
+    }
+    if(is_alu_reg(d.op) or ((d.op >= pd_beq) and (d.op <= pd_bgeu)) or
+       ((d.op >= pd_sb) and (d.op <= pd_sd))) {
+      uses[d.rs2]++;
+    }
+    if(not(((d.op >= pd_beq) and (d.op <= pd_bgeu)) or
+	   ((d.op >= pd_sb) and (d.op <= pd_sd)))) {
+      uses[d.rd]++;
+    }
+  }
+  uses[0] = 0;
+  int host_of[32], guest_of[n_mapped];
+  std::fill(host_of, host_of+32, -1);
+  std::fill(guest_of, guest_of+n_mapped, 0);
+  for(int i = 0; i < n_mapped; i++) {
+    int g = 0;
+    for(int r = 1; r < 32; r++) {
+      if(uses[r] > uses[g] and host_of[r] == -1) {
+	g = r;
+      }
+    }
+    if(g == 0) {
+      break;
+    }
+    host_of[g] = mapped_regs[i];
+    guest_of[i] = g;
+  }
+
+  const int32_t off_pc = reinterpret_cast<uint8_t*>(&s->pc) - reinterpret_cast<uint8_t*>(s);
+  const int32_t off_icnt = reinterpret_cast<uint8_t*>(&s->icnt) - reinterpret_cast<uint8_t*>(s);
+  const int32_t off_last_call = reinterpret_cast<uint8_t*>(&s->last_call) - reinterpret_cast<uint8_t*>(s);
+
+  std::vector<uint8_t> buf;
+  std::vector<size_t> to_exit_len, to_exit_wb;
+  emitter e(buf);
+
+  auto get = [&](int h, int g) {
+    if(g == 0)
+      e.zero(h);
+    else if(host_of[g] != -1)
+      e.mov_rr(h, host_of[g]);
+    else
+      e.load(h, R15, 8*g);
+  };
+  auto put = [&](int g, int h) {
+    if(g == 0)
+      return;
+    else if(host_of[g] != -1)
+      e.mov_rr(host_of[g], h);
+    else
+      e.store(R15, 8*g, h);
+  };
+  auto exit_to = [&](uint64_t pc) {
+    e.mov_ri(RAX, pc);
+    e.store(R14, off_pc, RAX);
+    to_exit_len.push_back(e.jmp());
+  };
+  size_t body = 0;
+  /* branch back to the head of the block, keep looping
+   * while the whole block fits under stop_icnt */
+  auto loop_to_head = [&]() {
+    e.load(RAX, R14, off_icnt);
+    e.alu_ri(EXT_ADD, RAX, n);
+    e.store(R14, off_icnt, RAX);
+    e.alu_ri(EXT_ADD, RAX, n);
+    e.load(RCX, RSP, 0);
+    e.alu_rr(ALU_CMP, RAX, RCX);
+    size_t stop = e.jcc(CC_A);
+    e.jmp_to(body);
+    e.patch(stop, e.pos());
+    e.mov_ri(RAX, b.pc);
+    e.store(R14, off_pc, RAX);
+    to_exit_wb.push_back(e.jmp());
+  };
+  auto link = [&](uint64_t pc, int rd, int rs1) {
+    e.mov_ri(RAX, pc);
+    e.store(R14, off_last_call, RAX);
+    bool rd_is_link = (rd == 1) or (rd == 5);
+    bool rs1_is_link = (rs1 == 1) or (rs1 == 5);
+    if(rd_is_link or ((rd == 0) and rs1_is_link)) {
+      e.mov_rr(RDI, R14);
+      e.mov_ri(RSI, pc);
+      e.mov_ri(RDX, rd);
+      e.mov_ri(RCX, rs1);
+      e.call(reinterpret_cast<const void*>(&jit_link));
+    }
+  };
+
+  /* prologue: void fn(state_t *s, int64_t *gpr, uint64_t stop_icnt) */
+  e.push(RBX);
+  e.push(RBP);
+  e.push(R12);
+  e.push(R13);
+  e.push(R14);
+  e.push(R15);
+  e.alu_ri(EXT_SUB, RSP, 8);
+  e.store(RSP, 0, RDX);
+  e.mov_rr(R14, RDI);
+  e.mov_rr(R15, RSI);
+  for(int i = 0; i < n_mapped; i++) {
+    if(guest_of[i]) {
+      e.load(mapped_regs[i], R15, 8*guest_of[i]);
+    }
+  }
+  body = e.pos();
+
+  uint64_t pc = b.pc;
+  for(uint64_t i = 0; i < n; pc += insns[i].len, i++) {
+    const pd_insn &d = insns[i];
+    const int32_t imm = d.imm;
+    switch(d.op)
+      {
+      case pd_nop:
+	break;
+      case pd_lui:
+	e.mov_ri(RAX, d.imm);
+	put(d.rd, RAX);
+	break;
+      case pd_auipc:
+	e.mov_ri(RAX, pc + d.imm);
+	put(d.rd, RAX);
+	break;
+      case pd_jal:
+	if(d.rd != 0) {
+	  e.mov_ri(RAX, pc + d.len);
+	  put(d.rd, RAX);
+	}
+	link(pc, d.rd, 0);
+	if((pc + d.imm) == b.pc)
+	  loop_to_head();
+	else
+	  exit_to(pc + d.imm);
+	break;
+      case pd_jalr:
+	get(RAX, d.rs1);
+	e.alu_ri(EXT_ADD, RAX, imm);
+	e.alu_ri(EXT_AND, RAX, -2);
+	e.store(R14, off_pc, RAX);
+	if(d.rd != 0) {
+	  e.mov_ri(RAX, pc + d.len);
+	  put(d.rd, RAX);
+	}
+	link(pc, d.rd, d.rs1);
+	to_exit_len.push_back(e.jmp());
+	break;
+      case pd_beq:
+      case pd_bne:
+      case pd_blt:
+      case pd_bge:
+      case pd_bltu:
+      case pd_bgeu: {
+	static const int ccs[] = {CC_E, CC_NE, CC_L, CC_GE, CC_B, CC_AE};
+	get(RAX, d.rs1);
+	get(RCX, d.rs2);
+	e.alu_rr(ALU_CMP, RAX, RCX);
+	size_t taken = e.jcc(ccs[d.op - pd_beq]);
+	exit_to(pc + d.len);
+	e.patch(taken, e.pos());
+	if((pc + d.imm) == b.pc)
+	  loop_to_head();
+	else
+	  exit_to(pc + d.imm);
+	break;
+      }
+      case pd_lb:
+      case pd_lh:
+      case pd_lw:
+      case pd_ld:
+      case pd_lbu:
+      case pd_lhu:
+      case pd_lwu:
+	get(RSI, d.rs1);
+	e.alu_ri(EXT_ADD, RSI, imm);
+	e.mov_rr(RDI, R14);
+	e.mov_ri(RDX, d.op);
+	e.mov_ri(RCX, pc);
+	e.mov_ri(R8, i);
+	e.call(reinterpret_cast<const void*>(&jit_load));
+	e.alu_rr(ALU_TEST, RDX, RDX);
+	to_exit_wb.push_back(e.jcc(CC_NE));
+	put(d.rd, RAX);
+	break;
+      case pd_sb:
+      case pd_sh:
+      case pd_sw:
+      case pd_sd:
+	get(RSI, d.rs1);
+	e.alu_ri(EXT_ADD, RSI, imm);
+	get(RDX, d.rs2);
+	e.mov_rr(RDI, R14);
+	e.mov_ri(RCX, (d.len == 2) ? (d.op | jit_rvc) : d.op);
+	e.mov_ri(R8, pc);
+	e.mov_ri(R9, i);
+	e.call(reinterpret_cast<const void*>(&jit_store));
+	e.alu_rr(ALU_TEST, RAX, RAX);
+	to_exit_wb.push_back(e.jcc(CC_NE));
+	break;
+      default:
+	assert(is_alu_imm(d.op) or is_alu_reg(d.op));
+	get(RAX, d.rs1);
+	if(is_alu_reg(d.op)) {
+	  get(RCX, d.rs2);
+	}
+	switch(d.op)
+	  {
+	  case pd_addi:
+	    e.alu_ri(EXT_ADD, RAX, imm);
+	    break;
+	  case pd_slti:
+	    e.alu_ri(EXT_CMP, RAX, imm);
+	    e.setcc_rax(CC_L);
+	    break;
+	  case pd_sltiu:
+	    e.alu_ri(EXT_CMP, RAX, imm);
+	    e.setcc_rax(CC_B);
+	    break;
+	  case pd_xori:
+	    e.alu_ri(EXT_XOR, RAX, imm);
+	    break;
+	  case pd_ori:
+	    e.alu_ri(EXT_OR, RAX, imm);
+	    break;
+	  case pd_andi:
+	    e.alu_ri(EXT_AND, RAX, imm);
+	    break;
+	  case pd_slli:
+	    e.shift_ri(EXT_SHL, RAX, imm);
+	    break;
+	  case pd_srli:
+	    e.shift_ri(EXT_SHR, RAX, imm);
+	    break;
+	  case pd_srai:
+	    e.shift_ri(EXT_SAR, RAX, imm);
+	    break;
+	  case pd_addiw:
+	    e.alu_ri(EXT_ADD, RAX, imm, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_slliw:
+	    e.shift_ri(EXT_SHL, RAX, imm, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_srliw:
+	    e.shift_ri(EXT_SHR, RAX, imm, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_sraiw:
+	    e.shift_ri(EXT_SAR, RAX, imm, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_add:
+	    e.alu_rr(ALU_ADD, RAX, RCX);
+	    break;
+	  case pd_sub:
+	    e.alu_rr(ALU_SUB, RAX, RCX);
+	    break;
+	  case pd_xor:
+	    e.alu_rr(ALU_XOR, RAX, RCX);
+	    break;
+	  case pd_or:
+	    e.alu_rr(ALU_OR, RAX, RCX);
+	    break;
+	  case pd_and:
+	    e.alu_rr(ALU_AND, RAX, RCX);
+	    break;
+	  case pd_sll:
+	    e.shift_rcl(EXT_SHL, RAX);
+	    break;
+	  case pd_srl:
+	    e.shift_rcl(EXT_SHR, RAX);
+	    break;
+	  case pd_sra:
+	    e.shift_rcl(EXT_SAR, RAX);
+	    break;
+	  case pd_slt:
+	    e.alu_rr(ALU_CMP, RAX, RCX);
+	    e.setcc_rax(CC_L);
+	    break;
+	  case pd_sltu:
+	    e.alu_rr(ALU_CMP, RAX, RCX);
+	    e.setcc_rax(CC_B);
+	    break;
+	  case pd_addw:
+	    e.alu_rr(ALU_ADD, RAX, RCX, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_subw:
+	    e.alu_rr(ALU_SUB, RAX, RCX, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_sllw:
+	    e.shift_rcl(EXT_SHL, RAX, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_srlw:
+	    e.shift_rcl(EXT_SHR, RAX, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_sraw:
+	    e.shift_rcl(EXT_SAR, RAX, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_mul:
+	    e.imul_rr(RAX, RCX);
+	    break;
+	  case pd_mulw:
+	    e.imul_rr(RAX, RCX, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_slliuw:
+	    e.zext32(RAX);
+	    e.shift_ri(EXT_SHL, RAX, imm);
+	    break;
+	  case pd_bseti:
+	    e.bt_ri(BT_EXT_BTS, RAX, imm);
+	    break;
+	  case pd_bclri:
+	    e.bt_ri(BT_EXT_BTR, RAX, imm);
+	    break;
+	  case pd_binvi:
+	    e.bt_ri(BT_EXT_BTC, RAX, imm);
+	    break;
+	  case pd_bexti:
+	    e.shift_ri(EXT_SHR, RAX, imm);
+	    e.alu_ri(EXT_AND, RAX, 1);
+	    break;
+	  case pd_rori:
+	    e.shift_ri(EXT_ROR, RAX, imm);
+	    break;
+	  case pd_roriw:
+	    e.shift_ri(EXT_ROR, RAX, imm, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+#ifdef __LZCNT__
+	  case pd_clz:
+	    e.count(CNT_LZCNT, RAX, RAX);
+	    break;
+	  case pd_clzw:
+	    e.count(CNT_LZCNT, RAX, RAX, false);
+	    break;
+#endif
+#ifdef __BMI__
+	  case pd_ctz:
+	    e.count(CNT_TZCNT, RAX, RAX);
+	    break;
+	  case pd_ctzw:
+	    e.count(CNT_TZCNT, RAX, RAX, false);
+	    break;
+#endif
+#ifdef __POPCNT__
+	  case pd_cpop:
+	    e.count(CNT_POPCNT, RAX, RAX);
+	    break;
+	  case pd_cpopw:
+	    e.count(CNT_POPCNT, RAX, RAX, false);
+	    break;
+#endif
+	  case pd_sextb:
+	    e.movx(0xbe, RAX, RAX);
+	    break;
+	  case pd_sexth:
+	    e.movx(0xbf, RAX, RAX);
+	    break;
+	  case pd_zexth:
+	    e.movx(0xb7, RAX, RAX);
+	    break;
+	  case pd_rev8:
+	    e.bswap(RAX);
+	    break;
+	  case pd_sh1add:
+	  case pd_sh2add:
+	  case pd_sh3add:
+	    e.shift_ri(EXT_SHL, RAX, 1 + d.op - pd_sh1add);
+	    e.alu_rr(ALU_ADD, RAX, RCX);
+	    break;
+	  case pd_adduw:
+	  case pd_sh1adduw:
+	  case pd_sh2adduw:
+	  case pd_sh3adduw:
+	    e.zext32(RAX);
+	    if(d.op != pd_adduw) {
+	      e.shift_ri(EXT_SHL, RAX, d.op - pd_adduw);
+	    }
+	    e.alu_rr(ALU_ADD, RAX, RCX);
+	    break;
+	  case pd_andn:
+	    e.not_r(RCX);
+	    e.alu_rr(ALU_AND, RAX, RCX);
+	    break;
+	  case pd_orn:
+	    e.not_r(RCX);
+	    e.alu_rr(ALU_OR, RAX, RCX);
+	    break;
+	  case pd_xnor:
+	    e.alu_rr(ALU_XOR, RAX, RCX);
+	    e.not_r(RAX);
+	    break;
+	  case pd_rol:
+	    e.shift_rcl(EXT_ROL, RAX);
+	    break;
+	  case pd_ror:
+	    e.shift_rcl(EXT_ROR, RAX);
+	    break;
+	  case pd_rolw:
+	    e.shift_rcl(EXT_ROL, RAX, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_rorw:
+	    e.shift_rcl(EXT_ROR, RAX, false);
+	    e.movsxd(RAX, RAX);
+	    break;
+	  case pd_bset:
+	    e.bt_rr(BT_BTS, RAX, RCX);
+	    break;
+	  case pd_bclr:
+	    e.bt_rr(BT_BTR, RAX, RCX);
+	    break;
+	  case pd_binv:
+	    e.bt_rr(BT_BTC, RAX, RCX);
+	    break;
+	  case pd_bext:
+	    e.shift_rcl(EXT_SHR, RAX);
+	    e.alu_ri(EXT_AND, RAX, 1);
+	    break;
+	  default:
+	    /* mulh, the divides, min/max, orc.b and clmul go through
+	     * the interpreter's ops */
+	    e.mov_rr(RSI, RAX);
+	    get(RDX, d.rs2);
+	    e.mov_ri(RDI, d.op);
+	    e.mov_ri(RCX, d.imm);
+	    e.call(reinterpret_cast<const void*>(&jit_alu));
+	    break;
+	  }
+	put(d.rd, RAX);
+	break;
+      }
+  }
+  if(not(is_cti(insns.back().op))) {
+    exit_to(pc);
+  }
+
+  /* exits: retire the block, write back mapped registers */
+  for(size_t at : to_exit_len) {
+    e.patch(at, e.pos());
+  }
+  e.add_mi(R14, off_icnt, n);
+  for(size_t at : to_exit_wb) {
+    e.patch(at, e.pos());
+  }
+  for(int i = 0; i < n_mapped; i++) {
+    if(guest_of[i]) {
+      e.store(R15, 8*guest_of[i], mapped_regs[i]);
+    }
+  }
+  e.alu_ri(EXT_ADD, RSP, 8);
+  e.pop(R15);
+  e.pop(R14);
+  e.pop(R13);
+  e.pop(R12);
+  e.pop(RBP);
+  e.pop(RBX);
+  e.ret();
+
+  uint64_t sz = (buf.size() + 15) & (~15UL);
+  if((code_ptr + sz) > (code + code_sz)) {
+    /* out of code space, drop every translation */
+    block t = b;
+    memset(blocks, 0, sizeof(block)*(1UL<<lg_n_blocks));
+    b = t;
+    code_ptr = code;
+    ++code_flushes;
+  }
+  memcpy(code_ptr, buf.data(), buf.size());
+  b.fn = reinterpret_cast<block_fn>(code_ptr);
+  b.len = n;
+  code_ptr += sz;
+  ++translations;
+  translated_insns += n;
+  return true;
+}
@@ -0,0 +1,71 @@
+#ifndef __JIT_HH__
+#define __JIT_HH__
+
+#include <cstdint>
+#include <vector>
+
+struct state_t;
+
+/* slow-path helpers called from translated code, defined in
+ * interpret.cc. k is the number of instructions of the block retired
+ * before the calling instruction. on a fault the helper takes the
+ * trap itself and the block returns */
+struct jit_ret {
+  int64_t value;
+  uint64_t fault;
+};
+jit_ret jit_load(state_t *s, int64_t ea, uint64_t op, uint64_t pc, uint64_t k);
+/* non-zero when the block has to end: fault, or the store hit code
+ * or changed the interrupt state. jit_rvc is or'd into op for a
+ * compressed store */
+static const uint64_t jit_rvc = 1UL<<8;
+uint64_t jit_store(state_t *s, int64_t ea, int64_t x, uint64_t op, uint64_t pc, uint64_t k);
+int64_t jit_alu(uint64_t op, uint64_t u_rs1, uint64_t u_rs2, int64_t imm);
+void jit_link(state_t *s, uint64_t pc, uint64_t rd, uint64_t rs1);
+
+/* translates hot predecoded blocks into x86-64. a block is the same
+ * straight-line run the block executor uses, keyed by physical and
+ * virtual pc plus the pd_cache generation of its page so code
+ * modifications retire stale translations. translated code keeps the
+ * most used guest registers in callee-saved host registers and
+ * returns to the block loop at the end of the block, except for
+ * branches back to the block head which loop until stop_icnt */
+class jit_cache {
+public:
+  typedef void (*block_fn)(state_t *s, int64_t *gpr, uint64_t stop_icnt);
+  struct block {
+    uint64_t phys_pc;
+    uint64_t pc;
+    uint64_t gen;
+    uint32_t hits;
+    uint32_t len;
+    block_fn fn;
+  };
+private:
+  static const uint64_t lg_n_blocks = 14;
+  static const uint32_t hot_threshold = 64;
+  static const uint64_t code_sz = 1UL<<26;
+  static const uint32_t max_block_len = 256;
+  block *blocks;
+  uint8_t *code, *code_ptr;
+  uint64_t translations, translated_insns, code_flushes;
+  bool translate(state_t *s, block &b);
+public:
+  jit_cache();
+  ~jit_cache();
+  block *find(state_t *s, uint64_t phys_pc);
+  uint64_t get_translations() const {
+    return translations;
+  }
+  uint64_t get_translated_insns() const {
+    return translated_insns;
+  }
+  uint64_t get_code_bytes() const {
+    return code_ptr - code;
+  }
+  uint64_t get_code_flushes() const {
+    return code_flushes;
+  }
+};
+
+#endif
@@ -43,6 +43,7 @@
 #include <cstring>
 #include <cassert>
 #include <map>
+#include <algorithm>
 #include <fstream>
 #include <boost/program_options.hpp>
 
@@ -50,23 +51,73 @@
 #include "helper.hh"
 #include "disassemble.hh"
 #include "interpret.hh"
+#include "vector.hh"
 #include "saveState.hh"
 #include "globals.hh"
 #include "virtio.hh"
 #include "uart.hh"
 #include "trace.hh"
 #include "branch_predictor.hh"
+#include "predecode.hh"
+#include "jit.hh"
+#include "aot.hh"
+#include "mmio.hh"
+#include "fdt.hh"
 
 extern const char* githash;
 
 void load_raw(const char* fn, state_t *ms);
 
+/* host mapping for guest physical memory, 2MB aligned so guest and
+ * host huge pages line up. hugepages 2 reserves the whole range from
+ * the hugetlbfs pool up front and falls back to transparent huge
+ * pages when the pool is too small */
+static uint8_t *map_guest_mem(uint64_t len, int hugepages) {
+  static const uint64_t align = 1UL<<21;
+#ifdef __linux__
+  if(hugepages == 2) {
+    void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(p != MAP_FAILED) {
+      return reinterpret_cast<uint8_t*>(p);
+    }
+    std::cerr << "INTERP : no hugetlbfs pages, using transparent huge pages\n";
+  }
+  void *p = mmap(nullptr, len + align, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+#else
+  void *p = mmap(nullptr, len + align, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS , -1, 0);
+#endif
+  if(p == MAP_FAILED) {
+    return nullptr;
+  }
+  uint8_t *m = reinterpret_cast<uint8_t*>(p);
+  uint8_t *a = reinterpret_cast<uint8_t*>((reinterpret_cast<uint64_t>(m) + align - 1) & ~(align - 1));
+  if(a != m) {
+    munmap(m, a - m);
+  }
+  munmap(a + len, (m + len + align) - (a + len));
+#ifdef MADV_HUGEPAGE
+  if(hugepages) {
+    madvise(a, len, MADV_HUGEPAGE);
+  }
+#endif
+  return a;
+}
+
 uint64_t globals::tlb_accesses = 0;
 uint64_t globals::tlb_hits = 0;
+uint64_t globals::tlb_pg_hits[5] = {0};
+uint64_t globals::pwc_accesses = 0;
+uint64_t globals::pwc_hits = 0;
+uint64_t globals::pte_reads[5] = {0};
+uint64_t globals::wfi_skips = 0;
 uint64_t globals::tohost_addr = 0;
 uint64_t globals::fromhost_addr = 0;
 bool globals::log = false;
 std::map<std::string, uint64_t> globals::symtab;
+std::vector<std::pair<uint64_t, uint64_t>> globals::elf_text;
 char **globals::sysArgv = nullptr;
 int globals::sysArgc = 0;
 bool globals::silent = true;
@@ -74,10 +125,14 @@ bool globals::fullsim = true;
 bool globals::fdt_uart = false;
 bool globals::interactive = false;
 bool globals::svnapot = true;
+int globals::va_bits = 39;
 uint64_t globals::fdt_ram_size = 1UL<<24;
 uint64_t globals::fw_start_addr = 1UL<<21;
 uint64_t globals::fdt_addr = (1UL<<16) + 64;
 uint64_t globals::ram_phys_start = 0x0;
+bool globals::ram_sparse = false;
+uint64_t globals::phys_mem_size = 1UL<<32;
+int globals::hugepages = 1;
 uint32_t globals::cpu_freq = 100*1000*1000;
 trace* globals::tracer = nullptr;
 branch_trace* globals::branch_tracer = nullptr;
@@ -86,6 +141,8 @@ branch_predictor *globals::bpred = nullptr;
 bool globals::extract_kernel = false;
 bool globals::enable_zbb = true;
 bool globals::hacky_fp32 = true;
+bool globals::blocks = true;
+uint64_t globals::vlen = 256;
 std::map<uint64_t, std::map<uint64_t, uint64_t>> globals::insn_histo;
 
 static state_t *s = nullptr;
@@ -152,8 +209,8 @@ int main(int argc, char *argv[]) {
   std::string sysArgs, filename, tracename, bpred;
   uint64_t maxinsns = ~(0UL), dumpIcnt = ~(0UL);
   bool simpoint = false, raw = false, load_dump = false, take_checkpoints = false;
-  bool use_store_to_load_tracker = false;
-  std::string tohost, fromhost, simpoint_file;
+  bool use_store_to_load_tracker = false, use_predecode = true, use_jit = true;
+  std::string tohost, fromhost, simpoint_file, aot_so, aot_out;
   int lg2_icache_lines, lg2_dcache_lines;
   int icache_ways, dcache_ways, dtlb_entries;
   uint64_t init_icnt = 0, simpoint_interval;
@@ -180,6 +237,8 @@ int main(int argc, char *argv[]) {
       ("uart", po::value<bool>(&globals::fdt_uart)->default_value(false), "enable uart in fdt")
       ("ram_size", po::value<uint64_t>(&globals::fdt_ram_size)->default_value(1UL<<30), "fdt ram size")
       ("phys_start", po::value<uint64_t>(&globals::ram_phys_start)->default_value(1UL<<21), "start address for physical memory")
+      ("ram_sparse", po::value<bool>(&globals::ram_sparse)->default_value(false), "ram past the devices continues at 4GB")
+      ("hugepages", po::value<int>(&globals::hugepages)->default_value(1), "back guest memory with 0 small pages, 1 transparent huge pages, 2 hugetlbfs")
       ("interactive", po::value<bool>(&globals::interactive)->default_value(false), "interactive shell")
       ("lg2_icache_lines", po::value<int>(&lg2_icache_lines)->default_value(0), "number of icache lines")
       ("lg2_dcache_lines", po::value<int>(&lg2_dcache_lines)->default_value(0), "number of dcache lines")
@@ -188,9 +247,16 @@ int main(int argc, char *argv[]) {
       ("dcache_ways", po::value<int>(&dcache_ways)->default_value(1), "number of dcache ways")
       ("tracename", po::value<std::string>(&tracename), "tracename")
       ("svnapot", po::value<bool>(&globals::svnapot)->default_value(true), "enable svnapot")
+      ("va_bits", po::value<int>(&globals::va_bits)->default_value(39), "widest paging mode (39, 48 or 57)")
       ("store_to_load",  po::value<bool>(&use_store_to_load_tracker)->default_value(false), "store to load tracker") 
       ("extract_kernel,k", po::value<bool>(&globals::extract_kernel)->default_value(false), "extract kernel.bin")
       ("freq", po::value<uint32_t>(&globals::cpu_freq)->default_value(100*1000*1000), "system freq")
+      ("predecode", po::value<bool>(&use_predecode)->default_value(true), "cache predecoded instructions")
+      ("blocks", po::value<bool>(&globals::blocks)->default_value(true), "run predecoded basic blocks (needs predecode)")
+      ("jit", po::value<bool>(&use_jit)->default_value(true), "translate hot blocks to x86-64 (needs blocks)")
+      ("aot", po::value<std::string>(&aot_so), "run blocks from a shared object made by --aot_out (needs blocks)")
+      ("aot_out", po::value<std::string>(&aot_out), "translate the elf's code into a shared object and exit")
+      ("vlen", po::value<uint64_t>(&globals::vlen)->default_value(256), "vector register bits (0 disables rvv)")
       ; 
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -205,12 +271,26 @@ int main(int argc, char *argv[]) {
     std::cerr << argv[0] << ": no file\n";
     return -1;
   }
+  if((globals::va_bits != 39) and (globals::va_bits != 48) and (globals::va_bits != 57)) {
+    std::cerr << argv[0] << ": va_bits must be 39, 48 or 57\n";
+    return -1;
+  }
+  {
+    /* at least the low 4GB, where the devices and boot rom live,
+     * rounded up to a 1GB multiple */
+    uint64_t bank_start[2], bank_size[2];
+    int n_banks = ram_banks(bank_start, bank_size);
+    uint64_t ram_end = bank_start[n_banks-1] + bank_size[n_banks-1];
+    globals::phys_mem_size = std::max(1UL<<32, (ram_end + (1UL<<30) - 1) & ~((1UL<<30) - 1));
+  }
 
   /* Build argc and argv */
   globals::sysArgc = buildArgcArgv(filename.c_str(),sysArgs,globals::sysArgv);
 
   int rc = posix_memalign((void**)&s, pgSize, pgSize); 
   initState(s);
+  initDevices(s);
+  initVector(s, globals::vlen);
   if(globals::extract_kernel) {
     s->maxicnt = maxinsns = 0;
   }
@@ -231,19 +311,18 @@ int main(int argc, char *argv[]) {
   if(dtlb_entries) {
     s->dtlb = new tlb(dtlb_entries);
   }
+  if(use_predecode) {
+    s->pdc = new pd_cache(globals::phys_mem_size);
+  }
+#ifdef __x86_64__
+  if(use_jit and use_predecode and globals::blocks) {
+    s->jit = new jit_cache();
+  }
+#endif
   s->last_pc = 0;
   s->last_phys_pc = 0;
   
-#ifdef __linux__
-  void* mempt = mmap(nullptr, 1UL<<32, PROT_READ | PROT_WRITE,
-		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
-#else
-  void* mempt = mmap(nullptr, 1UL<<32, PROT_READ | PROT_WRITE,
-		     MAP_PRIVATE | MAP_ANONYMOUS , -1, 0);
-#endif
-  assert(mempt != reinterpret_cast<void*>(-1));
-  assert(madvise(mempt, 1UL<<32, MADV_DONTNEED)==0);
-  s->mem = reinterpret_cast<uint8_t*>(mempt);
+  s->mem = map_guest_mem(globals::phys_mem_size, globals::hugepages);
 
   bool fileIsDump = false;
   if(not(filename.empty())) {
@@ -280,6 +359,21 @@ int main(int argc, char *argv[]) {
   else {
     load_elf(filename.c_str(), s);
   }
+  initHtif(s);
+  if(not(aot_out.empty())) {
+    if(globals::elf_text.empty()) {
+      std::cerr << argv[0] << ": --aot_out needs an elf with executable sections\n";
+      return -1;
+    }
+    return aot_image::build(s, globals::elf_text, aot_out) ? 0 : -1;
+  }
+  if(not(aot_so.empty())) {
+    if((s->pdc == nullptr) or not(globals::blocks)) {
+      std::cerr << argv[0] << ": --aot needs predecode and blocks\n";
+      return -1;
+    }
+    s->aot = new aot_image(s, aot_so);
+  }
   initCapstone();
 
   if(not(tracename.empty())) {
@@ -334,7 +428,13 @@ int main(int argc, char *argv[]) {
 	dumpState(*s, ss.str());
 	++ch_idx;
       }
-      execRiscv(s);
+      /* run to the next checkpoint, a checkpoint we already
+       * passed can never be hit so just run to the end */
+      uint64_t stop = s->icnt + 1;
+      if(ch_idx < n_chpts) {
+	stop = checkpoint_icnts.at(ch_idx) > s->icnt ? checkpoint_icnts.at(ch_idx) : ~0UL;
+      }
+      runRiscv(s, stop);
     }    
   }
   else if(take_checkpoints) {
@@ -345,7 +445,7 @@ int main(int argc, char *argv[]) {
 	//std::cout << "dumping at icnt " << s->icnt << "\n";
 	dumpState(*s, ss.str());
       }
-      execRiscv(s);
+      runRiscv(s, ((s->icnt / dumpIcnt) + 1) * dumpIcnt);
     }
   }
   else if(not(globals::interactive)) {
@@ -374,8 +474,13 @@ int main(int argc, char *argv[]) {
 	      << std::round((s->icnt/runtime)*1e-6) << " mips "
 	      << KNRM  << "\n";
     std::cerr << "final pc " << std::hex << s->pc << std::dec << "\n";
-    for(int i = 0; i < 3; i++) {
-      if((s->ipgszcnt[i] == 0) and (s->dpgszcnt[i]==0))
+    if(globals::wfi_skips) {
+      std::cout << "wfi/wrs: " << globals::wfi_skips << " skips, "
+		<< s->idle_time << " time units idle ("
+		<< (100.0 * s->idle_time) / s->get_time() << "% of time)\n";
+    }
+    for(int i = 0; i < 5; i++) {
+      if((s->ipgszcnt[i] == 0) and (s->dpgszcnt[i]==0) and (globals::tlb_pg_hits[i]==0))
 	continue;
       uint64_t pgsz = 0;
       switch(i)
@@ -392,10 +497,28 @@ int main(int argc, char *argv[]) {
 	case 3:
 	  pgsz = 1UL<<16;
 	  break;
+	case 4: /* and sv57's 256TB pages */
+	  pgsz = 1UL<<39;
+	  break;
 	}
-      std::cout << pgsz << " pg sizes : iside " << s->ipgszcnt[i] << ", dside " << s->dpgszcnt[i] << " accesses\n";
+      std::cout << pgsz << " pg sizes : iside " << s->ipgszcnt[i] << ", dside " << s->dpgszcnt[i] << " accesses, "
+		<< globals::tlb_pg_hits[i] << " tlb hits\n";
+    }
+    if(globals::tlb_accesses) {
       std::cout << "tlb_accesses = " << globals::tlb_accesses << "\n";
-      std::cout << "tlb_hits     = " << globals::tlb_hits << "\n";
+      std::cout << "tlb_hits     = " << globals::tlb_hits << " ("
+		<< (100.0 * globals::tlb_hits) / globals::tlb_accesses
+		<< "% hit rate)\n";
+    }
+    if(globals::pwc_accesses) {
+      std::cout << "pte reads by level :";
+      for(int i = 4; i >= 0; i--) {
+	std::cout << " " << globals::pte_reads[i];
+      }
+      std::cout << "\n";
+      std::cout << "pwc_hits     = " << globals::pwc_hits << " ("
+		<< (100.0 * globals::pwc_hits) / globals::pwc_accesses
+		<< "% of " << globals::pwc_accesses << " walks)\n";
     }
   }
 
@@ -412,7 +535,7 @@ int main(int argc, char *argv[]) {
   //   close(fd);
   // }
   
-  munmap(mempt, 1UL<<32);
+  munmap(s->mem, globals::phys_mem_size);
   if(globals::sysArgv) {
     for(int i = 0; i < globals::sysArgc; i++) {
       delete [] globals::sysArgv[i];
@@ -452,9 +575,53 @@ int main(int argc, char *argv[]) {
 	      << mpki << " mpki\n";
     delete s->dtlb;
   }
+  if(s->pdc) {
+    if(not(globals::silent)) {
+      std::cout << "predecode: " << s->pdc->get_fills() << " page fills, "
+		<< s->pdc->get_decodes() << " decodes, "
+		<< s->pdc->get_invalidations() << " invalidations, "
+		<< s->pdc->get_flushes() << " flushes\n";
+      static const char *fused_names[pd_num_fused] = {
+	"lui+addi", "lui+addiw", "auipc+addi",
+	"auipc+jalr", "auipc+ld", "slli+srli"
+      };
+      uint64_t fused = 0;
+      std::cout << "fused pairs:";
+      for(int i = 0; i < pd_num_fused; i++) {
+	uint64_t c = s->pdc->get_fused(pd_lui_addi + i);
+	std::cout << " " << fused_names[i] << " " << c;
+	fused += c;
+      }
+      std::cout << ", " << (200.0 * fused) / (s->icnt - init_icnt)
+		<< "% of insns\n";
+      std::cout << "loops: " << s->pdc->get_loop_runs() << " bulk runs, "
+		<< s->pdc->get_loop_insns() << " insns\n";
+      std::cout << "spins: " << s->pdc->get_spin_runs() << " skips, "
+		<< s->pdc->get_spin_insns() << " insns\n";
+    }
+    delete s->pdc;
+  }
+  if(s->aot) {
+    if(not(globals::silent)) {
+      std::cout << "aot: " << s->aot->get_blocks() << " blocks, "
+		<< s->aot->get_runs() << " runs, "
+		<< s->aot->get_mismatches() << " mismatches\n";
+    }
+    delete s->aot;
+  }
+  if(s->jit) {
+    if(not(globals::silent)) {
+      std::cout << "jit: " << s->jit->get_translations() << " blocks, "
+		<< s->jit->get_translated_insns() << " insns, "
+		<< s->jit->get_code_bytes() << " code bytes, "
+		<< s->jit->get_code_flushes() << " flushes\n";
+    }
+    delete s->jit;
+  }
   if(s->vio) {
     delete s->vio;
   }
+  delete s->mmio;
 
   free(s);
   stopCapstone();
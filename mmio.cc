@@ -0,0 +1,63 @@
+#include <cassert>
+#include "mmio.hh"
+
+mmio_map::mmio_map(uint64_t mem_size) :
+  pages(((mem_size >> lg_pg_sz) + 63) / 64, 0) {}
+
+void mmio_map::mark(uint64_t ppn) {
+  assert((ppn >> 6) < pages.size());
+  pages[ppn >> 6] |= 1UL << (ppn & 63);
+}
+
+void mmio_map::add(uint64_t base, uint64_t size, read_fn rd, write_fn wr) {
+  const uint64_t pg_mask = (1UL << lg_pg_sz) - 1;
+  assert(((base & pg_mask) == 0) and ((size & pg_mask) == 0));
+  for(uint64_t ppn = base >> lg_pg_sz; ppn < ((base + size) >> lg_pg_sz); ppn++) {
+    mark(ppn);
+  }
+  regions.push_back({base, size, rd, wr});
+}
+
+void mmio_map::watch(uint64_t pa, write_fn wr) {
+  assert((pa & 7) == 0);
+  mark(pa >> lg_pg_sz);
+  watches.push_back({pa, wr});
+}
+
+void mmio_map::stored(uint64_t pa, int sz, const uint8_t *mem) {
+  for(const watch_word &w : watches) {
+    if((pa < (w.pa + 8)) and (w.pa < (pa + sz))) {
+      w.wr(w.pa, *reinterpret_cast<const int64_t*>(mem + w.pa));
+    }
+  }
+}
+
+bool mmio_map::overlaps(uint64_t base, uint64_t size) const {
+  for(const region &r : regions) {
+    if((r.base < (base + size)) and (base < (r.base + r.size))) {
+      return true;
+    }
+  }
+  for(const watch_word &w : watches) {
+    if((w.pa - base) < size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool mmio_map::access(uint64_t pa, bool store, int64_t x) {
+  for(const region &r : regions) {
+    if((pa - r.base) >= r.size) {
+      continue;
+    }
+    if(store and r.wr) {
+      r.wr(pa, x);
+    }
+    else if(not(store) and r.rd) {
+      r.rd(pa);
+    }
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,58 @@
+#ifndef __MMIO_HH__
+#define __MMIO_HH__
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/* registry of memory mapped devices. a device claims a physical
+ * range and is called for the loads and stores that touch it. a
+ * bitmap over 4KB physical pages marks the pages a device owns, so a
+ * ram access costs one bit test here (and none when the tlb hands
+ * out a host pointer for the page). device registers are backed by
+ * guest memory: the read callback runs before the load reads the
+ * backing bytes and can fill them in, the write callback gets the
+ * value before it lands in memory */
+class mmio_map {
+public:
+  typedef std::function<void(uint64_t pa)> read_fn;
+  typedef std::function<void(uint64_t pa, int64_t x)> write_fn;
+private:
+  static const uint64_t lg_pg_sz = 12;
+  struct region {
+    uint64_t base;
+    uint64_t size;
+    read_fn rd;
+    write_fn wr;
+  };
+  struct watch_word {
+    uint64_t pa;
+    write_fn wr;
+  };
+  std::vector<region> regions;
+  std::vector<watch_word> watches;
+  std::vector<uint64_t> pages;
+  void mark(uint64_t ppn);
+public:
+  mmio_map(uint64_t mem_size);
+  /* either callback may be empty. ranges are page granular */
+  void add(uint64_t base, uint64_t size, read_fn rd, write_fn wr);
+  bool is_device(uint64_t pa) const {
+    uint64_t ppn = pa >> lg_pg_sz;
+    return ((ppn >> 6) < pages.size()) and ((pages[ppn >> 6] >> (ppn & 63)) & 1);
+  }
+  /* true when any device or watched word lies in [base, base + size) */
+  bool overlaps(uint64_t base, uint64_t size) const;
+  /* pa is on a device page: runs the callback of the device that
+   * owns it, false when no device covers pa */
+  bool access(uint64_t pa, bool store, int64_t x);
+  /* the 8 byte word of ram at pa stays ram, but its page is marked
+   * like a device page so every store to it takes the slow path.
+   * wr runs after a store that touches the word has landed and gets
+   * the whole word */
+  void watch(uint64_t pa, write_fn wr);
+  /* a store of sz bytes to pa on a device page has landed */
+  void stored(uint64_t pa, int sz, const uint8_t *mem);
+};
+
+#endif
@@ -0,0 +1,578 @@
+#include <cassert>
+#include "predecode.hh"
+#include "rvc.hh"
+
+static inline int64_t sext12(uint32_t inst) {
+  return static_cast<int64_t>(static_cast<int32_t>(inst) >> 20);
+}
+
+void predecode(pd_insn &d, uint32_t inst) {
+  uint32_t opcode = inst & 127;
+  uint32_t sel = (inst >> 12) & 7;
+  uint32_t special = inst >> 25;
+  d.inst = inst;
+  d.rd = (inst >> 7) & 31;
+  d.rs1 = (inst >> 15) & 31;
+  d.rs2 = (inst >> 20) & 31;
+  d.imm = 0;
+  d.op = pd_slow;
+
+  switch(opcode)
+    {
+    case 0x3: {
+      static const pd_op ops[8] = {pd_lb, pd_lh, pd_lw, pd_ld,
+				   pd_lbu, pd_lhu, pd_lwu, pd_slow};
+      d.imm = sext12(inst);
+      d.op = ops[sel];
+      break;
+    }
+    case 0x23: {
+      static const pd_op ops[8] = {pd_sb, pd_sh, pd_sw, pd_sd,
+				   pd_slow, pd_slow, pd_slow, pd_slow};
+      int32_t disp = ((inst >> 7) & 31) | ((inst >> 25) << 5);
+      d.imm = (static_cast<int64_t>(disp) << 52) >> 52;
+      d.op = ops[sel];
+      break;
+    }
+    case 0x13:
+      if(d.rd == 0) {
+	d.op = pd_nop;
+	break;
+      }
+      d.imm = sext12(inst);
+      switch(sel)
+	{
+	case 0:
+	  d.op = pd_addi;
+	  break;
+	case 1: {
+	  static const pd_op unary[8] = {pd_clz, pd_ctz, pd_cpop, pd_slow,
+					 pd_sextb, pd_sexth, pd_slow, pd_slow};
+	  uint32_t funct6 = inst >> 26;
+	  d.imm = (inst >> 20) & 63;
+	  if(funct6 == 0) {
+	    d.op = pd_slli;
+	  }
+	  else if(funct6 == 0x0a) {
+	    d.op = pd_bseti;
+	  }
+	  else if(funct6 == 0x12) {
+	    d.op = pd_bclri;
+	  }
+	  else if(funct6 == 0x1a) {
+	    d.op = pd_binvi;
+	  }
+	  else if((inst >> 23) == 0xc0) {
+	    d.op = unary[(inst >> 20) & 7];
+	  }
+	  break;
+	}
+	case 2:
+	  d.op = pd_slti;
+	  break;
+	case 3:
+	  d.op = pd_sltiu;
+	  break;
+	case 4:
+	  d.op = pd_xori;
+	  break;
+	case 5:
+	  if((inst >> 26) == 0) {
+	    d.op = pd_srli;
+	  }
+	  else if((inst >> 26) == 16) {
+	    d.op = pd_srai;
+	  }
+	  else if((inst >> 26) == 0x12) {
+	    d.op = pd_bexti;
+	  }
+	  else if((inst >> 26) == 0x18) {
+	    d.op = pd_rori;
+	  }
+	  else if((inst >> 20) == 0x287) {
+	    d.op = pd_orcb;
+	  }
+	  else if((inst >> 20) == 0x6b8) {
+	    d.op = pd_rev8;
+	  }
+	  d.imm = (inst >> 20) & 63;
+	  break;
+	case 6:
+	  d.op = pd_ori;
+	  break;
+	case 7:
+	  d.op = pd_andi;
+	  break;
+	}
+      break;
+    case 0x1b:
+      if(d.rd == 0) {
+	d.op = pd_nop;
+	break;
+      }
+      if(sel == 0) {
+	d.op = pd_addiw;
+	d.imm = sext12(inst);
+      }
+      else if(sel == 1 and ((inst >> 26) == 0)) {
+	d.op = pd_slliw;
+	d.imm = (inst >> 20) & 31;
+      }
+      else if(sel == 1 and ((inst >> 26) == 2)) {
+	d.op = pd_slliuw;
+	d.imm = (inst >> 20) & 63;
+      }
+      else if(sel == 1 and ((inst >> 20) >= 0x600) and ((inst >> 20) <= 0x602)) {
+	static const pd_op ops[3] = {pd_clzw, pd_ctzw, pd_cpopw};
+	d.op = ops[(inst >> 20) & 3];
+      }
+      else if(sel == 5 and (special == 0)) {
+	d.op = pd_srliw;
+	d.imm = (inst >> 20) & 31;
+      }
+      else if(sel == 5 and (special == 32)) {
+	d.op = pd_sraiw;
+	d.imm = (inst >> 20) & 31;
+      }
+      else if(sel == 5 and (special == 0x30)) {
+	d.op = pd_roriw;
+	d.imm = (inst >> 20) & 31;
+      }
+      break;
+    case 0x33:
+      if(d.rd == 0) {
+	d.op = pd_nop;
+	break;
+      }
+      if(special == 0) {
+	static const pd_op ops[8] = {pd_add, pd_sll, pd_slt, pd_sltu,
+				     pd_xor, pd_srl, pd_or, pd_and};
+	d.op = ops[sel];
+      }
+      else if(special == 1) {
+	static const pd_op ops[8] = {pd_mul, pd_mulh, pd_slow, pd_mulhu,
+				     pd_div, pd_divu, pd_rem, pd_remu};
+	d.op = ops[sel];
+      }
+      else if(special == 32) {
+	static const pd_op ops[8] = {pd_sub, pd_slow, pd_slow, pd_slow,
+				     pd_xnor, pd_sra, pd_orn, pd_andn};
+	d.op = ops[sel];
+      }
+      else if(special == 5) {
+	static const pd_op ops[8] = {pd_slow, pd_clmul, pd_clmulr, pd_clmulh,
+				     pd_min, pd_minu, pd_max, pd_maxu};
+	d.op = ops[sel];
+      }
+      else if(special == 0x10 and (sel & 1) == 0 and sel != 0) {
+	static const pd_op ops[3] = {pd_sh1add, pd_sh2add, pd_sh3add};
+	d.op = ops[(sel >> 1) - 1];
+      }
+      else if(special == 0x30 and sel == 1) {
+	d.op = pd_rol;
+      }
+      else if(special == 0x30 and sel == 5) {
+	d.op = pd_ror;
+      }
+      else if(special == 0x14 and sel == 1) {
+	d.op = pd_bset;
+      }
+      else if(special == 0x24 and sel == 1) {
+	d.op = pd_bclr;
+      }
+      else if(special == 0x24 and sel == 5) {
+	d.op = pd_bext;
+      }
+      else if(special == 0x34 and sel == 1) {
+	d.op = pd_binv;
+      }
+      break;
+    case 0x3b:
+      if(d.rd == 0) {
+	d.op = pd_nop;
+	break;
+      }
+      if(special == 0) {
+	static const pd_op ops[8] = {pd_addw, pd_sllw, pd_slow, pd_slow,
+				     pd_slow, pd_srlw, pd_slow, pd_slow};
+	d.op = ops[sel];
+      }
+      else if(special == 1) {
+	static const pd_op ops[8] = {pd_mulw, pd_slow, pd_slow, pd_slow,
+				     pd_divw, pd_divuw, pd_remw, pd_remuw};
+	d.op = ops[sel];
+      }
+      else if(special == 32 and sel == 0) {
+	d.op = pd_subw;
+      }
+      else if(special == 32 and sel == 5) {
+	d.op = pd_sraw;
+      }
+      else if(special == 4 and sel == 0) {
+	d.op = pd_adduw;
+      }
+      else if(special == 4 and sel == 4 and d.rs2 == 0) {
+	d.op = pd_zexth;
+      }
+      else if(special == 0x10 and (sel & 1) == 0 and sel != 0) {
+	static const pd_op ops[3] = {pd_sh1adduw, pd_sh2adduw, pd_sh3adduw};
+	d.op = ops[(sel >> 1) - 1];
+      }
+      else if(special == 0x30 and sel == 1) {
+	d.op = pd_rolw;
+      }
+      else if(special == 0x30 and sel == 5) {
+	d.op = pd_rorw;
+      }
+      break;
+    case 0x37:
+      d.op = (d.rd == 0) ? pd_nop : pd_lui;
+      d.imm = static_cast<int32_t>(inst & 0xfffff000);
+      break;
+    case 0x17:
+      d.op = (d.rd == 0) ? pd_nop : pd_auipc;
+      d.imm = static_cast<int32_t>(inst & 0xfffff000);
+      break;
+    case 0x6f: {
+      int32_t jaddr32 =
+	(((inst >> 21) & 1023) << 1) |
+	(((inst >> 20) & 1) << 11)   |
+	(((inst >> 12) & 255) << 12) |
+	((inst >> 31) << 20);
+      d.imm = (static_cast<int64_t>(jaddr32) << 43) >> 43;
+      d.op = pd_jal;
+      break;
+    }
+    case 0x67:
+      d.imm = sext12(inst);
+      d.op = pd_jalr;
+      break;
+    case 0x63: {
+      static const pd_op ops[8] = {pd_beq, pd_bne, pd_slow, pd_slow,
+				   pd_blt, pd_bge, pd_bltu, pd_bgeu};
+      int32_t disp32 =
+	(((inst >> 8) & 15) << 1)  |
+	(((inst >> 25) & 63) << 5) |
+	(((inst >> 7) & 1) << 11)  |
+	((inst >> 31) << 12);
+      d.imm = (static_cast<int64_t>(disp32) << 51) >> 51;
+      d.op = ops[sel];
+      break;
+    }
+    default:
+      break;
+    }
+}
+
+pd_cache::pd_cache(uint64_t mem_size) :
+  code_pages(((mem_size >> lg_pg_sz) + 63) / 64, 0),
+  fills(0), decodes(0), invalidations(0), flushes(0),
+  loop_runs(0), loop_insns(0), spin_runs(0), spin_insns(0), next_gen(0) {
+  memset(pages, 0, sizeof(pages));
+  memset(fused, 0, sizeof(fused));
+}
+
+pd_cache::~pd_cache() {
+  for(size_t i = 0; i < (1UL<<lg_n_pages); i++) {
+    delete pages[i];
+  }
+}
+
+pd_cache::pd_page *pd_cache::fill(uint64_t ppn) {
+  pd_page *&p = pages[ppn & ((1UL<<lg_n_pages)-1)];
+  if(p == nullptr) {
+    p = new pd_page;
+  }
+  else if(p->ppn != invalid_ppn) {
+    set_code_page(p->ppn, false);
+  }
+  p->ppn = ppn;
+  p->gen = ++next_gen;
+  memset(p->insns, 0, sizeof(p->insns));
+  p->insns[pg_insns].op = pd_page_end;
+  set_code_page(ppn, true);
+  ++fills;
+  return p;
+}
+
+void pd_cache::decode_parcel(pd_insn &d, uint64_t pa, const uint8_t *mem) {
+  static const uint64_t pg_mask = (1UL<<lg_pg_sz)-1;
+  uint16_t parcel = *reinterpret_cast<const uint16_t*>(mem + pa);
+  if((parcel & 3) != 3) {
+    predecode(d, rvc_expand(parcel));
+    d.len = 2;
+  }
+  else if((pa & pg_mask) == (pg_mask - 1)) {
+    /* the upper half is on the next page, execRiscv_ fetches it */
+    predecode(d, parcel);
+    d.op = pd_slow;
+    d.len = 4;
+  }
+  else {
+    predecode(d, *reinterpret_cast<const uint32_t*>(mem + pa));
+    d.len = 4;
+  }
+  ++decodes;
+}
+
+/* the fused op for first followed by second, or first's own op */
+static uint8_t fuse(const pd_insn &first, const pd_insn &second) {
+  const bool same_rd = (second.rs1 == first.rd) and (second.rd == first.rd);
+  switch(first.op)
+    {
+    case pd_lui:
+      if(same_rd and (second.op == pd_addi)) {
+	return pd_lui_addi;
+      }
+      if(same_rd and (second.op == pd_addiw)) {
+	return pd_lui_addiw;
+      }
+      break;
+    case pd_auipc:
+      if(same_rd and (second.op == pd_addi)) {
+	return pd_auipc_addi;
+      }
+      /* the block executor goes straight on to the 32b handler */
+      if((second.rs1 == first.rd) and (second.len == 4) and (second.op == pd_jalr)) {
+	return pd_auipc_jalr;
+      }
+      if((second.rs1 == first.rd) and (second.len == 4) and (second.op == pd_ld)) {
+	return pd_auipc_ld;
+      }
+      break;
+    case pd_slli:
+      if(same_rd and (second.op == pd_srli)) {
+	return pd_slli_srli;
+      }
+      break;
+    default:
+      break;
+    }
+  return first.op;
+}
+
+static bool is_load(uint8_t op) {
+  return (op >= pd_lb) and (op <= pd_lwu);
+}
+
+static bool is_store(uint8_t op) {
+  return (op >= pd_sb) and (op <= pd_sd);
+}
+
+bool match_loop(const pd_insn *br, pd_loop &l) {
+  const pd_insn *d = br + (br->imm >> 1);
+  uint32_t written = 0, bumped = 0;
+  int64_t bump[32];
+  memset(&l, 0, sizeof(l));
+  l.n_insns = 1;
+  for(; d < br; d += d->len >> 1) {
+    if((d->op == pd_undecoded) or (++l.n_insns > pd_loop::max_insns)) {
+      return false;
+    }
+    if((d->op == pd_addi) and (d->rd != 0) and (d->rd == d->rs1)) {
+      if(((bumped >> d->rd) & 1) or (l.n_ptrs == 2)) {
+	return false;
+      }
+      bumped |= 1U << d->rd;
+      written |= 1U << d->rd;
+      bump[d->rd] = d->imm;
+      l.ptr[l.n_ptrs++] = d->rd;
+      continue;
+    }
+    /* accesses are relative to the pointer as it was at the branch */
+    if(is_load(d->op) and (l.ld == nullptr) and (l.st == nullptr) and
+       (d->rd != 0) and (d->rd != d->rs1)) {
+      l.ld = d;
+      l.ld_off = d->imm + (((bumped >> d->rs1) & 1) ? bump[d->rs1] : 0);
+      written |= 1U << d->rd;
+      continue;
+    }
+    if(is_store(d->op) and (l.st == nullptr) and (d->rs2 != d->rs1)) {
+      l.st = d;
+      l.st_off = d->imm + (((bumped >> d->rs1) & 1) ? bump[d->rs1] : 0);
+      continue;
+    }
+    return false;
+  }
+  if((d != br) or ((l.ld == nullptr) and (l.st == nullptr))) {
+    return false;
+  }
+  /* every access walks up through its own pointer, one element an
+   * iteration, and the stored value is loop invariant or just loaded */
+  const pd_insn *m[2] = {l.ld, l.st};
+  for(const pd_insn *a : m) {
+    if(a == nullptr) {
+      continue;
+    }
+    int64_t sz = 1L << ((a->inst >> 12) & 3);
+    if((((bumped >> a->rs1) & 1) == 0) or (bump[a->rs1] != sz) or
+       (l.stride and (l.stride != sz))) {
+      return false;
+    }
+    l.stride = sz;
+  }
+  if(l.ld and l.st) {
+    if((l.ld->rs1 == l.st->rs1) or (l.st->rs2 != l.ld->rd)) {
+      return false;
+    }
+  }
+  else if(l.st and ((written >> l.st->rs2) & 1)) {
+    return false;
+  }
+  if(l.ld and ((bumped >> l.ld->rd) & 1)) {
+    return false;
+  }
+  for(int i = 0; i < l.n_ptrs; i++) {
+    bool used = (l.ld and (l.ld->rs1 == l.ptr[i])) or
+      (l.st and (l.st->rs1 == l.ptr[i]));
+    if(not(used)) {
+      return false;
+    }
+  }
+  /* pointer against an invariant, or bnez on the loaded value */
+  if(l.ld and (br->op == pd_bne) and
+     (((br->rs1 == l.ld->rd) and (br->rs2 == 0)) or
+      ((br->rs2 == l.ld->rd) and (br->rs1 == 0)))) {
+    l.cmp_ptr = 0;
+    return true;
+  }
+  if(((bumped >> br->rs1) & 1) and (((written >> br->rs2) & 1) == 0)) {
+    l.cmp_ptr = br->rs1;
+    l.cmp_reg = br->rs2;
+    return true;
+  }
+  if((br->op == pd_bne) and ((bumped >> br->rs2) & 1) and
+     (((written >> br->rs1) & 1) == 0)) {
+    l.cmp_ptr = br->rs2;
+    l.cmp_reg = br->rs1;
+    return true;
+  }
+  return false;
+}
+
+static bool is_lr(uint32_t inst) {
+  return ((inst & 0xf9f0707f) == 0x1000202f) or ((inst & 0xf9f0707f) == 0x1000302f);
+}
+
+/* pause, wrs.nto and wrs.sto */
+static bool is_spin_hint(uint32_t inst) {
+  return (inst == 0x0100000f) or (inst == 0x00d00073) or (inst == 0x01d00073);
+}
+
+bool match_spin(const pd_insn *br, pd_spin &l) {
+  const pd_insn *d = br + (br->imm >> 1);
+  uint32_t written = 0, live_in = 0;
+  l.n_lds = 0;
+  l.n_insns = 1;
+  for(; d < br; d += d->len >> 1) {
+    if((d->op == pd_undecoded) or (++l.n_insns > pd_spin::max_insns)) {
+      return false;
+    }
+    const uint8_t op = pd_unfused(d->op);
+    uint32_t src = 0, dst = 0;
+    if(is_load(op) or ((op == pd_slow) and is_lr(d->inst))) {
+      l.ld[l.n_lds++] = d;
+      src = 1U << d->rs1;
+      dst = 1U << d->rd;
+    }
+    else if((op == pd_lui) or (op == pd_auipc)) {
+      dst = 1U << d->rd;
+    }
+    else if((op >= pd_addi) and (op <= pd_rev8)) {
+      src = 1U << d->rs1;
+      dst = 1U << d->rd;
+    }
+    else if((op >= pd_add) and (op <= pd_clmulr)) {
+      src = (1U << d->rs1) | (1U << d->rs2);
+      dst = 1U << d->rd;
+    }
+    else if(not((op == pd_nop) or ((op == pd_slow) and is_spin_hint(d->inst)))) {
+      return false;
+    }
+    dst &= ~1U;
+    if(dst & written) {
+      return false;
+    }
+    live_in |= src & ~written;
+    written |= dst;
+  }
+  return (d == br) and (l.n_lds != 0) and ((live_in & written) == 0);
+}
+
+void pd_cache::decode(pd_insn &d, uint64_t pa, const uint8_t *mem) {
+  static const uint64_t pg_mask = (1UL<<lg_pg_sz)-1;
+  decode_parcel(d, pa, mem);
+  /* a short backward branch on the same page, the body has run by
+   * now so its entries are usually decoded */
+  if((d.op >= pd_beq) and (d.op <= pd_bgeu) and (d.imm < 0) and
+     (d.imm >= -4*pd_loop::max_insns) and
+     (static_cast<int64_t>(pa & pg_mask) + d.imm >= 0)) {
+    pd_loop l;
+    pd_spin sp;
+    if(((d.op == pd_bne) or (d.op == pd_bltu)) and match_loop(&d, l)) {
+      d.op = (d.op == pd_bne) ? pd_bne_loop : pd_bltu_loop;
+    }
+    else if(match_spin(&d, sp)) {
+      d.op = d.op - pd_beq + pd_beq_spin;
+    }
+    return;
+  }
+  if(((d.op != pd_lui) and (d.op != pd_auipc) and (d.op != pd_slli)) or
+     (d.rd == 0) or (((pa & pg_mask) + d.len) > pg_mask)) {
+    return;
+  }
+  /* d is in its page's insns array, so is the entry that follows */
+  pd_insn &n = (&d)[d.len >> 1];
+  if(n.op != pd_undecoded) {
+    d.op = fuse(d, n);
+    return;
+  }
+  /* only keep the decode of the next instruction if it pairs up,
+   * otherwise it gets its own chance to start a pair */
+  pd_insn t;
+  decode_parcel(t, pa + d.len, mem);
+  uint8_t op = fuse(d, t);
+  if(op != d.op) {
+    n = t;
+    d.op = op;
+  }
+}
+
+void pd_cache::invalidate(uint64_t pa, int sz) {
+  for(uint64_t a = pa & (~1UL); a < (pa + sz); a += 2) {
+    if(not(is_code(a))) {
+      continue;
+    }
+    uint64_t ppn = a >> lg_pg_sz;
+    pd_page *p = pages[ppn & ((1UL<<lg_n_pages)-1)];
+    uint64_t i = (a >> 1) & (pg_insns-1);
+    assert(p and (p->ppn == ppn));
+    p->insns[i].op = pd_undecoded;
+    /* a 32b instruction starting at the previous parcel, and the
+     * first instruction of a fused pair whose second one covers a.
+     * a pair spans at most four parcels */
+    for(uint64_t j = 1; (j <= 3) and (j <= i); j++) {
+      p->insns[i-j].op = pd_undecoded;
+    }
+    /* a loop or spin branch further on matched the old body */
+    for(uint64_t j = i + 1; (j < pg_insns) and (j <= i + 2*pd_loop::max_insns); j++) {
+      if((p->insns[j].op == pd_bne_loop) or (p->insns[j].op == pd_bltu_loop) or
+	 ((p->insns[j].op >= pd_beq_spin) and (p->insns[j].op <= pd_bgeu_spin))) {
+	p->insns[j].op = pd_undecoded;
+      }
+    }
+    p->gen = ++next_gen;
+    ++invalidations;
+  }
+}
+
+void pd_cache::flush() {
+  for(size_t i = 0; i < (1UL<<lg_n_pages); i++) {
+    pd_page *p = pages[i];
+    if(p and (p->ppn != invalid_ppn)) {
+      set_code_page(p->ppn, false);
+      p->ppn = invalid_ppn;
+    }
+  }
+  ++flushes;
+}
@@ -0,0 +1,321 @@
+#ifndef __PREDECODE_HH__
+#define __PREDECODE_HH__
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/* handlers with a fast path in execRiscv_, anything
+ * decoded as pd_slow goes through the big opcode switch */
+enum pd_op : uint8_t {
+  pd_undecoded = 0,
+  pd_slow,
+  pd_nop,
+  pd_lui,
+  pd_auipc,
+  pd_jal,
+  pd_jalr,
+  pd_beq,
+  pd_bne,
+  pd_blt,
+  pd_bge,
+  pd_bltu,
+  pd_bgeu,
+  pd_lb,
+  pd_lh,
+  pd_lw,
+  pd_ld,
+  pd_lbu,
+  pd_lhu,
+  pd_lwu,
+  pd_sb,
+  pd_sh,
+  pd_sw,
+  pd_sd,
+  pd_addi,
+  pd_slti,
+  pd_sltiu,
+  pd_xori,
+  pd_ori,
+  pd_andi,
+  pd_slli,
+  pd_srli,
+  pd_srai,
+  pd_addiw,
+  pd_slliw,
+  pd_srliw,
+  pd_sraiw,
+  /* zba/zbb/zbs ops on rs1 alone, imm is the shift or bit */
+  pd_slliuw,
+  pd_bseti,
+  pd_bclri,
+  pd_binvi,
+  pd_bexti,
+  pd_rori,
+  pd_roriw,
+  pd_clz,
+  pd_ctz,
+  pd_cpop,
+  pd_clzw,
+  pd_ctzw,
+  pd_cpopw,
+  pd_sextb,
+  pd_sexth,
+  pd_zexth,
+  pd_orcb,
+  pd_rev8,
+  pd_add,
+  pd_sub,
+  pd_sll,
+  pd_slt,
+  pd_sltu,
+  pd_xor,
+  pd_srl,
+  pd_sra,
+  pd_or,
+  pd_and,
+  pd_addw,
+  pd_subw,
+  pd_sllw,
+  pd_srlw,
+  pd_sraw,
+  pd_mul,
+  pd_mulh,
+  pd_mulhu,
+  pd_div,
+  pd_divu,
+  pd_rem,
+  pd_remu,
+  pd_mulw,
+  pd_divw,
+  pd_divuw,
+  pd_remw,
+  pd_remuw,
+  pd_sh1add,
+  pd_sh2add,
+  pd_sh3add,
+  pd_adduw,
+  pd_sh1adduw,
+  pd_sh2adduw,
+  pd_sh3adduw,
+  pd_andn,
+  pd_orn,
+  pd_xnor,
+  pd_min,
+  pd_minu,
+  pd_max,
+  pd_maxu,
+  pd_rol,
+  pd_ror,
+  pd_rolw,
+  pd_rorw,
+  pd_bset,
+  pd_bclr,
+  pd_binv,
+  pd_bext,
+  pd_clmul,
+  pd_clmulh,
+  pd_clmulr,
+  /* sentinel after the last parcel of a page, ends a block */
+  pd_page_end,
+  /* fused pairs, decoded for the first instruction of an idiom when
+   * the second one follows on the same page. the second keeps its own
+   * entry. only the block executor runs the pair as one, everything
+   * else runs the first instruction alone, see pd_unfused() */
+  pd_lui_addi,
+  pd_lui_addiw,
+  pd_auipc_addi,
+  pd_auipc_jalr,
+  pd_auipc_ld,
+  pd_slli_srli,
+  /* bne and bltu closing a store, copy or scan loop, see match_loop().
+   * only the block executor runs iterations in bulk */
+  pd_bne_loop,
+  pd_bltu_loop,
+  /* branches closing a loop that only loads and computes registers,
+   * see match_spin(). in the order of pd_beq..pd_bgeu */
+  pd_beq_spin,
+  pd_bne_spin,
+  pd_blt_spin,
+  pd_bge_spin,
+  pd_bltu_spin,
+  pd_bgeu_spin,
+  pd_num_ops
+};
+
+static const int pd_num_fused = pd_bne_loop - pd_lui_addi;
+
+static inline uint8_t pd_unfused(uint8_t op) {
+  switch(op)
+    {
+    case pd_lui_addi:
+    case pd_lui_addiw:
+      return pd_lui;
+    case pd_auipc_addi:
+    case pd_auipc_jalr:
+    case pd_auipc_ld:
+      return pd_auipc;
+    case pd_slli_srli:
+      return pd_slli;
+    case pd_bne_loop:
+      return pd_bne;
+    case pd_bltu_loop:
+      return pd_bltu;
+    default:
+      if((op >= pd_beq_spin) and (op <= pd_bgeu_spin)) {
+	return op - pd_beq_spin + pd_beq;
+      }
+      return op;
+    }
+}
+
+struct pd_insn {
+  int32_t imm; /* sign-extended immediate or shift amount */
+  uint32_t inst; /* compressed instructions are expanded */
+  uint8_t op;
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;
+  uint8_t len; /* 2 or 4 bytes */
+};
+
+void predecode(pd_insn &d, uint32_t inst);
+
+/* a loop of at most max_insns instructions closed by a backward bne or
+ * bltu on the same page. the body bumps one or two pointers by the
+ * access size and does a store, a load or a load then store through
+ * them. the branch compares a pointer against a register the body
+ * leaves alone, or (bne) the loaded value against x0. offsets are from
+ * the pointer values at the branch */
+struct pd_loop {
+  static const int max_insns = 8;
+  const pd_insn *ld, *st;
+  int64_t ld_off, st_off;
+  uint8_t ptr[2], n_ptrs;
+  uint8_t cmp_ptr, cmp_reg; /* cmp_ptr is 0 for a scan loop */
+  int64_t stride;
+  uint64_t n_insns; /* body and branch */
+};
+/* br is the branch entry in its page's insns array */
+bool match_loop(const pd_insn *br, pd_loop &l);
+
+/* a spin loop of at most max_insns instructions closed by a backward
+ * branch on the same page. the body is loads, lr, integer ops, pause
+ * and wrs, with at least one load or lr. no register is read before
+ * the body writes it and also written, and none is written twice, so
+ * once an iteration has run from the top every further one computes
+ * the same values until memory changes */
+struct pd_spin {
+  static const int max_insns = 8;
+  const pd_insn *ld[max_insns]; /* loads and lrs */
+  int n_lds;
+  uint64_t n_insns; /* body and branch */
+};
+bool match_spin(const pd_insn *br, pd_spin &l);
+
+/* predecoded instructions, one entry per 16b parcel of a
+ * physical page. pages are direct mapped by physical
+ * page number. a bitmap over physical memory records which
+ * pages currently hold predecoded instructions so stores
+ * can cheaply find out if they modify code */
+class pd_cache {
+  static const uint64_t lg_pg_sz = 12;
+  static const uint64_t pg_insns = (1UL<<lg_pg_sz) / sizeof(uint16_t);
+  static const uint64_t lg_n_pages = 10;
+  static const uint64_t invalid_ppn = ~0UL;
+  struct pd_page {
+    uint64_t ppn;
+    uint64_t gen;
+    pd_insn insns[pg_insns+1];
+  };
+  pd_page *pages[1UL<<lg_n_pages];
+  std::vector<uint64_t> code_pages;
+  uint64_t fills, decodes, invalidations, flushes;
+  uint64_t fused[pd_num_fused];
+  uint64_t loop_runs, loop_insns;
+  uint64_t spin_runs, spin_insns;
+  uint64_t next_gen;
+
+  void set_code_page(uint64_t ppn, bool v) {
+    uint64_t b = 1UL << (ppn & 63);
+    if(v)
+      code_pages[ppn >> 6] |= b;
+    else
+      code_pages[ppn >> 6] &= ~b;
+  }
+  pd_page *fill(uint64_t ppn);
+  void decode_parcel(pd_insn &d, uint64_t pa, const uint8_t *mem);
+  void decode(pd_insn &d, uint64_t pa, const uint8_t *mem);
+public:
+  pd_cache(uint64_t mem_size);
+  ~pd_cache();
+  pd_insn *lookup(uint64_t pa, const uint8_t *mem) {
+    uint64_t ppn = pa >> lg_pg_sz;
+    pd_page *p = pages[ppn & ((1UL<<lg_n_pages)-1)];
+    if(p == nullptr or p->ppn != ppn) {
+      p = fill(ppn);
+    }
+    pd_insn *d = &p->insns[(pa >> 1) & (pg_insns-1)];
+    if(d->op == pd_undecoded) {
+      decode(*d, pa, mem);
+    }
+    return d;
+  }
+  /* changes whenever the predecoded contents of the page holding
+   * pa are refilled or invalidated, 0 if the page is not cached */
+  uint64_t get_gen(uint64_t pa) const {
+    uint64_t ppn = pa >> lg_pg_sz;
+    const pd_page *p = pages[ppn & ((1UL<<lg_n_pages)-1)];
+    return (p and (p->ppn == ppn)) ? p->gen : 0;
+  }
+  bool is_code(uint64_t pa) const {
+    uint64_t ppn = pa >> lg_pg_sz;
+    return (code_pages[ppn >> 6] >> (ppn & 63)) & 1;
+  }
+  /* a store of sz bytes to pa hit a code page */
+  void invalidate(uint64_t pa, int sz);
+  void flush();
+  uint64_t get_fills() const {
+    return fills;
+  }
+  uint64_t get_decodes() const {
+    return decodes;
+  }
+  uint64_t get_invalidations() const {
+    return invalidations;
+  }
+  uint64_t get_flushes() const {
+    return flushes;
+  }
+  /* a fused pair ran as one */
+  void count_fused(uint8_t op) {
+    ++fused[op - pd_lui_addi];
+  }
+  uint64_t get_fused(uint8_t op) const {
+    return fused[op - pd_lui_addi];
+  }
+  /* insns loop iterations ran in bulk */
+  void count_loop(uint64_t insns) {
+    ++loop_runs;
+    loop_insns += insns;
+  }
+  uint64_t get_loop_runs() const {
+    return loop_runs;
+  }
+  uint64_t get_loop_insns() const {
+    return loop_insns;
+  }
+  /* insns of a spin loop skipped */
+  void count_spin(uint64_t insns) {
+    ++spin_runs;
+    spin_insns += insns;
+  }
+  uint64_t get_spin_runs() const {
+    return spin_runs;
+  }
+  uint64_t get_spin_insns() const {
+    return spin_insns;
+  }
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "rvc.hh"
+
+uint32_t rvc_table[1U<<16];
+
+static inline uint32_t bits(uint32_t x, int hi, int lo) {
+  return (x >> lo) & ((1U << (hi - lo + 1)) - 1);
+}
+
+static inline int32_t sext(uint32_t x, int b) {
+  return static_cast<int32_t>(x << (32 - b)) >> (32 - b);
+}
+
+/* rd', rs1', rs2' name x8-x15 */
+static inline uint32_t creg(uint32_t x) {
+  return x + 8;
+}
+
+static uint32_t i_type(int32_t imm, uint32_t rs1, uint32_t f3, uint32_t rd, uint32_t opc) {
+  return ((static_cast<uint32_t>(imm) & 0xfff) << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | opc;
+}
+
+static uint32_t s_type(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t f3, uint32_t opc) {
+  uint32_t u = static_cast<uint32_t>(imm);
+  return (bits(u, 11, 5) << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (bits(u, 4, 0) << 7) | opc;
+}
+
+static uint32_t r_type(uint32_t f7, uint32_t rs2, uint32_t rs1, uint32_t f3, uint32_t rd, uint32_t opc) {
+  return (f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | opc;
+}
+
+static uint32_t b_type(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t f3) {
+  uint32_t u = static_cast<uint32_t>(imm);
+  return (bits(u, 12, 12) << 31) | (bits(u, 10, 5) << 25) | (rs2 << 20) | (rs1 << 15) |
+    (f3 << 12) | (bits(u, 4, 1) << 8) | (bits(u, 11, 11) << 7) | 0x63;
+}
+
+static uint32_t j_type(int32_t imm, uint32_t rd) {
+  uint32_t u = static_cast<uint32_t>(imm);
+  return (bits(u, 20, 20) << 31) | (bits(u, 10, 1) << 21) | (bits(u, 11, 11) << 20) |
+    (bits(u, 19, 12) << 12) | (rd << 7) | 0x6f;
+}
+
+static uint32_t expand(uint32_t c) {
+  uint32_t f3 = bits(c, 15, 13);
+  uint32_t rd = bits(c, 11, 7), rs2 = bits(c, 6, 2);
+  uint32_t rdp = creg(bits(c, 4, 2)), rs1p = creg(bits(c, 9, 7));
+  /* ci-format immediate, imm[5] in bit 12 and imm[4:0] in bits 6:2 */
+  int32_t ci_imm = sext((bits(c, 12, 12) << 5) | bits(c, 6, 2), 6);
+  uint32_t shamt = (bits(c, 12, 12) << 5) | bits(c, 6, 2);
+  /* cl/cs-format offsets scaled by 4 and by 8 */
+  uint32_t w_off = (bits(c, 12, 10) << 3) | (bits(c, 6, 6) << 2) | (bits(c, 5, 5) << 6);
+  uint32_t d_off = (bits(c, 12, 10) << 3) | (bits(c, 6, 5) << 6);
+
+  switch(c & 3)
+    {
+    case 0:
+      switch(f3)
+	{
+	case 0: { /* c.addi4spn */
+	  uint32_t imm = (bits(c, 12, 11) << 4) | (bits(c, 10, 7) << 6) |
+	    (bits(c, 6, 6) << 2) | (bits(c, 5, 5) << 3);
+	  if(imm == 0)
+	    return 0;
+	  return i_type(imm, 2, 0, rdp, 0x13);
+	}
+	case 1: /* c.fld */
+	  return i_type(d_off, rs1p, 3, rdp, 0x07);
+	case 2: /* c.lw */
+	  return i_type(w_off, rs1p, 2, rdp, 0x03);
+	case 3: /* c.ld */
+	  return i_type(d_off, rs1p, 3, rdp, 0x03);
+	case 5: /* c.fsd */
+	  return s_type(d_off, rdp, rs1p, 3, 0x27);
+	case 6: /* c.sw */
+	  return s_type(w_off, rdp, rs1p, 2, 0x23);
+	case 7: /* c.sd */
+	  return s_type(d_off, rdp, rs1p, 3, 0x23);
+	default:
+	  return 0;
+	}
+    case 1:
+      switch(f3)
+	{
+	case 0: /* c.addi, c.nop */
+	  return i_type(ci_imm, rd, 0, rd, 0x13);
+	case 1: /* c.addiw */
+	  if(rd == 0)
+	    return 0;
+	  return i_type(ci_imm, rd, 0, rd, 0x1b);
+	case 2: /* c.li */
+	  return i_type(ci_imm, 0, 0, rd, 0x13);
+	case 3:
+	  if(rd == 2) { /* c.addi16sp */
+	    int32_t imm = sext((bits(c, 12, 12) << 9) | (bits(c, 6, 6) << 4) |
+			       (bits(c, 5, 5) << 6) | (bits(c, 4, 3) << 7) |
+			       (bits(c, 2, 2) << 5), 10);
+	    if(imm == 0)
+	      return 0;
+	    return i_type(imm, 2, 0, 2, 0x13);
+	  }
+	  else { /* c.lui */
+	    if(ci_imm == 0)
+	      return 0;
+	    return (static_cast<uint32_t>(ci_imm) << 12) | (rd << 7) | 0x37;
+	  }
+	case 4:
+	  switch(bits(c, 11, 10))
+	    {
+	    case 0: /* c.srli */
+	      return i_type(shamt, rs1p, 5, rs1p, 0x13);
+	    case 1: /* c.srai */
+	      return i_type(0x400 | shamt, rs1p, 5, rs1p, 0x13);
+	    case 2: /* c.andi */
+	      return i_type(ci_imm, rs1p, 7, rs1p, 0x13);
+	    default: {
+	      static const uint32_t f3s[4] = {0, 4, 6, 7};
+	      uint32_t op = bits(c, 6, 5);
+	      if(bits(c, 12, 12) == 0) { /* c.sub, c.xor, c.or, c.and */
+		return r_type(op == 0 ? 0x20 : 0, rdp, rs1p, f3s[op], rs1p, 0x33);
+	      }
+	      if(op == 0) { /* c.subw */
+		return r_type(0x20, rdp, rs1p, 0, rs1p, 0x3b);
+	      }
+	      if(op == 1) { /* c.addw */
+		return r_type(0, rdp, rs1p, 0, rs1p, 0x3b);
+	      }
+	      return 0;
+	    }
+	    }
+	case 5: { /* c.j */
+	  int32_t imm = sext((bits(c, 12, 12) << 11) | (bits(c, 11, 11) << 4) |
+			     (bits(c, 10, 9) << 8) | (bits(c, 8, 8) << 10) |
+			     (bits(c, 7, 7) << 6) | (bits(c, 6, 6) << 7) |
+			     (bits(c, 5, 3) << 1) | (bits(c, 2, 2) << 5), 12);
+	  return j_type(imm, 0);
+	}
+	default: { /* c.beqz, c.bnez */
+	  int32_t imm = sext((bits(c, 12, 12) << 8) | (bits(c, 11, 10) << 3) |
+			     (bits(c, 6, 5) << 6) | (bits(c, 4, 3) << 1) |
+			     (bits(c, 2, 2) << 5), 9);
+	  return b_type(imm, 0, rs1p, f3 & 1);
+	}
+	}
+    case 2:
+      switch(f3)
+	{
+	case 0: /* c.slli */
+	  return i_type(shamt, rd, 1, rd, 0x13);
+	case 1: /* c.fldsp */
+	  return i_type((bits(c, 12, 12) << 5) | (bits(c, 6, 5) << 3) | (bits(c, 4, 2) << 6),
+			2, 3, rd, 0x07);
+	case 2: /* c.lwsp */
+	  if(rd == 0)
+	    return 0;
+	  return i_type((bits(c, 12, 12) << 5) | (bits(c, 6, 4) << 2) | (bits(c, 3, 2) << 6),
+			2, 2, rd, 0x03);
+	case 3: /* c.ldsp */
+	  if(rd == 0)
+	    return 0;
+	  return i_type((bits(c, 12, 12) << 5) | (bits(c, 6, 5) << 3) | (bits(c, 4, 2) << 6),
+			2, 3, rd, 0x03);
+	case 4:
+	  if(bits(c, 12, 12) == 0) {
+	    if(rs2 == 0) { /* c.jr */
+	      if(rd == 0)
+		return 0;
+	      return i_type(0, rd, 0, 0, 0x67);
+	    }
+	    /* c.mv */
+	    return r_type(0, rs2, 0, 0, rd, 0x33);
+	  }
+	  if(rs2 == 0) {
+	    if(rd == 0) { /* c.ebreak */
+	      return 0x00100073;
+	    }
+	    /* c.jalr */
+	    return i_type(0, rd, 0, 1, 0x67);
+	  }
+	  /* c.add */
+	  return r_type(0, rs2, rd, 0, rd, 0x33);
+	case 5: /* c.fsdsp */
+	  return s_type((bits(c, 12, 10) << 3) | (bits(c, 9, 7) << 6), rs2, 2, 3, 0x27);
+	case 6: /* c.swsp */
+	  return s_type((bits(c, 12, 9) << 2) | (bits(c, 8, 7) << 6), rs2, 2, 2, 0x23);
+	default: /* c.sdsp */
+	  return s_type((bits(c, 12, 10) << 3) | (bits(c, 9, 7) << 6), rs2, 2, 3, 0x23);
+	}
+    default:
+      return 0;
+    }
+}
+
+static struct rvc_table_init {
+  rvc_table_init() {
+    for(uint32_t c = 0; c < (1U<<16); c++) {
+      rvc_table[c] = expand(c);
+    }
+  }
+} rvc_table_init_;
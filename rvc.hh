@@ -0,0 +1,15 @@
+#ifndef __RVC_HH__
+#define __RVC_HH__
+
+#include <cstdint>
+
+/* 32b equivalent of every 16b compressed parcel (rv64c), 0 for
+ * reserved and illegal encodings. parcels with both low bits set
+ * are not compressed and map to 0 */
+extern uint32_t rvc_table[1U<<16];
+
+static inline uint32_t rvc_expand(uint16_t parcel) {
+  return rvc_table[parcel];
+}
+
+#endif
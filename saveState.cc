@@ -29,6 +29,7 @@
 
 #include <boost/dynamic_bitset.hpp>
 #include <cstdint>
+#include <cstdlib>
 #include <cassert>
 #include <cstring>
 #include <iostream>
@@ -36,14 +37,15 @@
 #include <fcntl.h>
 #include "interpret.hh"
 #include "globals.hh"
+#include "fdt.hh"
 
 struct page {
-  uint32_t va;
+  uint64_t va;
   uint8_t data[4096];
 } __attribute__((packed));
 
 
-static const uint64_t MAGIC_NUM = 0x6464f5f5beefd005UL;
+static const uint64_t MAGIC_NUM = 0x6464f5f5beefd00dUL;
 
 struct header {
   uint64_t magic;
@@ -53,6 +55,10 @@ struct header {
   uint32_t num_nz_pages;
   uint64_t tohost_addr;
   uint64_t fromhost_addr;
+  /* the ram layout the pages were taken from, see ram_banks() */
+  uint64_t phys_mem_size;
+  uint64_t bank_start[2];
+  uint64_t bank_size[2];
 
   int64_t priv;
   int64_t mstatus;
@@ -63,6 +69,7 @@ struct header {
   int64_t mhartid;
   int64_t mtvec;
   int64_t mcounteren;
+  int64_t menvcfg;
   int64_t mie;
   int64_t mip;
   int64_t mcause;
@@ -82,20 +89,39 @@ struct header {
   int64_t pmpaddr3;
   int64_t pmpcfg0;
   int64_t mtimecmp;
+  int64_t stimecmp;
+  uint64_t idle_time;
+  uint64_t fpr[32];
+  int64_t fcsr;
+  /* 32*vlenb bytes of vector registers follow the header */
+  uint64_t vlenb;
+  uint64_t vl;
+  int64_t vtype;
+  uint64_t vstart;
+  int64_t vxrm;
+  int64_t vxsat;
   
   header() : magic(MAGIC_NUM) {}
 } __attribute__((packed));
 
+static void ram_layout(header &h) {
+  uint64_t start[2] = {0, 0}, size[2] = {0, 0};
+  ram_banks(start, size);
+  h.phys_mem_size = globals::phys_mem_size;
+  memcpy(h.bank_start, start, sizeof(start));
+  memcpy(h.bank_size, size, sizeof(size));
+}
+
 void dumpState(const state_t &s, const std::string &filename) {
-  static const int n_pages = 1<<20;
+  const uint64_t n_pages = globals::phys_mem_size >> 12;
   header h;
   boost::dynamic_bitset<> nz_pages(n_pages,false);
   uint64_t *mem64 = reinterpret_cast<uint64_t*>(s.mem);
-  static_assert(sizeof(page)==4100, "struct page has weird size");
+  static_assert(sizeof(page)==4104, "struct page has weird size");
   
   /* mark non-zero pages */
-  for(int p = 0; p < n_pages; p++) {
-    for(int pp = 0; pp < 512; pp++) {
+  for(uint64_t p = 0; p < n_pages; p++) {
+    for(uint64_t pp = 0; pp < 512; pp++) {
       if(mem64[p*512+pp]) {
 	nz_pages[p] = true;
 	break;
@@ -115,6 +141,7 @@ void dumpState(const state_t &s, const std::string &filename) {
   h.num_nz_pages = nz_pages.count();
   h.tohost_addr = globals::tohost_addr;
   h.fromhost_addr = globals::fromhost_addr;
+  ram_layout(h);
 
   h.priv = s.priv;
   h.mstatus = s.mstatus;
@@ -125,6 +152,7 @@ void dumpState(const state_t &s, const std::string &filename) {
   h.mhartid = s.mhartid;
   h.mtvec = s.mtvec;
   h.mcounteren = s.mcounteren;
+  h.menvcfg = s.menvcfg;
   h.mie = s.mie;
   h.mip = s.mip;
   h.mcause = s.mcause;
@@ -144,11 +172,24 @@ void dumpState(const state_t &s, const std::string &filename) {
   h.pmpaddr3 = s.pmpaddr3;
   h.pmpcfg0 = s.pmpcfg0;
   h.mtimecmp = s.mtimecmp;
-  
+  h.stimecmp = s.stimecmp;
+  h.idle_time = s.idle_time;
+  memcpy(&h.fpr, &s.fpr, sizeof(h.fpr));
+  h.fcsr = s.fcsr;
+  h.vlenb = s.vlenb;
+  h.vl = s.vl;
+  h.vtype = s.vtype;
+  h.vstart = s.vstart;
+  h.vxrm = s.vxrm;
+  h.vxsat = s.vxsat;
 
   
   ssize_t wb = write(fd, &h, sizeof(h));
   assert(wb == sizeof(h));
+  if(s.vlenb) {
+    wb = write(fd, s.vrf, 32*s.vlenb);
+    assert(wb == static_cast<ssize_t>(32*s.vlenb));
+  }
 
   for(size_t i = nz_pages.find_first(); i != boost::dynamic_bitset<>::npos;
       i = nz_pages.find_next(i)) {
@@ -188,11 +229,37 @@ void loadState(state_t &s, const std::string &filename) {
   s.pc = h.pc;
   memcpy(&s.gpr,&h.gpr,sizeof(s.gpr));
   s.icnt = h.icnt;
+
+  if(h.vlenb != s.vlenb) {
+    std::cerr << "dump has vlen " << 8*h.vlenb
+	      << ", run with --vlen " << 8*h.vlenb << "\n";
+    exit(-1);
+  }
+  header l;
+  ram_layout(l);
+  if((h.phys_mem_size != l.phys_mem_size) or
+     memcmp(h.bank_start, l.bank_start, sizeof(l.bank_start)) or
+     memcmp(h.bank_size, l.bank_size, sizeof(l.bank_size))) {
+    std::cerr << "dump has " << h.bank_size[0] + h.bank_size[1]
+	      << " bytes of ram at " << std::hex << h.bank_start[0] << std::dec
+	      << (h.bank_size[1] ? " (sparse)" : "")
+	      << ", run with the --ram_size, --phys_start and --ram_sparse it was taken with\n";
+    exit(-1);
+  }
+  if(h.vlenb) {
+    sz = read(fd, s.vrf, 32*h.vlenb);
+    assert(sz == 32*h.vlenb);
+  }
   
   for(uint32_t i = 0; i < h.num_nz_pages; i++) {
     page p;
     sz = read(fd, &p, sizeof(p));
     assert(sz == sizeof(p));
+    if(((p.va & 4095) != 0) or ((p.va + 4096) > globals::phys_mem_size)) {
+      std::cerr << "dump page at " << std::hex << p.va << std::dec
+		<< " is outside of ram\n";
+      exit(-1);
+    }
     memcpy(s.mem+p.va, p.data, 4096);
   }
 
@@ -229,6 +296,7 @@ void loadState(state_t &s, const std::string &filename) {
   s.mhartid = h.mhartid;
   s.mtvec = h.mtvec;
   s.mcounteren = h.mcounteren;
+  s.menvcfg = h.menvcfg;
   s.mie = h.mie;
   s.mip = h.mip;
   s.mcause = h.mcause;
@@ -248,6 +316,17 @@ void loadState(state_t &s, const std::string &filename) {
   s.pmpaddr3 = h.pmpaddr3;
   s.pmpcfg0 = h.pmpcfg0;
   s.mtimecmp = h.mtimecmp;
+  s.stimecmp = h.stimecmp;
+  s.idle_time = h.idle_time;
+  memcpy(&s.fpr, &h.fpr, sizeof(s.fpr));
+  s.fcsr = h.fcsr;
+  s.vl = h.vl;
+  s.vtype = h.vtype;
+  s.vstart = h.vstart;
+  s.vxrm = h.vxrm;
+  s.vxsat = h.vxsat;
+  /* poll interrupts at the first instruction */
+  s.next_event = 0;
   
   close(fd);
 }
@@ -18,6 +18,7 @@
 #include "disassemble.hh"
 #include "helper.hh"
 #include "globals.hh"
+#include "predecode.hh"
 
 
 void handle_syscall(state_t *s, uint64_t tohost) {
@@ -57,6 +58,9 @@ void handle_syscall(state_t *s, uint64_t tohost) {
     }
     case SYS_read: {
       buf[0] = read(buf[1], reinterpret_cast<char*>(s->mem + buf[2]), buf[3]); 
+      if(s->pdc) {
+	s->pdc->flush();
+      }
       break;
     }
     case SYS_lseek: {
@@ -48,13 +48,11 @@ int64_t take_interrupt(state_t *s) {
   pending_irq_bitvec &= enabled_ints;
   
   
-  if(pending_irq_bitvec != 0) {
+  /* highest numbered pending irq among the low 32 */
+  uint32_t pending = static_cast<uint32_t>(pending_irq_bitvec);
+  if(pending != 0) {
     //printf("%d pending irqs\n", __builtin_popcount(pending_irq_bitvec));
-    for(int32_t p = 31; p >= 0; p--) {
-      if((pending_irq_bitvec >> p) & 1) {
-	return p;
-      }
-    }
+    return 31 - __builtin_clz(pending);
   }
 
   return 0;
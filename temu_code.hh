@@ -71,6 +71,7 @@ static std::array<std::string, 16> cause_reasons =
 #define MSTATUS_MPIE_SHIFT 7
 #define MSTATUS_SPP_SHIFT 8
 #define MSTATUS_MPP_SHIFT 11
+#define MSTATUS_VS_SHIFT 9
 #define MSTATUS_FS_SHIFT 13
 #define MSTATUS_UXL_SHIFT 32
 #define MSTATUS_SXL_SHIFT 34
@@ -85,8 +86,10 @@ static std::array<std::string, 16> cause_reasons =
 #define MSTATUS_SPP (1 << MSTATUS_SPP_SHIFT)
 #define MSTATUS_HPP (3 << 9)
 #define MSTATUS_MPP (3 << MSTATUS_MPP_SHIFT)
+#define MSTATUS_VS (3 << MSTATUS_VS_SHIFT)
 #define MSTATUS_FS (3 << MSTATUS_FS_SHIFT)
 #define MSTATUS_XS (3 << 15)
+#define MSTATUS_SD (1UL << 63)
 #define MSTATUS_MPRV (1 << 17)
 #define MSTATUS_SUM (1 << 18)
 #define MSTATUS_MXR (1 << 19)
@@ -96,7 +99,7 @@ static std::array<std::string, 16> cause_reasons =
 #define MSTATUS_MASK (MSTATUS_UIE | MSTATUS_SIE | MSTATUS_MIE |		\
                       MSTATUS_UPIE | MSTATUS_SPIE | MSTATUS_MPIE |	\
                       MSTATUS_SPP | MSTATUS_MPP |			\
-                      MSTATUS_FS |					\
+                      MSTATUS_VS | MSTATUS_FS |				\
                       MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR )
 
 
@@ -113,6 +116,8 @@ static std::array<std::string, 16> cause_reasons =
 #define MIP_HEIP (1 << 10)
 #define MIP_MEIP (1 << 11)
 
+#define MENVCFG_STCE (1UL << 63)
+
 
 #define VIRTIO_BASE_ADDR 0x40010000
 #define VIRTIO_SIZE      0x1000
@@ -0,0 +1,1854 @@
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <iostream>
+#include <algorithm>
+#include <type_traits>
+
+#include "vector.hh"
+#include "fpu.hh"
+#include "predecode.hh"
+#include "temu_code.hh"
+#include "mmio.hh"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static const uint64_t vtype_vill = 1UL << 63;
+
+enum vfunct3 {
+  opivv = 0, opfvv, opmvv, opivi, opivx, opfvf, opmvx, opcfg
+};
+
+/* the fields of an op-v instruction and the vtype/vl it runs under */
+struct vinsn {
+  uint32_t funct6, funct3, vd, vs1, vs2;
+  bool vm;
+  uint64_t vstart, vl, vlmax;
+  /* element bytes */
+  uint32_t sew;
+  /* log2 lmul, -3 (mf8) to 3 (m8) */
+  int lmul_log;
+  /* registers in a group, 1 for fractional lmul */
+  uint32_t nregs;
+  vinsn(const state_t *s, uint32_t inst) :
+    funct6(inst >> 26), funct3((inst >> 12) & 7),
+    vd((inst >> 7) & 31), vs1((inst >> 15) & 31), vs2((inst >> 20) & 31),
+    vm((inst >> 25) & 1), vstart(s->vstart), vl(s->vl), vlmax(0) {
+    uint32_t vlmul = s->vtype & 7;
+    sew = 1U << ((s->vtype >> 3) & 7);
+    lmul_log = vlmul < 4 ? static_cast<int>(vlmul) : static_cast<int>(vlmul) - 8;
+    nregs = lmul_log > 0 ? 1U << lmul_log : 1;
+    uint64_t per_reg = s->vlenb / sew;
+    vlmax = lmul_log >= 0 ? per_reg << lmul_log : per_reg >> -lmul_log;
+  }
+  /* registers in a group of 2*sew elements */
+  uint32_t wregs() const {
+    return lmul_log >= 0 ? 2*nregs : 1;
+  }
+};
+
+static inline uint8_t *vreg(state_t *s, uint32_t r) {
+  return s->vrf + r * s->vlenb;
+}
+
+template <typename T>
+static inline T *vreg(state_t *s, uint32_t r) {
+  return reinterpret_cast<T*>(vreg(s, r));
+}
+
+static inline bool mask_bit(const uint8_t *m, uint64_t i) {
+  return (m[i >> 3] >> (i & 7)) & 1;
+}
+
+static inline void set_mask_bit(uint8_t *m, uint64_t i, bool b) {
+  m[i >> 3] = (m[i >> 3] & ~(1U << (i & 7))) | (static_cast<uint32_t>(b) << (i & 7));
+}
+
+static inline bool active(const state_t *s, const vinsn &v, uint64_t i) {
+  return v.vm or mask_bit(s->vrf, i);
+}
+
+static inline bool group_ok(uint32_t r, uint32_t n) {
+  return ((r & (n - 1)) == 0) and ((r + n) <= 32);
+}
+
+/* ops whose elements do not line up with their sources (slides,
+ * gathers, widening) build the result in the scratch group past v31
+ * and copy it over vd at the end, so any overlap reads old values */
+static inline uint8_t *begin_scratch(state_t *s, uint32_t vd, uint32_t n) {
+  uint8_t *t = vreg(s, 32);
+  memcpy(t, vreg(s, vd), n * s->vlenb);
+  return t;
+}
+
+static inline void end_scratch(state_t *s, uint32_t vd, uint32_t n) {
+  memcpy(vreg(s, vd), vreg(s, 32), n * s->vlenb);
+}
+
+template <typename U> struct vwide;
+template <> struct vwide<uint8_t> {
+  typedef uint16_t u;
+  typedef int16_t s;
+};
+template <> struct vwide<uint16_t> {
+  typedef uint32_t u;
+  typedef int32_t s;
+};
+template <> struct vwide<uint32_t> {
+  typedef uint64_t u;
+  typedef int64_t s;
+};
+template <> struct vwide<uint64_t> {
+  typedef unsigned __int128 u;
+  typedef __int128 s;
+};
+
+/* element sources: a vector register group or a splatted scalar */
+template <typename T>
+struct vsrc {
+  const T *p;
+  T operator[](uint64_t i) const {
+    return p[i];
+  }
+};
+
+template <typename T>
+struct xsrc {
+  T x;
+  T operator[](uint64_t) const {
+    return x;
+  }
+};
+
+/* the integer ops with an avx2 kernel. vmap, vcmp and vred take one
+ * as K, the kernel runs whole 32 byte chunks and the scalar loop
+ * finishes the elements it leaves */
+enum vkern {
+  vk_none = 0, vk_add, vk_sub, vk_rsub, vk_and, vk_or, vk_xor,
+  vk_minu, vk_min, vk_maxu, vk_max,
+  /* compares of vs2 against a, as lane masks */
+  vk_eq, vk_ne, vk_ltu, vk_lt, vk_leu, vk_le, vk_gtu, vk_gt,
+  /* vmerge and vmv.v, and the blends of masked unit-stride accesses */
+  vk_merge
+};
+
+/* no kernel, everything is left to the scalar loops */
+struct vscalar {
+  template <typename A>
+  static uint64_t map(state_t *, const vinsn &v, const A &) {
+    return v.vstart;
+  }
+  template <typename A>
+  static uint64_t cmp(state_t *, const vinsn &v, const A &, uint8_t *) {
+    return v.vstart;
+  }
+  template <typename T>
+  static uint64_t red(state_t *, const vinsn &, T *) {
+    return 0;
+  }
+  template <typename T>
+  static uint64_t mcopy(T *, const T *, uint64_t, const uint8_t *, uint64_t) {
+    return 0;
+  }
+};
+
+#ifdef __AVX2__
+/* the lane ops of each element width. gt is signed, the unsigned
+ * compares flip the sign bits first. lanes() widens mask bits to
+ * lane masks and bits() packs them back */
+template <typename U> struct vlanes;
+
+template <> struct vlanes<uint8_t> {
+  static __m256i splat(uint8_t x) { return _mm256_set1_epi8(x); }
+  static __m256i add(__m256i x, __m256i y) { return _mm256_add_epi8(x, y); }
+  static __m256i sub(__m256i x, __m256i y) { return _mm256_sub_epi8(x, y); }
+  static __m256i eq(__m256i x, __m256i y) { return _mm256_cmpeq_epi8(x, y); }
+  static __m256i gt(__m256i x, __m256i y) { return _mm256_cmpgt_epi8(x, y); }
+  static __m256i lanes(uint64_t m) {
+    /* byte k of m to lanes 8k..8k+7 */
+    const __m256i sel = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+					 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bit = _mm256_set1_epi64x(0x8040201008040201L);
+    __m256i b = _mm256_shuffle_epi8(_mm256_set1_epi32(static_cast<int>(m)), sel);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(b, bit), bit);
+  }
+  static uint32_t bits(__m256i m) { return _mm256_movemask_epi8(m); }
+};
+
+template <> struct vlanes<uint16_t> {
+  static __m256i splat(uint16_t x) { return _mm256_set1_epi16(x); }
+  static __m256i add(__m256i x, __m256i y) { return _mm256_add_epi16(x, y); }
+  static __m256i sub(__m256i x, __m256i y) { return _mm256_sub_epi16(x, y); }
+  static __m256i eq(__m256i x, __m256i y) { return _mm256_cmpeq_epi16(x, y); }
+  static __m256i gt(__m256i x, __m256i y) { return _mm256_cmpgt_epi16(x, y); }
+  static __m256i lanes(uint64_t m) {
+    const __m256i bit = _mm256_setr_epi16(1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4, 1 << 5,
+					  1 << 6, 1 << 7, 1 << 8, 1 << 9, 1 << 10, 1 << 11,
+					  1 << 12, 1 << 13, 1 << 14, -32768);
+    __m256i b = _mm256_set1_epi16(static_cast<short>(m));
+    return _mm256_cmpeq_epi16(_mm256_and_si256(b, bit), bit);
+  }
+  static uint32_t bits(__m256i m) {
+    __m128i p = _mm_packs_epi16(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1));
+    return _mm_movemask_epi8(p);
+  }
+};
+
+template <> struct vlanes<uint32_t> {
+  static __m256i splat(uint32_t x) { return _mm256_set1_epi32(x); }
+  static __m256i add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+  static __m256i sub(__m256i x, __m256i y) { return _mm256_sub_epi32(x, y); }
+  static __m256i eq(__m256i x, __m256i y) { return _mm256_cmpeq_epi32(x, y); }
+  static __m256i gt(__m256i x, __m256i y) { return _mm256_cmpgt_epi32(x, y); }
+  static __m256i lanes(uint64_t m) {
+    const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i b = _mm256_set1_epi32(static_cast<int>(m));
+    return _mm256_cmpeq_epi32(_mm256_and_si256(b, bit), bit);
+  }
+  static uint32_t bits(__m256i m) { return _mm256_movemask_ps(_mm256_castsi256_ps(m)); }
+};
+
+template <> struct vlanes<uint64_t> {
+  static __m256i splat(uint64_t x) { return _mm256_set1_epi64x(x); }
+  static __m256i add(__m256i x, __m256i y) { return _mm256_add_epi64(x, y); }
+  static __m256i sub(__m256i x, __m256i y) { return _mm256_sub_epi64(x, y); }
+  static __m256i eq(__m256i x, __m256i y) { return _mm256_cmpeq_epi64(x, y); }
+  static __m256i gt(__m256i x, __m256i y) { return _mm256_cmpgt_epi64(x, y); }
+  static __m256i lanes(uint64_t m) {
+    const __m256i bit = _mm256_setr_epi64x(1, 2, 4, 8);
+    __m256i b = _mm256_set1_epi64x(m);
+    return _mm256_cmpeq_epi64(_mm256_and_si256(b, bit), bit);
+  }
+  static uint32_t bits(__m256i m) { return _mm256_movemask_pd(_mm256_castsi256_pd(m)); }
+};
+
+template <typename U, int K>
+struct vsimd {
+  typedef vlanes<U> L;
+  static const uint64_t n_lanes = 32 / sizeof(U);
+
+  static __m256i load(const U *p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  }
+  static void store(U *p, __m256i x) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x);
+  }
+  static __m256i src(const vsrc<U> &a, uint64_t i) {
+    return load(a.p + i);
+  }
+  static __m256i src(const xsrc<U> &a, uint64_t) {
+    return L::splat(a.x);
+  }
+  /* lane masks of mask bits i.. of m */
+  static __m256i active(const uint8_t *m, uint64_t i) {
+    uint64_t w;
+    memcpy(&w, m + (i >> 3), sizeof(w));
+    return L::lanes(w >> (i & 7));
+  }
+  static __m256i op(__m256i x, __m256i y) {
+    const __m256i sb = L::splat(static_cast<U>(1) << (8*sizeof(U) - 1));
+    const __m256i ones = _mm256_set1_epi32(-1);
+    switch(K)
+      {
+      case vk_add:
+	return L::add(x, y);
+      case vk_sub:
+	return L::sub(x, y);
+      case vk_rsub:
+	return L::sub(y, x);
+      case vk_and:
+	return _mm256_and_si256(x, y);
+      case vk_or:
+	return _mm256_or_si256(x, y);
+      case vk_xor:
+	return _mm256_xor_si256(x, y);
+      case vk_minu:
+	return _mm256_blendv_epi8(x, y, L::gt(_mm256_xor_si256(x, sb), _mm256_xor_si256(y, sb)));
+      case vk_min:
+	return _mm256_blendv_epi8(x, y, L::gt(x, y));
+      case vk_maxu:
+	return _mm256_blendv_epi8(x, y, L::gt(_mm256_xor_si256(y, sb), _mm256_xor_si256(x, sb)));
+      case vk_max:
+	return _mm256_blendv_epi8(x, y, L::gt(y, x));
+      case vk_eq:
+	return L::eq(x, y);
+      case vk_ne:
+	return _mm256_xor_si256(L::eq(x, y), ones);
+      case vk_ltu:
+	return L::gt(_mm256_xor_si256(y, sb), _mm256_xor_si256(x, sb));
+      case vk_lt:
+	return L::gt(y, x);
+      case vk_leu:
+	return _mm256_xor_si256(L::gt(_mm256_xor_si256(x, sb), _mm256_xor_si256(y, sb)), ones);
+      case vk_le:
+	return _mm256_xor_si256(L::gt(x, y), ones);
+      case vk_gtu:
+	return L::gt(_mm256_xor_si256(x, sb), _mm256_xor_si256(y, sb));
+      case vk_gt:
+	return L::gt(x, y);
+      default:
+	return y;
+      }
+  }
+  /* what a reduction folds in for an inactive element */
+  static __m256i identity() {
+    const __m256i sb = L::splat(static_cast<U>(1) << (8*sizeof(U) - 1));
+    switch(K)
+      {
+      case vk_and:
+      case vk_minu:
+	return _mm256_set1_epi32(-1);
+      case vk_min:
+	return _mm256_xor_si256(sb, _mm256_set1_epi32(-1));
+      case vk_max:
+	return sb;
+      default:
+	return _mm256_setzero_si256();
+      }
+  }
+
+  /* vd[i] = op(vs2[i], a[i]), vmerge takes vs2 for the masked off
+   * elements. vd over v0 reads mask bits it has already written */
+  template <typename A>
+  static uint64_t map(state_t *s, const vinsn &v, const A &a) {
+    U *d = vreg<U>(s, v.vd);
+    const U *b = vreg<U>(s, v.vs2);
+    uint64_t i = v.vstart;
+    if(not(v.vm) and (v.vd == 0)) {
+      return i;
+    }
+    for(; (i + n_lanes) <= v.vl; i += n_lanes) {
+      __m256i r = op(load(b + i), src(a, i));
+      if(not(v.vm)) {
+	r = _mm256_blendv_epi8(load(((K == vk_merge) ? b : d) + i), r, active(s->vrf, i));
+      }
+      store(d + i, r);
+    }
+    return i;
+  }
+  /* writes whole bytes of m, so it starts on one and moves 8 or more
+   * elements a step */
+  template <typename A>
+  static uint64_t cmp(state_t *s, const vinsn &v, const A &a, uint8_t *m) {
+    const uint64_t step = (n_lanes < 8) ? 8 : n_lanes, nb = step / 8;
+    const U *b = vreg<U>(s, v.vs2);
+    uint64_t i = v.vstart;
+    if(i & 7) {
+      return i;
+    }
+    for(; (i + step) <= v.vl; i += step) {
+      uint32_t r = L::bits(op(load(b + i), src(a, i)));
+      if(n_lanes < 8) {
+	r |= L::bits(op(load(b + i + 4), src(a, i + 4))) << 4;
+      }
+      if(not(v.vm)) {
+	uint32_t act = 0, old = 0;
+	memcpy(&act, s->vrf + (i >> 3), nb);
+	memcpy(&old, m + (i >> 3), nb);
+	r = (r & act) | (old & ~act);
+      }
+      memcpy(m + (i >> 3), &r, nb);
+    }
+    return i;
+  }
+  /* folds the active elements into the lanes of part, 0 if it did
+   * not run */
+  static uint64_t red(state_t *s, const vinsn &v, U *part) {
+    const U *b = vreg<U>(s, v.vs2);
+    const __m256i id = identity();
+    __m256i r = id;
+    uint64_t i = 0;
+    for(; (i + n_lanes) <= v.vl; i += n_lanes) {
+      __m256i x = load(b + i);
+      if(not(v.vm)) {
+	x = _mm256_blendv_epi8(id, x, active(s->vrf, i));
+      }
+      r = op(r, x);
+    }
+    store(part, r);
+    return i;
+  }
+  /* d[k] = src[k] where mask bit i+k is set */
+  static uint64_t mcopy(U *d, const U *src, uint64_t n, const uint8_t *m, uint64_t i) {
+    uint64_t k = 0;
+    for(; (k + n_lanes) <= n; k += n_lanes) {
+      store(d + k, _mm256_blendv_epi8(load(d + k), load(src + k), active(m, i + k)));
+    }
+    return k;
+  }
+};
+
+template <typename U>
+struct vsimd<U, vk_none> : vscalar {};
+#else
+template <typename U, int K>
+struct vsimd : vscalar {};
+#endif
+
+/* vd[i] = f(vs2[i], a[i]) over the body, masked off elements are
+ * left alone. unmasked this is a straight loop over host arrays */
+template <typename T, int K = vk_none, typename A, typename F>
+static void vmap(state_t *s, const vinsn &v, A a, F f) {
+  T *d = vreg<T>(s, v.vd);
+  const T *b = vreg<T>(s, v.vs2);
+  uint64_t i = vsimd<T, K>::map(s, v, a);
+  if(v.vm) {
+    for(; i < v.vl; i++) {
+      d[i] = f(b[i], a[i]);
+    }
+  }
+  else {
+    for(; i < v.vl; i++) {
+      if(mask_bit(s->vrf, i)) {
+	d[i] = f(b[i], a[i]);
+      }
+    }
+  }
+}
+
+/* vd[i] = f(vs2[i], a[i], vd[i]) for the multiply-adds */
+template <typename T, typename A, typename F>
+static void vmap3(state_t *s, const vinsn &v, A a, F f) {
+  T *d = vreg<T>(s, v.vd);
+  const T *b = vreg<T>(s, v.vs2);
+  if(v.vm) {
+    for(uint64_t i = v.vstart; i < v.vl; i++) {
+      d[i] = f(b[i], a[i], d[i]);
+    }
+  }
+  else {
+    for(uint64_t i = v.vstart; i < v.vl; i++) {
+      if(mask_bit(s->vrf, i)) {
+	d[i] = f(b[i], a[i], d[i]);
+      }
+    }
+  }
+}
+
+/* mask bit i of vd = f(vs2[i], a[i]) */
+template <typename T, int K = vk_none, typename A, typename F>
+static void vcmp(state_t *s, const vinsn &v, A a, F f) {
+  const T *b = vreg<T>(s, v.vs2);
+  uint8_t *m = begin_scratch(s, v.vd, 1);
+  for(uint64_t i = vsimd<T, K>::cmp(s, v, a, m); i < v.vl; i++) {
+    if(active(s, v, i)) {
+      set_mask_bit(m, i, f(b[i], a[i]));
+    }
+  }
+  end_scratch(s, v.vd, 1);
+}
+
+/* vd[0] = f(...f(vs1[0], vs2[0])..., vs2[vl-1]) over active elements */
+template <typename T, int K = vk_none, typename F>
+static void vred(state_t *s, const vinsn &v, F f) {
+  if(v.vl == 0) {
+    return;
+  }
+  const T *b = vreg<T>(s, v.vs2);
+  T acc = vreg<T>(s, v.vs1)[0];
+  T part[32 / sizeof(T)];
+  uint64_t i = vsimd<T, K>::red(s, v, part);
+  for(uint64_t j = 0; (i != 0) and (j < (32 / sizeof(T))); j++) {
+    acc = f(acc, part[j]);
+  }
+  for(; i < v.vl; i++) {
+    if(active(s, v, i)) {
+      acc = f(acc, b[i]);
+    }
+  }
+  vreg<T>(s, v.vd)[0] = acc;
+}
+
+/* vd (2*sew) = f(vs2[i], a[i], vd[i]), vs2 is narrow or, for the
+ * .w forms, already wide */
+template <typename W, typename B, typename A, typename F>
+static void vmap_w(state_t *s, const vinsn &v, A a, F f) {
+  uint32_t n = v.wregs();
+  W *d = reinterpret_cast<W*>(begin_scratch(s, v.vd, n));
+  const B *b = vreg<B>(s, v.vs2);
+  for(uint64_t i = v.vstart; i < v.vl; i++) {
+    if(active(s, v, i)) {
+      d[i] = f(b[i], a[i], d[i]);
+    }
+  }
+  end_scratch(s, v.vd, n);
+}
+
+template <typename U, typename I>
+static void vgather(state_t *s, const vinsn &v, I idx) {
+  const U *b = vreg<U>(s, v.vs2);
+  U *d = reinterpret_cast<U*>(begin_scratch(s, v.vd, v.nregs));
+  for(uint64_t i = v.vstart; i < v.vl; i++) {
+    if(active(s, v, i)) {
+      uint64_t j = idx[i];
+      d[i] = j < v.vlmax ? b[j] : 0;
+    }
+  }
+  end_scratch(s, v.vd, v.nregs);
+}
+
+/* vslideup/vslidedown by off, or the slide1 forms that shift in x */
+template <typename U>
+static void vslide(state_t *s, const vinsn &v, bool up, bool one, uint64_t off, U x) {
+  const U *b = vreg<U>(s, v.vs2);
+  U *d = reinterpret_cast<U*>(begin_scratch(s, v.vd, v.nregs));
+  if(one) {
+    off = 1;
+  }
+  for(uint64_t i = v.vstart; i < v.vl; i++) {
+    if(not(active(s, v, i))) {
+      continue;
+    }
+    if(up) {
+      if(i >= off) {
+	d[i] = b[i - off];
+      }
+      else if(one) {
+	d[i] = x;
+      }
+    }
+    else if(one) {
+      d[i] = (i + 1) < v.vl ? b[i + 1] : x;
+    }
+    else {
+      d[i] = ((off < v.vlmax) and (i < (v.vlmax - off))) ? b[i + off] : 0;
+    }
+  }
+  end_scratch(s, v.vd, v.nregs);
+}
+
+/* vnsrl/vnsra, vd (sew) = vs2 (2*sew) >> a */
+template <typename U, typename A>
+static bool vnshift(state_t *s, const vinsn &v, A a, bool arith) {
+  typedef typename vwide<U>::u W;
+  typedef typename vwide<U>::s SW;
+  if((sizeof(U) == 8) or (v.lmul_log > 2) or not(group_ok(v.vs2, v.wregs()))) {
+    return false;
+  }
+  const W sh = 16*sizeof(U) - 1;
+  const W *b = vreg<W>(s, v.vs2);
+  U *d = reinterpret_cast<U*>(begin_scratch(s, v.vd, v.nregs));
+  for(uint64_t i = v.vstart; i < v.vl; i++) {
+    if(active(s, v, i)) {
+      W c = a[i] & sh;
+      d[i] = arith ? static_cast<U>(static_cast<SW>(b[i]) >> c) : static_cast<U>(b[i] >> c);
+    }
+  }
+  end_scratch(s, v.vd, v.nregs);
+  return true;
+}
+
+/* vzext/vsext.vf2/vf4/vf8 */
+template <typename D, typename N>
+static bool vext(state_t *s, const vinsn &v, bool sgn) {
+  typedef typename std::make_signed<D>::type SD;
+  typedef typename std::make_signed<N>::type SN;
+  int frac_log = sizeof(D) == 8*sizeof(N) ? 3 : (sizeof(D) == 4*sizeof(N) ? 2 : 1);
+  int emul_log = v.lmul_log - frac_log;
+  if(emul_log < -3) {
+    return false;
+  }
+  uint32_t n = emul_log > 0 ? 1U << emul_log : 1;
+  if(not(group_ok(v.vs2, n))) {
+    return false;
+  }
+  const N *b = vreg<N>(s, v.vs2);
+  D *d = reinterpret_cast<D*>(begin_scratch(s, v.vd, v.nregs));
+  for(uint64_t i = v.vstart; i < v.vl; i++) {
+    if(active(s, v, i)) {
+      d[i] = sgn ? static_cast<D>(static_cast<SD>(static_cast<SN>(b[i]))) : static_cast<D>(b[i]);
+    }
+  }
+  end_scratch(s, v.vd, v.nregs);
+  return true;
+}
+
+/* op-ivv, op-ivx and op-ivi. x is the untruncated scalar (or the
+ * immediate) for the slides and gathers that index with it */
+template <typename U, typename A>
+static bool opi(state_t *s, const vinsn &v, A a, uint64_t x) {
+  typedef typename std::make_signed<U>::type S;
+  const U sh = 8*sizeof(U) - 1;
+  const bool vv = v.funct3 == opivv, vi = v.funct3 == opivi;
+  const uint32_t n = v.nregs;
+  /* everything but the compares writes a whole group */
+  bool to_mask = (v.funct6 >= 0x18) and (v.funct6 <= 0x1f);
+  if(not(group_ok(v.vs2, (v.funct6 >= 0x2c) and (v.funct6 <= 0x2d) ? v.wregs() : n)) or
+     not(to_mask or group_ok(v.vd, n)) or (vv and not(group_ok(v.vs1, n)))) {
+    return false;
+  }
+  switch(v.funct6)
+    {
+    case 0x00: /* vadd */
+      vmap<U, vk_add>(s, v, a, [](U x, U y) -> U { return x + y; });
+      break;
+    case 0x02: /* vsub */
+      if(vi) return false;
+      vmap<U, vk_sub>(s, v, a, [](U x, U y) -> U { return x - y; });
+      break;
+    case 0x03: /* vrsub */
+      if(vv) return false;
+      vmap<U, vk_rsub>(s, v, a, [](U x, U y) -> U { return y - x; });
+      break;
+    case 0x04: /* vminu */
+      if(vi) return false;
+      vmap<U, vk_minu>(s, v, a, [](U x, U y) -> U { return x < y ? x : y; });
+      break;
+    case 0x05: /* vmin */
+      if(vi) return false;
+      vmap<U, vk_min>(s, v, a, [](U x, U y) -> U { return static_cast<S>(x) < static_cast<S>(y) ? x : y; });
+      break;
+    case 0x06: /* vmaxu */
+      if(vi) return false;
+      vmap<U, vk_maxu>(s, v, a, [](U x, U y) -> U { return x > y ? x : y; });
+      break;
+    case 0x07: /* vmax */
+      if(vi) return false;
+      vmap<U, vk_max>(s, v, a, [](U x, U y) -> U { return static_cast<S>(x) > static_cast<S>(y) ? x : y; });
+      break;
+    case 0x09: /* vand */
+      vmap<U, vk_and>(s, v, a, [](U x, U y) -> U { return x & y; });
+      break;
+    case 0x0a: /* vor */
+      vmap<U, vk_or>(s, v, a, [](U x, U y) -> U { return x | y; });
+      break;
+    case 0x0b: /* vxor */
+      vmap<U, vk_xor>(s, v, a, [](U x, U y) -> U { return x ^ y; });
+      break;
+    case 0x0c: /* vrgather */
+      if((v.vd == v.vs2) or (vv and (v.vd == v.vs1))) return false;
+      if(vv) {
+	vgather<U>(s, v, a);
+      }
+      else {
+	vgather<U>(s, v, xsrc<uint64_t>{x});
+      }
+      break;
+    case 0x0e: /* vslideup */
+      if(vv or (v.vd == v.vs2)) return false;
+      vslide<U>(s, v, true, false, x, 0);
+      break;
+    case 0x0f: /* vslidedown */
+      if(vv) return false;
+      vslide<U>(s, v, false, false, x, 0);
+      break;
+    case 0x17: { /* vmerge, vmv.v */
+      U *d = vreg<U>(s, v.vd);
+      if(v.vm and (v.vs2 != 0)) return false;
+      uint64_t i = vsimd<U, vk_merge>::map(s, v, a);
+      if(v.vm) {
+	for(; i < v.vl; i++) {
+	  d[i] = a[i];
+	}
+      }
+      else {
+	const U *b = vreg<U>(s, v.vs2);
+	for(; i < v.vl; i++) {
+	  d[i] = mask_bit(s->vrf, i) ? a[i] : b[i];
+	}
+      }
+      break;
+    }
+    case 0x18: /* vmseq */
+      vcmp<U, vk_eq>(s, v, a, [](U x, U y) { return x == y; });
+      break;
+    case 0x19: /* vmsne */
+      vcmp<U, vk_ne>(s, v, a, [](U x, U y) { return x != y; });
+      break;
+    case 0x1a: /* vmsltu */
+      if(vi) return false;
+      vcmp<U, vk_ltu>(s, v, a, [](U x, U y) { return x < y; });
+      break;
+    case 0x1b: /* vmslt */
+      if(vi) return false;
+      vcmp<U, vk_lt>(s, v, a, [](U x, U y) { return static_cast<S>(x) < static_cast<S>(y); });
+      break;
+    case 0x1c: /* vmsleu */
+      vcmp<U, vk_leu>(s, v, a, [](U x, U y) { return x <= y; });
+      break;
+    case 0x1d: /* vmsle */
+      vcmp<U, vk_le>(s, v, a, [](U x, U y) { return static_cast<S>(x) <= static_cast<S>(y); });
+      break;
+    case 0x1e: /* vmsgtu */
+      if(vv) return false;
+      vcmp<U, vk_gtu>(s, v, a, [](U x, U y) { return x > y; });
+      break;
+    case 0x1f: /* vmsgt */
+      if(vv) return false;
+      vcmp<U, vk_gt>(s, v, a, [](U x, U y) { return static_cast<S>(x) > static_cast<S>(y); });
+      break;
+    case 0x25: /* vsll */
+      vmap<U>(s, v, a, [sh](U x, U y) -> U { return x << (y & sh); });
+      break;
+    case 0x28: /* vsrl */
+      vmap<U>(s, v, a, [sh](U x, U y) -> U { return x >> (y & sh); });
+      break;
+    case 0x29: /* vsra */
+      vmap<U>(s, v, a, [sh](U x, U y) -> U { return static_cast<S>(x) >> (y & sh); });
+      break;
+    case 0x2c: /* vnsrl */
+      return vnshift<U>(s, v, a, false);
+    case 0x2d: /* vnsra */
+      return vnshift<U>(s, v, a, true);
+    default:
+      return false;
+    }
+  return true;
+}
+
+template <typename U>
+static bool opi_sew(state_t *s, const vinsn &v, uint64_t x) {
+  if(v.funct3 == opivv) {
+    return opi<U>(s, v, vsrc<U>{vreg<U>(s, v.vs1)}, x);
+  }
+  return opi<U>(s, v, xsrc<U>{static_cast<U>(x)}, x);
+}
+
+/* vmv<nr>r.v copies whole registers and ignores vtype */
+static bool vmv_nr(state_t *s, const vinsn &v) {
+  uint32_t nr = v.vs1 + 1;
+  if(((nr & (nr - 1)) != 0) or (nr > 8) or not(group_ok(v.vd, nr)) or
+     not(group_ok(v.vs2, nr))) {
+    return false;
+  }
+  uint64_t off = (s->vtype & vtype_vill) ? 0 : v.vstart * v.sew;
+  if(off < nr * s->vlenb) {
+    memmove(vreg(s, v.vd) + off, vreg(s, v.vs2) + off, nr * s->vlenb - off);
+  }
+  return true;
+}
+
+static bool exec_opi(state_t *s, const vinsn &v, uint32_t inst) {
+  uint64_t x = s->gpr[v.vs1];
+  if(v.funct3 == opivi) {
+    switch(v.funct6)
+      {
+      case 0x0c: case 0x0e: case 0x0f:
+      case 0x25: case 0x28: case 0x29:
+      case 0x2c: case 0x2d:
+	x = v.vs1;
+	break;
+      default:
+	x = static_cast<int64_t>(static_cast<int32_t>(inst << 12) >> 27);
+	break;
+      }
+  }
+  switch(v.sew)
+    {
+    case 1:
+      return opi_sew<uint8_t>(s, v, x);
+    case 2:
+      return opi_sew<uint16_t>(s, v, x);
+    case 4:
+      return opi_sew<uint32_t>(s, v, x);
+    case 8:
+      return opi_sew<uint64_t>(s, v, x);
+    default:
+      break;
+    }
+  return false;
+}
+
+/* the op-mvv ops that work on mask registers whatever the sew */
+static bool opm_mask(state_t *s, const vinsn &v, uint32_t rd, bool &handled) {
+  handled = true;
+  const uint8_t *b = vreg(s, v.vs2);
+  if(v.funct6 == 0x10 and (v.vs1 == 0x10 or v.vs1 == 0x11)) { /* vcpop, vfirst */
+    int64_t r = v.vs1 == 0x10 ? 0 : -1;
+    uint64_t i = 0;
+    /* 64 elements a word */
+    for(; (i + 64) <= v.vl; i += 64) {
+      uint64_t w, m = ~0UL;
+      memcpy(&w, b + (i >> 3), sizeof(w));
+      if(not(v.vm)) {
+	memcpy(&m, s->vrf + (i >> 3), sizeof(m));
+      }
+      w &= m;
+      if(v.vs1 == 0x10) {
+	r += __builtin_popcountl(w);
+      }
+      else if(w) {
+	r = i + __builtin_ctzl(w);
+	break;
+      }
+    }
+    for(; ((v.vs1 == 0x10) or (r < 0)) and (i < v.vl); i++) {
+      if(active(s, v, i) and mask_bit(b, i)) {
+	if(v.vs1 == 0x11) {
+	  r = i;
+	  break;
+	}
+	r++;
+      }
+    }
+    if(rd != 0) {
+      s->gpr[rd] = r;
+    }
+    return true;
+  }
+  if(v.funct6 == 0x14 and (v.vs1 >= 1) and (v.vs1 <= 3)) { /* vmsbf, vmsof, vmsif */
+    if((v.vd == v.vs2) or (not(v.vm) and (v.vd == 0))) {
+      return false;
+    }
+    uint8_t *d = vreg(s, v.vd);
+    bool found = false;
+    for(uint64_t i = 0; i < v.vl; i++) {
+      if(not(active(s, v, i))) {
+	continue;
+      }
+      bool bit = mask_bit(b, i);
+      switch(v.vs1)
+	{
+	case 1:
+	  set_mask_bit(d, i, not(found or bit));
+	  break;
+	case 2:
+	  set_mask_bit(d, i, not(found) and bit);
+	  break;
+	default:
+	  set_mask_bit(d, i, not(found));
+	  break;
+	}
+      found |= bit;
+    }
+    return true;
+  }
+  if(v.funct6 >= 0x18 and v.funct6 <= 0x1f) {
+    if(not(v.vm)) {
+      return false;
+    }
+    const uint8_t *a = vreg(s, v.vs1);
+    uint8_t *d = vreg(s, v.vd);
+    auto op = [&v](uint8_t x, uint8_t y) -> uint8_t {
+      switch(v.funct6)
+	{
+	case 0x18: return x & ~y;
+	case 0x19: return x & y;
+	case 0x1a: return x | y;
+	case 0x1b: return x ^ y;
+	case 0x1c: return x | ~y;
+	case 0x1d: return ~(x & y);
+	case 0x1e: return ~(x | y);
+	default: return ~(x ^ y);
+	}
+    };
+    uint64_t nb = v.vl >> 3;
+    for(uint64_t j = 0; j < nb; j++) {
+      d[j] = op(b[j], a[j]);
+    }
+    for(uint64_t i = nb << 3; i < v.vl; i++) {
+      set_mask_bit(d, i, op(b[i >> 3], a[i >> 3]) & (1U << (i & 7)));
+    }
+    return true;
+  }
+  handled = false;
+  return false;
+}
+
+/* op-mvv and op-mvx */
+template <typename U, typename A>
+static bool opm(state_t *s, const vinsn &v, A a, uint64_t x) {
+  typedef typename std::make_signed<U>::type S;
+  typedef typename vwide<U>::u WU;
+  typedef typename vwide<U>::s WS;
+  const bool vv = v.funct3 == opmvv;
+  const uint32_t n = v.nregs;
+  const uint32_t bits = 8*sizeof(U);
+  uint32_t rd = v.vd;
+
+  if(v.funct6 >= 0x30) { /* widening */
+    bool wsrc = (v.funct6 >= 0x34) and (v.funct6 <= 0x37);
+    if((sizeof(U) == 8) or (v.lmul_log > 2) or not(group_ok(v.vd, v.wregs())) or
+       not(group_ok(v.vs2, wsrc ? v.wregs() : n)) or (vv and not(group_ok(v.vs1, n)))) {
+      return false;
+    }
+    switch(v.funct6)
+      {
+      case 0x30: /* vwaddu */
+	vmap_w<WU, U>(s, v, a, [](U x, U y, WU) -> WU { return static_cast<WU>(x) + static_cast<WU>(y); });
+	break;
+      case 0x31: /* vwadd */
+	vmap_w<WU, U>(s, v, a, [](U x, U y, WU) -> WU {
+	    return static_cast<WS>(static_cast<S>(x)) + static_cast<WS>(static_cast<S>(y)); });
+	break;
+      case 0x32: /* vwsubu */
+	vmap_w<WU, U>(s, v, a, [](U x, U y, WU) -> WU { return static_cast<WU>(x) - static_cast<WU>(y); });
+	break;
+      case 0x33: /* vwsub */
+	vmap_w<WU, U>(s, v, a, [](U x, U y, WU) -> WU {
+	    return static_cast<WS>(static_cast<S>(x)) - static_cast<WS>(static_cast<S>(y)); });
+	break;
+      case 0x34: /* vwaddu.w */
+	vmap_w<WU, WU>(s, v, a, [](WU x, U y, WU) -> WU { return x + static_cast<WU>(y); });
+	break;
+      case 0x35: /* vwadd.w */
+	vmap_w<WU, WU>(s, v, a, [](WU x, U y, WU) -> WU {
+	    return x + static_cast<WU>(static_cast<WS>(static_cast<S>(y))); });
+	break;
+      case 0x36: /* vwsubu.w */
+	vmap_w<WU, WU>(s, v, a, [](WU x, U y, WU) -> WU { return x - static_cast<WU>(y); });
+	break;
+      case 0x37: /* vwsub.w */
+	vmap_w<WU, WU>(s, v, a, [](WU x, U y, WU) -> WU {
+	    return x - static_cast<WU>(static_cast<WS>(static_cast<S>(y))); });
+	break;
+      case 0x38: /* vwmulu */
+	vmap_w<WU, U>(s, v, a, [](U x, U y, WU) -> WU { return static_cast<WU>(x) * static_cast<WU>(y); });
+	break;
+      case 0x3a: /* vwmulsu */
+	vmap_w<WU, U>(s, v, a, [](U x, U y, WU) -> WU {
+	    return static_cast<WS>(static_cast<S>(x)) * static_cast<WS>(y); });
+	break;
+      case 0x3b: /* vwmul */
+	vmap_w<WU, U>(s, v, a, [](U x, U y, WU) -> WU {
+	    return static_cast<WS>(static_cast<S>(x)) * static_cast<WS>(static_cast<S>(y)); });
+	break;
+      case 0x3c: /* vwmaccu */
+	vmap_w<WU, U>(s, v, a, [](U x, U y, WU d) -> WU { return d + static_cast<WU>(x) * static_cast<WU>(y); });
+	break;
+      case 0x3d: /* vwmacc */
+	vmap_w<WU, U>(s, v, a, [](U x, U y, WU d) -> WU {
+	    return d + static_cast<WU>(static_cast<WS>(static_cast<S>(x)) * static_cast<WS>(static_cast<S>(y))); });
+	break;
+      case 0x3e: /* vwmaccus */
+	if(vv) return false;
+	vmap_w<WU, U>(s, v, a, [](U x, U y, WU d) -> WU {
+	    return d + static_cast<WU>(static_cast<WS>(static_cast<S>(x)) * static_cast<WS>(y)); });
+	break;
+      case 0x3f: /* vwmaccsu */
+	vmap_w<WU, U>(s, v, a, [](U x, U y, WU d) -> WU {
+	    return d + static_cast<WU>(static_cast<WS>(x) * static_cast<WS>(static_cast<S>(y))); });
+	break;
+      default:
+	return false;
+      }
+    return true;
+  }
+
+  switch(v.funct6)
+    {
+    case 0x00: case 0x01: case 0x02: case 0x03:
+    case 0x04: case 0x05: case 0x06: case 0x07:
+      if(not(vv) or not(group_ok(v.vs2, n))) return false;
+      break;
+    case 0x10: case 0x12: case 0x14: case 0x17:
+      break;
+    default:
+      if(not(group_ok(v.vd, n)) or not(group_ok(v.vs2, n)) or (vv and not(group_ok(v.vs1, n)))) {
+	return false;
+      }
+      break;
+    }
+
+  switch(v.funct6)
+    {
+    case 0x00: /* vredsum */
+      vred<U, vk_add>(s, v, [](U x, U y) -> U { return x + y; });
+      break;
+    case 0x01: /* vredand */
+      vred<U, vk_and>(s, v, [](U x, U y) -> U { return x & y; });
+      break;
+    case 0x02: /* vredor */
+      vred<U, vk_or>(s, v, [](U x, U y) -> U { return x | y; });
+      break;
+    case 0x03: /* vredxor */
+      vred<U, vk_xor>(s, v, [](U x, U y) -> U { return x ^ y; });
+      break;
+    case 0x04: /* vredminu */
+      vred<U, vk_minu>(s, v, [](U x, U y) -> U { return x < y ? x : y; });
+      break;
+    case 0x05: /* vredmin */
+      vred<U, vk_min>(s, v, [](U x, U y) -> U { return static_cast<S>(x) < static_cast<S>(y) ? x : y; });
+      break;
+    case 0x06: /* vredmaxu */
+      vred<U, vk_maxu>(s, v, [](U x, U y) -> U { return x > y ? x : y; });
+      break;
+    case 0x07: /* vredmax */
+      vred<U, vk_max>(s, v, [](U x, U y) -> U { return static_cast<S>(x) > static_cast<S>(y) ? x : y; });
+      break;
+    case 0x0e: /* vslide1up */
+      if(vv or (v.vd == v.vs2) or not(group_ok(v.vd, n))) return false;
+      vslide<U>(s, v, true, true, 1, static_cast<U>(x));
+      break;
+    case 0x0f: /* vslide1down */
+      if(vv) return false;
+      vslide<U>(s, v, false, true, 1, static_cast<U>(x));
+      break;
+    case 0x10:
+      if(vv) { /* vmv.x.s */
+	if(v.vs1 != 0) return false;
+	if(rd != 0) {
+	  s->gpr[rd] = static_cast<S>(vreg<U>(s, v.vs2)[0]);
+	}
+      }
+      else { /* vmv.s.x */
+	if(v.vs2 != 0) return false;
+	if(v.vstart < v.vl) {
+	  vreg<U>(s, v.vd)[0] = static_cast<U>(x);
+	}
+      }
+      break;
+    case 0x12: { /* vzext, vsext */
+      if(not(vv) or not(group_ok(v.vd, n))) return false;
+      bool sgn = v.vs1 & 1;
+      switch(v.vs1 >> 1)
+	{
+	case 1: /* vf8 */
+	  return (sizeof(U) == 8) and vext<uint64_t, uint8_t>(s, v, sgn);
+	case 2: /* vf4 */
+	  if(sizeof(U) == 8) return vext<uint64_t, uint16_t>(s, v, sgn);
+	  return (sizeof(U) == 4) and vext<uint32_t, uint8_t>(s, v, sgn);
+	case 3: /* vf2 */
+	  if(sizeof(U) == 8) return vext<uint64_t, uint32_t>(s, v, sgn);
+	  if(sizeof(U) == 4) return vext<uint32_t, uint16_t>(s, v, sgn);
+	  return (sizeof(U) == 2) and vext<uint16_t, uint8_t>(s, v, sgn);
+	default:
+	  return false;
+	}
+    }
+    case 0x14: { /* viota, vid */
+      if(not(vv) or not(group_ok(v.vd, n))) return false;
+      U *d = vreg<U>(s, v.vd);
+      if(v.vs1 == 0x11) {
+	for(uint64_t i = v.vstart; i < v.vl; i++) {
+	  if(active(s, v, i)) {
+	    d[i] = i;
+	  }
+	}
+	break;
+      }
+      if((v.vs1 != 0x10) or (v.vstart != 0) or
+	 ((v.vs2 >= v.vd) and (v.vs2 < v.vd + n))) {
+	return false;
+      }
+      const uint8_t *m = vreg(s, v.vs2);
+      uint64_t c = 0;
+      for(uint64_t i = 0; i < v.vl; i++) {
+	if(active(s, v, i)) {
+	  d[i] = c;
+	  c += mask_bit(m, i);
+	}
+      }
+      break;
+    }
+    case 0x17: { /* vcompress */
+      if(not(vv) or not(v.vm) or (v.vstart != 0) or not(group_ok(v.vd, n)) or
+	 not(group_ok(v.vs2, n))) {
+	return false;
+      }
+      const U *b = vreg<U>(s, v.vs2);
+      const uint8_t *m = vreg(s, v.vs1);
+      U *d = reinterpret_cast<U*>(begin_scratch(s, v.vd, n));
+      uint64_t k = 0;
+      for(uint64_t i = 0; i < v.vl; i++) {
+	if(mask_bit(m, i)) {
+	  d[k++] = b[i];
+	}
+      }
+      end_scratch(s, v.vd, n);
+      break;
+    }
+    case 0x20: /* vdivu */
+      vmap<U>(s, v, a, [](U x, U y) -> U { return y == 0 ? static_cast<U>(~0UL) : x / y; });
+      break;
+    case 0x21: /* vdiv */
+      vmap<U>(s, v, a, [bits](U x, U y) -> U {
+	  if(y == 0) return static_cast<U>(~0UL);
+	  if((x == (static_cast<U>(1) << (bits-1))) and (y == static_cast<U>(~0UL))) return x;
+	  return static_cast<S>(x) / static_cast<S>(y); });
+      break;
+    case 0x22: /* vremu */
+      vmap<U>(s, v, a, [](U x, U y) -> U { return y == 0 ? x : x % y; });
+      break;
+    case 0x23: /* vrem */
+      vmap<U>(s, v, a, [bits](U x, U y) -> U {
+	  if(y == 0) return x;
+	  if((x == (static_cast<U>(1) << (bits-1))) and (y == static_cast<U>(~0UL))) return 0;
+	  return static_cast<S>(x) % static_cast<S>(y); });
+      break;
+    case 0x24: /* vmulhu */
+      vmap<U>(s, v, a, [bits](U x, U y) -> U { return (static_cast<WU>(x) * static_cast<WU>(y)) >> bits; });
+      break;
+    case 0x25: /* vmul */
+      vmap<U>(s, v, a, [](U x, U y) -> U { return static_cast<WU>(x) * static_cast<WU>(y); });
+      break;
+    case 0x26: /* vmulhsu */
+      vmap<U>(s, v, a, [bits](U x, U y) -> U {
+	  return (static_cast<WS>(static_cast<S>(x)) * static_cast<WS>(y)) >> bits; });
+      break;
+    case 0x27: /* vmulh */
+      vmap<U>(s, v, a, [bits](U x, U y) -> U {
+	  return (static_cast<WS>(static_cast<S>(x)) * static_cast<WS>(static_cast<S>(y))) >> bits; });
+      break;
+    case 0x29: /* vmadd */
+      vmap3<U>(s, v, a, [](U x, U y, U d) -> U { return static_cast<WU>(y) * static_cast<WU>(d) + x; });
+      break;
+    case 0x2b: /* vnmsub */
+      vmap3<U>(s, v, a, [](U x, U y, U d) -> U { return x - static_cast<WU>(y) * static_cast<WU>(d); });
+      break;
+    case 0x2d: /* vmacc */
+      vmap3<U>(s, v, a, [](U x, U y, U d) -> U { return static_cast<WU>(y) * static_cast<WU>(x) + d; });
+      break;
+    case 0x2f: /* vnmsac */
+      vmap3<U>(s, v, a, [](U x, U y, U d) -> U { return d - static_cast<WU>(y) * static_cast<WU>(x); });
+      break;
+    default:
+      return false;
+    }
+  return true;
+}
+
+template <typename U>
+static bool opm_sew(state_t *s, const vinsn &v, uint64_t x) {
+  if(v.funct3 == opmvv) {
+    return opm<U>(s, v, vsrc<U>{vreg<U>(s, v.vs1)}, x);
+  }
+  return opm<U>(s, v, xsrc<U>{static_cast<U>(x)}, x);
+}
+
+static bool exec_opm(state_t *s, const vinsn &v) {
+  if(v.funct3 == opmvv) {
+    bool handled = false;
+    bool ok = opm_mask(s, v, v.vd, handled);
+    if(handled) {
+      return ok;
+    }
+  }
+  uint64_t x = s->gpr[v.vs1];
+  switch(v.sew)
+    {
+    case 1:
+      return opm_sew<uint8_t>(s, v, x);
+    case 2:
+      return opm_sew<uint16_t>(s, v, x);
+    case 4:
+      return opm_sew<uint32_t>(s, v, x);
+    case 8:
+      return opm_sew<uint64_t>(s, v, x);
+    default:
+      break;
+    }
+  return false;
+}
+
+/* nan results are the canonical nan, as for the scalar ops */
+template <typename T>
+static inline T canon(T x) {
+  return x != x ? from_bits<T>(fp_traits<T>::qnan) : x;
+}
+
+/* 0 * inf raises invalid even when the addend is a quiet nan, as
+ * for the scalar fused ops */
+template <typename T>
+static inline T vfma(T a, T b, T c) {
+  if((std::isinf(a) and b == 0) or (a == 0 and std::isinf(b))) {
+    feraiseexcept(FE_INVALID);
+  }
+  return canon(std::fma(a, b, c));
+}
+
+/* feq and fne only signal on a signalling nan, the ordered
+ * compares on any nan */
+template <typename T>
+static inline bool fcmp_nan(typename fp_traits<T>::bits_t x,
+			    typename fp_traits<T>::bits_t y, bool quiet) {
+  if(not(is_nan<T>(x) or is_nan<T>(y))) {
+    return false;
+  }
+  if(not(quiet) or is_snan<T>(x) or is_snan<T>(y)) {
+    feraiseexcept(FE_INVALID);
+  }
+  return true;
+}
+
+/* op-fvv and op-fvf on singles (sew 32) and doubles (sew 64) */
+template <typename T, typename A, typename AB>
+static bool opf(state_t *s, const vinsn &v, A a, AB ab, uint32_t rm) {
+  typedef fp_traits<T> F;
+  typedef typename F::bits_t U;
+  typedef typename std::make_signed<U>::type S;
+  const bool vv = v.funct3 == opfvv;
+  const uint32_t n = v.nregs;
+  bool to_mask = (v.funct6 >= 0x18) and (v.funct6 <= 0x1f);
+  bool reduce = vv and (v.funct6 <= 0x07) and (v.funct6 & 1);
+  /* vs1 selects the op for the unary encodings */
+  bool unary = (v.funct6 == 0x12) or (v.funct6 == 0x13);
+  bool scalar_move = v.funct6 == 0x10;
+  if(not(scalar_move) and
+     (not(group_ok(v.vs2, n)) or not(to_mask or reduce or group_ok(v.vd, n)) or
+      (vv and not(reduce or unary) and not(group_ok(v.vs1, n))))) {
+    return false;
+  }
+  switch(v.funct6)
+    {
+    case 0x00: /* vfadd */
+      vmap<T>(s, v, a, [](T x, T y) { return canon(x + y); });
+      break;
+    case 0x01: /* vfredusum */
+    case 0x03: /* vfredosum */
+      if(not(vv)) return false;
+      vred<T>(s, v, [](T x, T y) { return canon(x + y); });
+      break;
+    case 0x02: /* vfsub */
+      vmap<T>(s, v, a, [](T x, T y) { return canon(x - y); });
+      break;
+    case 0x04: /* vfmin */
+      vmap<U>(s, v, ab, [](U x, U y) { return fminmax<T>(x, y, false); });
+      break;
+    case 0x05: /* vfredmin */
+      if(not(vv)) return false;
+      vred<U>(s, v, [](U x, U y) { return fminmax<T>(x, y, false); });
+      break;
+    case 0x06: /* vfmax */
+      vmap<U>(s, v, ab, [](U x, U y) { return fminmax<T>(x, y, true); });
+      break;
+    case 0x07: /* vfredmax */
+      if(not(vv)) return false;
+      vred<U>(s, v, [](U x, U y) { return fminmax<T>(x, y, true); });
+      break;
+    case 0x08: /* vfsgnj */
+      vmap<U>(s, v, ab, [](U x, U y) -> U { return (x & ~F::sign) | (y & F::sign); });
+      break;
+    case 0x09: /* vfsgnjn */
+      vmap<U>(s, v, ab, [](U x, U y) -> U { return (x & ~F::sign) | (~y & F::sign); });
+      break;
+    case 0x0a: /* vfsgnjx */
+      vmap<U>(s, v, ab, [](U x, U y) -> U { return x ^ (y & F::sign); });
+      break;
+    case 0x0e: /* vfslide1up */
+      if(vv or (v.vd == v.vs2)) return false;
+      vslide<U>(s, v, true, true, 1, ab[0]);
+      break;
+    case 0x0f: /* vfslide1down */
+      if(vv) return false;
+      vslide<U>(s, v, false, true, 1, ab[0]);
+      break;
+    case 0x10:
+      if(vv) { /* vfmv.f.s */
+	if(v.vs1 != 0) return false;
+	F::set(s, v.vd, vreg<U>(s, v.vs2)[0]);
+      }
+      else { /* vfmv.s.f */
+	if(v.vs2 != 0) return false;
+	if(v.vstart < v.vl) {
+	  vreg<U>(s, v.vd)[0] = ab[0];
+	}
+      }
+      break;
+    case 0x12: /* vfcvt */
+      if(not(vv)) return false;
+      switch(v.vs1)
+	{
+	case 0: /* vfcvt.xu.f */
+	case 1: /* vfcvt.x.f */
+	case 6: /* vfcvt.rtz.xu.f */
+	case 7: { /* vfcvt.rtz.x.f */
+	  uint32_t r = v.vs1 >= 6 ? 1 : rm;
+	  uint32_t kind = ((v.vs1 & 1) ? 0 : 1) + (sizeof(T) == 8 ? 2 : 0);
+	  vmap<U>(s, v, ab, [r, kind](U x, U) -> U {
+	      return fcvt_int(from_bits<T>(x), is_nan<T>(x), r, kind); });
+	  break;
+	}
+	case 2: /* vfcvt.f.xu */
+	  vmap<U>(s, v, ab, [](U x, U) -> U { return to_bits(static_cast<T>(x)); });
+	  break;
+	case 3: /* vfcvt.f.x */
+	  vmap<U>(s, v, ab, [](U x, U) -> U { return to_bits(static_cast<T>(static_cast<S>(x))); });
+	  break;
+	default:
+	  return false;
+	}
+      break;
+    case 0x13:
+      if(not(vv)) return false;
+      if(v.vs1 == 0) { /* vfsqrt */
+	vmap<T>(s, v, a, [](T x, T) { return canon(std::sqrt(x)); });
+      }
+      else if(v.vs1 == 0x10) { /* vfclass */
+	vmap<U>(s, v, ab, [](U x, U) -> U { return fclass<T>(x); });
+      }
+      else {
+	return false;
+      }
+      break;
+    case 0x17: { /* vfmerge, vfmv.v.f */
+      if(vv) return false;
+      U *d = vreg<U>(s, v.vd);
+      const U *b = vreg<U>(s, v.vs2);
+      U x = ab[0];
+      if(v.vm and (v.vs2 != 0)) return false;
+      for(uint64_t i = v.vstart; i < v.vl; i++) {
+	d[i] = (v.vm or mask_bit(s->vrf, i)) ? x : b[i];
+      }
+      break;
+    }
+    case 0x18: /* vmfeq */
+      vcmp<U>(s, v, ab, [](U x, U y) {
+	  return not(fcmp_nan<T>(x, y, true)) and (from_bits<T>(x) == from_bits<T>(y)); });
+      break;
+    case 0x19: /* vmfle */
+      vcmp<U>(s, v, ab, [](U x, U y) {
+	  return not(fcmp_nan<T>(x, y, false)) and (from_bits<T>(x) <= from_bits<T>(y)); });
+      break;
+    case 0x1b: /* vmflt */
+      vcmp<U>(s, v, ab, [](U x, U y) {
+	  return not(fcmp_nan<T>(x, y, false)) and (from_bits<T>(x) < from_bits<T>(y)); });
+      break;
+    case 0x1c: /* vmfne */
+      vcmp<U>(s, v, ab, [](U x, U y) {
+	  return fcmp_nan<T>(x, y, true) or (from_bits<T>(x) != from_bits<T>(y)); });
+      break;
+    case 0x1d: /* vmfgt */
+      if(vv) return false;
+      vcmp<U>(s, v, ab, [](U x, U y) {
+	  return not(fcmp_nan<T>(x, y, false)) and (from_bits<T>(x) > from_bits<T>(y)); });
+      break;
+    case 0x1f: /* vmfge */
+      if(vv) return false;
+      vcmp<U>(s, v, ab, [](U x, U y) {
+	  return not(fcmp_nan<T>(x, y, false)) and (from_bits<T>(x) >= from_bits<T>(y)); });
+      break;
+    case 0x20: /* vfdiv */
+      vmap<T>(s, v, a, [](T x, T y) { return canon(x / y); });
+      break;
+    case 0x21: /* vfrdiv */
+      if(vv) return false;
+      vmap<T>(s, v, a, [](T x, T y) { return canon(y / x); });
+      break;
+    case 0x24: /* vfmul */
+      vmap<T>(s, v, a, [](T x, T y) { return canon(x * y); });
+      break;
+    case 0x27: /* vfrsub */
+      if(vv) return false;
+      vmap<T>(s, v, a, [](T x, T y) { return canon(y - x); });
+      break;
+    case 0x28: /* vfmadd */
+      vmap3<T>(s, v, a, [](T x, T y, T d) { return vfma(y, d, x); });
+      break;
+    case 0x29: /* vfnmadd */
+      vmap3<T>(s, v, a, [](T x, T y, T d) { return vfma(-y, d, -x); });
+      break;
+    case 0x2a: /* vfmsub */
+      vmap3<T>(s, v, a, [](T x, T y, T d) { return vfma(y, d, -x); });
+      break;
+    case 0x2b: /* vfnmsub */
+      vmap3<T>(s, v, a, [](T x, T y, T d) { return vfma(-y, d, x); });
+      break;
+    case 0x2c: /* vfmacc */
+      vmap3<T>(s, v, a, [](T x, T y, T d) { return vfma(y, x, d); });
+      break;
+    case 0x2d: /* vfnmacc */
+      vmap3<T>(s, v, a, [](T x, T y, T d) { return vfma(-y, x, -d); });
+      break;
+    case 0x2e: /* vfmsac */
+      vmap3<T>(s, v, a, [](T x, T y, T d) { return vfma(y, x, -d); });
+      break;
+    case 0x2f: /* vfnmsac */
+      vmap3<T>(s, v, a, [](T x, T y, T d) { return vfma(-y, x, d); });
+      break;
+    default:
+      return false;
+    }
+  return true;
+}
+
+template <typename T>
+static bool opf_sew(state_t *s, const vinsn &v, uint32_t rm) {
+  typedef typename fp_traits<T>::bits_t U;
+  if(v.funct3 == opfvv) {
+    return opf<T>(s, v, vsrc<T>{vreg<T>(s, v.vs1)}, vsrc<U>{vreg<U>(s, v.vs1)}, rm);
+  }
+  U x = fp_traits<T>::get(s, v.vs1);
+  return opf<T>(s, v, xsrc<T>{from_bits<T>(x)}, xsrc<U>{x}, rm);
+}
+
+static bool exec_opf(state_t *s, const vinsn &v) {
+  uint32_t rm = (s->fcsr >> 5) & 7;
+  if(not(fp_enabled(s)) or (rm > 4)) {
+    return false;
+  }
+  bool ok = false;
+  if(v.sew == 4) {
+    ok = opf_sew<float>(s, v, rm);
+  }
+  else if(v.sew == 8) {
+    ok = opf_sew<double>(s, v, rm);
+  }
+  if(ok) {
+    fp_set_dirty(s);
+  }
+  return ok;
+}
+
+static bool vtype_ok(uint64_t vtype) {
+  uint32_t vlmul = vtype & 7, vsew = (vtype >> 3) & 7;
+  if((vtype >> 8) or (vsew > 3) or (vlmul == 4)) {
+    return false;
+  }
+  /* fractional lmul needs sew <= 64*lmul */
+  return (vlmul < 4) or ((8U << vsew) <= (64U >> (8 - vlmul)));
+}
+
+static bool exec_vset(state_t *s, uint32_t inst) {
+  uint32_t rd = (inst >> 7) & 31, rs1 = (inst >> 15) & 31;
+  uint64_t vtype = 0, avl = 0;
+  bool imm_avl = false;
+  if((inst >> 31) == 0) { /* vsetvli */
+    vtype = (inst >> 20) & 0x7ff;
+  }
+  else if(((inst >> 30) & 3) == 3) { /* vsetivli */
+    vtype = (inst >> 20) & 0x3ff;
+    avl = rs1;
+    imm_avl = true;
+  }
+  else if(((inst >> 25) & 0x7f) == 0x40) { /* vsetvl */
+    vtype = s->gpr[(inst >> 20) & 31];
+  }
+  else {
+    return false;
+  }
+  if(not(imm_avl)) {
+    if(rs1 != 0) {
+      avl = s->gpr[rs1];
+    }
+    else if(rd != 0) {
+      avl = ~0UL;
+    }
+    else {
+      avl = s->vl;
+    }
+  }
+  if(vtype_ok(vtype)) {
+    s->vtype = vtype;
+    vinsn v(s, 0);
+    s->vl = std::min(avl, v.vlmax);
+  }
+  else {
+    s->vtype = vtype_vill;
+    s->vl = 0;
+  }
+  if(rd != 0) {
+    s->gpr[rd] = s->vl;
+  }
+  return true;
+}
+
+/* element accesses of a vector load or store. the page under the
+ * last access stays translated, so a unit-stride or small-stride
+ * loop translates once per page */
+struct vmem_port {
+  state_t *s;
+  bool store;
+  uint64_t vpn;
+  uint64_t pa_page;
+  /* a ram page, not a device */
+  bool ram;
+  vmem_port(state_t *s, bool store) :
+    s(s), store(store), vpn(~0UL), pa_page(0), ram(false) {}
+  bool map(uint64_t ea) {
+    if((ea >> 12) == vpn) {
+      return true;
+    }
+    int fault = 0;
+    uint64_t pa = s->translate(ea, fault, 1, store);
+    if(fault) {
+      return false;
+    }
+    vpn = ea >> 12;
+    pa_page = pa & ~4095UL;
+    ram = not(s->mmio->is_device(pa_page));
+    return true;
+  }
+  /* device pages go through the sized accessors so a store to
+   * mtimecmp is seen */
+  void device(uint64_t pa, uint8_t *r, uint64_t len) {
+    if(store) {
+      switch(len)
+	{
+	case 8: {
+	  int64_t x;
+	  memcpy(&x, r, 8);
+	  s->store64(pa, x);
+	  return;
+	}
+	case 4: {
+	  int32_t x;
+	  memcpy(&x, r, 4);
+	  s->store32(pa, x);
+	  return;
+	}
+	case 2: {
+	  int16_t x;
+	  memcpy(&x, r, 2);
+	  s->store16(pa, x);
+	  return;
+	}
+	default:
+	  for(uint64_t i = 0; i < len; i++) {
+	    s->store8(pa + i, r[i]);
+	  }
+	  return;
+	}
+    }
+    for(uint64_t i = 0; i < len; i++) {
+      r[i] = s->load8(pa + i);
+    }
+  }
+  /* moves len bytes between r and ea, false with the faulting
+   * address in bad */
+  bool xfer(uint64_t ea, uint8_t *r, uint64_t len, uint64_t &bad) {
+    while(len != 0) {
+      uint64_t c = std::min(len, 4096 - (ea & 4095));
+      if(not(map(ea))) {
+	bad = ea;
+	return false;
+      }
+      uint64_t pa = pa_page | (ea & 4095);
+      if(not(ram)) {
+	device(pa, r, c);
+      }
+      else if(store) {
+	if(s->pdc and s->pdc->is_code(pa)) {
+	  s->pdc->invalidate(pa, c);
+	}
+	memcpy(s->mem + pa, r, c);
+      }
+      else {
+	memcpy(r, s->mem + pa, c);
+      }
+      ea += c;
+      r += c;
+      len -= c;
+    }
+    return true;
+  }
+};
+
+static inline uint64_t read_index(state_t *s, uint32_t vs2, uint64_t i, uint32_t eew) {
+  switch(eew)
+    {
+    case 1:
+      return vreg<uint8_t>(s, vs2)[i];
+    case 2:
+      return vreg<uint16_t>(s, vs2)[i];
+    case 4:
+      return vreg<uint32_t>(s, vs2)[i];
+    default:
+      return vreg<uint64_t>(s, vs2)[i];
+    }
+}
+
+static inline int lg2(uint32_t x) {
+  return __builtin_ctz(x);
+}
+
+static bool any_mask_bit(const uint8_t *m, uint64_t i, uint64_t j) {
+  for(; (i < j) and (i & 7); i++) {
+    if(mask_bit(m, i)) {
+      return true;
+    }
+  }
+  for(; (i + 8) <= j; i += 8) {
+    if(m[i >> 3]) {
+      return true;
+    }
+  }
+  for(; i < j; i++) {
+    if(mask_bit(m, i)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* d[k] = src[k] for the elements k whose mask bit i+k is set */
+template <typename U>
+static void vmem_blend(uint8_t *d, const uint8_t *src, uint64_t n, const uint8_t *m, uint64_t i) {
+  U *dd = reinterpret_cast<U*>(d);
+  const U *ss = reinterpret_cast<const U*>(src);
+  for(uint64_t k = vsimd<U, vk_merge>::mcopy(dd, ss, n, m, i); k < n; k++) {
+    if(mask_bit(m, i + k)) {
+      dd[k] = ss[k];
+    }
+  }
+}
+
+static bool exec_vmem(state_t *s, uint32_t inst, int &cause, uint64_t &tval) {
+  bool store = (inst & 127) == 0x27;
+  uint32_t width = (inst >> 12) & 7;
+  uint32_t eew = width == 0 ? 1 : 1U << (width - 4);
+  uint32_t vd = (inst >> 7) & 31, rs1 = (inst >> 15) & 31, f2 = (inst >> 20) & 31;
+  bool vm = (inst >> 25) & 1;
+  uint32_t mop = (inst >> 26) & 3, nf = ((inst >> 29) & 7) + 1;
+  uint64_t base = s->gpr[rs1];
+  vmem_port port(s, store);
+  uint64_t bad = 0;
+  if((inst >> 28) & 1) { /* mew */
+    return false;
+  }
+  if((mop == 0) and (f2 == 0x08)) { /* whole registers */
+    if(not(vm) or ((nf & (nf - 1)) != 0) or not(group_ok(vd, nf))) {
+      return false;
+    }
+    uint64_t len = nf * s->vlenb, off = s->vstart * eew;
+    if((off < len) and not(port.xfer(base + off, vreg(s, vd) + off, len - off, bad))) {
+      s->vstart = (bad - base) / eew;
+      goto fault;
+    }
+    return true;
+  }
+  if(s->vtype & vtype_vill) {
+    return false;
+  }
+  {
+    vinsn v(s, inst);
+    if((mop == 0) and (f2 == 0x0b)) { /* vlm, vsm */
+      if((eew != 1) or (nf != 1) or not(vm)) {
+	return false;
+      }
+      uint64_t len = (v.vl + 7) / 8;
+      if((v.vstart < len) and
+	 not(port.xfer(base + v.vstart, vreg(s, vd) + v.vstart, len - v.vstart, bad))) {
+	s->vstart = bad - base;
+	goto fault;
+      }
+      return true;
+    }
+    bool indexed = mop & 1, fof = false;
+    if(mop == 0) {
+      if(f2 == 0x10 and not(store)) {
+	fof = true;
+      }
+      else if(f2 != 0) {
+	return false;
+      }
+    }
+    /* data elements are sew wide for indexed ops, eew otherwise */
+    uint32_t de = indexed ? v.sew : eew;
+    int emul_log = indexed ? v.lmul_log : lg2(eew) - lg2(v.sew) + v.lmul_log;
+    int iemul_log = lg2(eew) - lg2(v.sew) + v.lmul_log;
+    if((emul_log < -3) or (emul_log > 3) or (indexed and ((iemul_log < -3) or (iemul_log > 3)))) {
+      return false;
+    }
+    uint32_t dregs = emul_log > 0 ? 1U << emul_log : 1;
+    if(((nf * dregs) > 8) or not(group_ok(vd, dregs)) or ((vd + nf * dregs) > 32)) {
+      return false;
+    }
+    if(indexed and not(group_ok(v.vs2, iemul_log > 0 ? 1U << iemul_log : 1))) {
+      return false;
+    }
+    if(v.vstart >= v.vl) {
+      return true;
+    }
+    /* an unmasked unit-stride vector is one copy per page */
+    if((mop == 0) and (nf == 1) and vm) {
+      uint64_t off = v.vstart * de;
+      if(not(port.xfer(base + off, vreg(s, vd) + off, (v.vl - v.vstart) * de, bad))) {
+	uint64_t i = (bad - base) / de;
+	if(fof and (i != 0)) {
+	  s->vl = i;
+	  return true;
+	}
+	s->vstart = i;
+	goto fault;
+      }
+      return true;
+    }
+    /* a masked unit-stride vector moves the elements of a ram page
+     * at a time under the mask. pages without an active element are
+     * not touched, elements across a page, device pages and faults
+     * go through the element loop, as does a load over v0 */
+    uint64_t i = v.vstart;
+    while((mop == 0) and (nf == 1) and (vd != 0) and (i < v.vl)) {
+      uint64_t ea = base + i * de;
+      uint64_t j = std::min(v.vl, i + (4096 - (ea & 4095)) / de);
+      if(j == i) {
+	break;
+      }
+      if(any_mask_bit(s->vrf, i, j)) {
+	if(not(port.map(ea)) or not(port.ram)) {
+	  break;
+	}
+	uint64_t pa = port.pa_page | (ea & 4095);
+	uint8_t *h = s->mem + pa, *r = vreg(s, vd) + i * de;
+	if(store and s->pdc and s->pdc->is_code(pa)) {
+	  s->pdc->invalidate(pa, (j - i) * de);
+	}
+	uint8_t *d = store ? h : r;
+	const uint8_t *src = store ? r : h;
+	switch(de)
+	  {
+	  case 1:
+	    vmem_blend<uint8_t>(d, src, j - i, s->vrf, i);
+	    break;
+	  case 2:
+	    vmem_blend<uint16_t>(d, src, j - i, s->vrf, i);
+	    break;
+	  case 4:
+	    vmem_blend<uint32_t>(d, src, j - i, s->vrf, i);
+	    break;
+	  default:
+	    vmem_blend<uint64_t>(d, src, j - i, s->vrf, i);
+	    break;
+	  }
+      }
+      i = j;
+    }
+    int64_t stride = s->gpr[v.vs2];
+    for(; i < v.vl; i++) {
+      if(not(vm or mask_bit(s->vrf, i))) {
+	continue;
+      }
+      uint64_t ea;
+      if(mop == 0) {
+	ea = base + i * nf * de;
+      }
+      else if(mop == 2) {
+	ea = base + i * stride;
+      }
+      else {
+	ea = base + read_index(s, v.vs2, i, eew);
+      }
+      for(uint32_t f = 0; f < nf; f++) {
+	if(not(port.xfer(ea + f * de, vreg(s, vd + f * dregs) + i * de, de, bad))) {
+	  if(fof and (i != 0)) {
+	    s->vl = i;
+	    return true;
+	  }
+	  s->vstart = i;
+	  goto fault;
+	}
+      }
+    }
+    return true;
+  }
+ fault:
+  cause = store ? CAUSE_STORE_PAGE_FAULT : CAUSE_LOAD_PAGE_FAULT;
+  tval = bad;
+  return false;
+}
+
+static bool exec_vop(state_t *s, uint32_t inst) {
+  vinsn v(s, inst);
+  if((v.funct3 == opivi) and (v.funct6 == 0x27)) {
+    return vmv_nr(s, v);
+  }
+  if(s->vtype & vtype_vill) {
+    return false;
+  }
+  switch(v.funct3)
+    {
+    case opivv:
+    case opivi:
+    case opivx:
+      return exec_opi(s, v, inst);
+    case opmvv:
+    case opmvx:
+      return exec_opm(s, v);
+    case opfvv:
+    case opfvf:
+      return exec_opf(s, v);
+    default:
+      break;
+    }
+  return false;
+}
+
+bool exec_vector(state_t *s, uint32_t inst, int &cause, uint64_t &tval) {
+  cause = CAUSE_ILLEGAL_INSTRUCTION;
+  tval = s->pc;
+  if(not(vec_enabled(s))) {
+    return false;
+  }
+  bool ok;
+  if((inst & 127) != 0x57) {
+    ok = exec_vmem(s, inst, cause, tval);
+  }
+  else if(((inst >> 12) & 7) == opcfg) {
+    ok = exec_vset(s, inst);
+  }
+  else {
+    ok = exec_vop(s, inst);
+  }
+  if(ok) {
+    s->vstart = 0;
+  }
+  if(ok or (cause != CAUSE_ILLEGAL_INSTRUCTION)) {
+    s->mstatus |= MSTATUS_VS;
+  }
+  return ok;
+}
+
+int64_t read_vcsr(const state_t *s, int csr_id) {
+  switch(csr_id)
+    {
+    case 0x008:
+      return s->vstart;
+    case 0x009:
+      return s->vxsat;
+    case 0x00a:
+      return s->vxrm;
+    case 0x00f:
+      return (s->vxrm << 1) | s->vxsat;
+    case 0xc20:
+      return s->vl;
+    case 0xc21:
+      return s->vtype;
+    case 0xc22:
+      return s->vlenb;
+    default:
+      break;
+    }
+  return 0;
+}
+
+bool write_vcsr(state_t *s, int csr_id, int64_t v) {
+  switch(csr_id)
+    {
+    case 0x008:
+      s->vstart = v & (8*s->vlenb - 1);
+      break;
+    case 0x009:
+      s->vxsat = v & 1;
+      break;
+    case 0x00a:
+      s->vxrm = v & 3;
+      break;
+    case 0x00f:
+      s->vxrm = (v >> 1) & 3;
+      s->vxsat = v & 1;
+      break;
+    default:
+      return false;
+    }
+  s->mstatus |= MSTATUS_VS;
+  return true;
+}
+
+void initVector(state_t *s, uint64_t vlen) {
+  s->vrf = nullptr;
+  s->vlenb = 0;
+  s->vl = 0;
+  s->vtype = vtype_vill;
+  s->vstart = 0;
+  s->vxrm = 0;
+  s->vxsat = 0;
+  if(vlen == 0) {
+    return;
+  }
+  if((vlen < 128) or (vlen > 65536) or ((vlen & (vlen - 1)) != 0)) {
+    std::cerr << "vlen must be a power of two from 128 to 65536\n";
+    exit(-1);
+  }
+  s->vlenb = vlen / 8;
+  /* 32 registers and an 8 register scratch group, see begin_scratch */
+  void *p = nullptr;
+  int rc = posix_memalign(&p, 64, 40 * s->vlenb);
+  assert(rc == 0);
+  memset(p, 0, 40 * s->vlenb);
+  s->vrf = reinterpret_cast<uint8_t*>(p);
+  s->misa |= 1L << ('v' - 'a');
+  s->mstatus = (s->mstatus & ~MSTATUS_VS) | (1 << MSTATUS_VS_SHIFT);
+}
@@ -0,0 +1,30 @@
+#ifndef __VECTOR_HH__
+#define __VECTOR_HH__
+
+#include <cstdint>
+#include "interpret.hh"
+
+/* rvv 1.0. the 32 vector registers sit back to back in s->vrf so
+ * a register group is one contiguous array of elements, and the
+ * element loops run over plain host arrays that the compiler turns
+ * into avx2/avx-512 code under -march=native. memory ops translate
+ * once per page and copy whole page chunks when they can */
+
+/* allocates the register file and advertises v in misa. vlen is in
+ * bits, 0 leaves the v extension off */
+void initVector(state_t *s, uint64_t vlen);
+
+static inline bool vec_enabled(const state_t *s) {
+  return s->vrf and ((s->mstatus & MSTATUS_VS) != 0);
+}
+
+/* op-v (0x57) and the vector forms of 0x07/0x27. false when the
+ * instruction traps, with cause and tval set */
+bool exec_vector(state_t *s, uint32_t inst, int &cause, uint64_t &tval);
+
+/* vstart, vxsat, vxrm, vcsr and the read-only vl, vtype and vlenb.
+ * write_vcsr returns false for the read-only ones */
+int64_t read_vcsr(const state_t *s, int csr_id);
+bool write_vcsr(state_t *s, int csr_id, int64_t v);
+
+#endif